@@ -0,0 +1,282 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#include "monero_scheduler.h"
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+
+/**
+ * Implements monero_scheduler.h.
+ */
+namespace monero {
+
+  static uint32_t get_default_num_workers() {
+    return std::max(2u, boost::thread::hardware_concurrency());
+  }
+
+  // -------------------------------- EXECUTOR --------------------------------
+
+  monero_executor::monero_executor(uint32_t num_workers) : m_is_closing(false) {
+    if (num_workers == 0) num_workers = get_default_num_workers();
+    for (uint32_t i = 0; i < num_workers; i++) m_workers.push_back(boost::thread([this]() { run_worker(); }));
+  }
+
+  monero_executor::~monero_executor() {
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_is_closing = true;
+    }
+    m_cv.notify_all();
+    for (boost::thread& worker : m_workers) worker.join();
+  }
+
+  void monero_executor::submit(std::function<void()> task) {
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (m_is_closing) throw std::runtime_error("Executor is closed");
+      m_tasks.push_back(std::move(task));
+    }
+    m_cv.notify_one();
+  }
+
+  void monero_executor::run_worker() {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (true) {
+      while (!m_is_closing && m_tasks.empty()) m_cv.wait(lock);
+      if (m_tasks.empty()) return; // closing
+      std::function<void()> task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+      lock.unlock();
+      try { task(); }
+      catch (std::exception const& e) { std::cout << "monero_executor task failed: " << e.what() << std::endl; }
+      catch (...) { std::cout << "monero_executor task failed" << std::endl; }
+      lock.lock();
+    }
+  }
+
+  // --------------------------------- STRAND ---------------------------------
+
+  // strand whose task is running on the current thread
+  static thread_local monero_strand* t_strand = nullptr;
+
+  monero_strand::~monero_strand() {
+    wait();
+  }
+
+  void monero_strand::post(std::function<void()> task) {
+    if (m_executor == nullptr) throw std::runtime_error("Strand has no executor to run posted tasks");
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_tasks.push_back(std::move(task));
+    if (!m_is_running) {
+      m_is_running = true;
+      m_executor->submit([this]() { drain(); });
+    }
+  }
+
+  void monero_strand::run(std::function<void()> task) {
+
+    // run nested task inline since the strand is held by the current thread
+    if (t_strand == this) {
+      task();
+      return;
+    }
+
+    // acquire the strand
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_num_waiting++;
+    while (m_is_running) m_cv.wait(lock);
+    m_num_waiting--;
+    m_is_running = true;
+    lock.unlock();
+
+    // run task on the calling thread
+    monero_strand* prev_strand = t_strand;
+    t_strand = this;
+    std::exception_ptr error;
+    try { task(); }
+    catch (...) { error = std::current_exception(); }
+    t_strand = prev_strand;
+
+    // release the strand
+    lock.lock();
+    release();
+    lock.unlock();
+    if (error) std::rethrow_exception(error);
+  }
+
+  void monero_strand::wait() {
+    if (t_strand == this) return;
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (m_is_running || !m_tasks.empty() || m_num_waiting > 0) m_cv.wait(lock);
+  }
+
+  size_t monero_strand::get_num_queued() {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_tasks.size() + m_num_waiting;
+  }
+
+  void monero_strand::drain() {
+    monero_strand* prev_strand = t_strand;
+    t_strand = this;
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (!m_tasks.empty() && m_num_waiting == 0) { // let callers of run() take turns with queued tasks
+      std::function<void()> task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+      lock.unlock();
+      try { task(); }
+      catch (std::exception const& e) { std::cout << "monero_strand task failed: " << e.what() << std::endl; }
+      catch (...) { std::cout << "monero_strand task failed" << std::endl; }
+      lock.lock();
+    }
+    t_strand = prev_strand;
+    release();
+  }
+
+  void monero_strand::release() {
+    if (!m_tasks.empty() && m_num_waiting == 0) m_executor->submit([this]() { drain(); }); // tasks are only queued with an executor
+    else {
+      m_is_running = false;
+      m_cv.notify_all();
+    }
+  }
+
+  // ------------------------------- SCHEDULER --------------------------------
+
+  monero_scheduler& monero_scheduler::get_instance() {
+    static monero_scheduler instance;
+    return instance;
+  }
+
+  monero_scheduler::monero_scheduler(uint32_t num_workers, uint64_t tick_ms, size_t num_slots) : m_executor(num_workers), m_tick_ms(tick_ms), m_slots(num_slots), m_cursor(0), m_next_id(1), m_is_closing(false) {
+    if (tick_ms == 0 || num_slots == 0) throw std::runtime_error("Scheduler tick and number of slots must be positive");
+    m_timer_thread = boost::thread([this]() { run_timer(); });
+  }
+
+  monero_scheduler::~monero_scheduler() {
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_is_closing = true;
+    }
+    m_cv.notify_all();
+    m_timer_thread.join();
+  }
+
+  uint64_t monero_scheduler::schedule(uint64_t delay_ms, std::function<void()> task, monero_executor* executor) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    if (m_is_closing) throw std::runtime_error("Scheduler is closed");
+    uint64_t timer_id = m_next_id++;
+    if (executor == nullptr) executor = &m_executor;
+
+    // submit immediately if due
+    if (delay_ms == 0) {
+      executor->submit(std::move(task));
+      return timer_id;
+    }
+
+    // add to slot of due tick
+    uint64_t num_ticks = (delay_ms + m_tick_ms - 1) / m_tick_ms;
+    size_t slot_idx = (m_cursor + num_ticks) % m_slots.size();
+    std::list<timer>& slot = m_slots[slot_idx];
+    slot.push_back(timer{timer_id, (num_ticks - 1) / m_slots.size(), std::move(task), executor});
+    m_timers[timer_id] = std::make_pair(slot_idx, std::prev(slot.end()));
+    if (m_timers.size() == 1) m_cv.notify_one(); // wake idle timer thread
+    return timer_id;
+  }
+
+  bool monero_scheduler::cancel(uint64_t timer_id) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    std::unordered_map<uint64_t, std::pair<size_t, std::list<timer>::iterator>>::iterator iter = m_timers.find(timer_id);
+    if (iter == m_timers.end()) return false;
+    m_slots[iter->second.first].erase(iter->second.second);
+    m_timers.erase(iter);
+    return true;
+  }
+
+  void monero_scheduler::run_timer() {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    std::chrono::steady_clock::time_point next_tick = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_tick_ms);
+    while (!m_is_closing) {
+
+      // sleep until timers are added
+      if (m_timers.empty()) {
+        while (!m_is_closing && m_timers.empty()) m_cv.wait(lock);
+        next_tick = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_tick_ms);
+        continue;
+      }
+
+      // sleep until next tick
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now < next_tick) {
+        m_cv.wait_for(lock, boost::chrono::milliseconds(std::chrono::duration_cast<std::chrono::milliseconds>(next_tick - now).count() + 1));
+        continue;
+      }
+      next_tick += std::chrono::milliseconds(m_tick_ms);
+
+      // advance wheel and submit due timers
+      m_cursor = (m_cursor + 1) % m_slots.size();
+      std::list<timer>& slot = m_slots[m_cursor];
+      for (std::list<timer>::iterator iter = slot.begin(); iter != slot.end(); ) {
+        if (iter->m_rounds > 0) {
+          iter->m_rounds--;
+          iter++;
+          continue;
+        }
+        iter->m_executor->submit(std::move(iter->m_task));
+        m_timers.erase(iter->m_id);
+        iter = slot.erase(iter);
+      }
+    }
+  }
+}
@@ -0,0 +1,254 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#pragma once
+
+#ifndef monero_scheduler_h
+#define monero_scheduler_h
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/**
+ * Process-wide executors shared by wallets for background work.
+ */
+namespace monero {
+
+  /**
+   * Bounded pool of worker threads which run submitted tasks in FIFO order.
+   */
+  class monero_executor {
+  public:
+
+    /**
+     * Construct an executor.
+     *
+     * @param num_workers is the number of worker threads (default number of cores, at least 2)
+     */
+    monero_executor(uint32_t num_workers = 0);
+
+    /**
+     * Run queued tasks and stop the worker threads.
+     */
+    ~monero_executor();
+
+    /**
+     * Queue a task to run on a worker thread.
+     *
+     * @param task is the task to run
+     */
+    void submit(std::function<void()> task);
+
+    uint32_t get_num_workers() const { return m_workers.size(); }
+
+  private:
+    boost::mutex m_mutex;
+    boost::condition_variable m_cv;               // wakes workers when tasks are queued or closing
+    std::deque<std::function<void()>> m_tasks;    // queued tasks
+    bool m_is_closing;                            // stops workers once the queue is empty
+    std::vector<boost::thread> m_workers;
+
+    void run_worker();
+  };
+
+  /**
+   * Runs tasks one at a time in submission order on a shared executor.
+   *
+   * Strands let many owners share a bounded executor while each owner's tasks
+   * keep their order and never run concurrently with each other.
+   *
+   * Tasks given to run() execute on the calling thread once the strand is
+   * free, so callers which block on them never hold an executor worker, and
+   * tasks which run() on their own strand execute inline.  A strand whose
+   * tasks only run() needs no executor.
+   */
+  class monero_strand {
+  public:
+
+    /**
+     * Construct a strand.
+     *
+     * @param executor runs the strand's posted tasks, or null if tasks are only run() on callers' threads
+     */
+    monero_strand(monero_executor* executor = nullptr) : m_executor(executor), m_is_running(false), m_num_waiting(0) { }
+
+    /**
+     * Wait for queued tasks and destroy the strand.
+     */
+    ~monero_strand();
+
+    /**
+     * Queue a task to run after previously queued tasks.  Throws if the
+     * strand has no executor.
+     *
+     * @param task is the task to run
+     */
+    void post(std::function<void()> task);
+
+    /**
+     * Run a task on the calling thread once the strand is free, rethrowing its
+     * exception if any.  Runs the task immediately if called from a task of
+     * this strand.
+     *
+     * @param task is the task to run
+     */
+    void run(std::function<void()> task);
+
+    /**
+     * Wait for queued tasks to run.  Returns immediately if called from a task
+     * of this strand.
+     */
+    void wait();
+
+    /**
+     * Get the number of tasks queued or waiting to run and not yet running.
+     */
+    size_t get_num_queued();
+
+  private:
+    monero_executor* m_executor;                  // runs posted tasks, null if none
+    boost::mutex m_mutex;
+    boost::condition_variable m_cv;               // wakes waiters when the queue is drained
+    std::deque<std::function<void()>> m_tasks;    // queued tasks
+    bool m_is_running;                            // a task is running on the executor or a caller of run()
+    size_t m_num_waiting;                         // callers of run() waiting for the strand
+
+    void drain();
+    void release();                               // pass the strand to queued tasks or mark it free; caller must hold m_mutex
+  };
+
+  /**
+   * Runs tasks after a delay using a hashed timer wheel.
+   *
+   * A single timer thread advances the wheel one slot per tick and submits due
+   * tasks to the scheduler's executor or to the executor given with the timer,
+   * so scheduling and canceling timers is O(1) regardless of how many are
+   * pending, and short periodic tasks need not queue behind long ones.
+   */
+  class monero_scheduler {
+  public:
+
+    /**
+     * Get the process-wide scheduler.
+     */
+    static monero_scheduler& get_instance();
+
+    /**
+     * Construct a scheduler.
+     *
+     * @param num_workers is the number of worker threads which run due tasks (default number of cores, at least 2)
+     * @param tick_ms is the resolution of timers in milliseconds
+     * @param num_slots is the number of slots in the timer wheel
+     */
+    monero_scheduler(uint32_t num_workers = 0, uint64_t tick_ms = 50, size_t num_slots = 512);
+
+    /**
+     * Cancel pending timers and stop the scheduler.
+     */
+    ~monero_scheduler();
+
+    /**
+     * Run a task after a delay.
+     *
+     * @param delay_ms is the minimum time to wait in milliseconds before running the task
+     * @param task is the task to run
+     * @param executor runs the task (default the scheduler's executor)
+     * @return the timer's id to cancel it
+     */
+    uint64_t schedule(uint64_t delay_ms, std::function<void()> task, monero_executor* executor = nullptr);
+
+    /**
+     * Cancel a timer before it is due.
+     *
+     * @param timer_id is the id of the timer to cancel
+     * @return true if the timer was canceled, false if its task is already submitted
+     */
+    bool cancel(uint64_t timer_id);
+
+    /**
+     * Get the executor which runs due tasks.
+     */
+    monero_executor& get_executor() { return m_executor; }
+
+  private:
+
+    // pending timer in a slot of the wheel
+    struct timer {
+      uint64_t m_id;
+      uint64_t m_rounds;                          // number of revolutions remaining before due
+      std::function<void()> m_task;
+      monero_executor* m_executor;                // runs the task when due
+    };
+
+    monero_executor m_executor;
+    const uint64_t m_tick_ms;
+    boost::mutex m_mutex;
+    boost::condition_variable m_cv;               // wakes timer thread when timers are added or closing
+    std::vector<std::list<timer>> m_slots;        // wheel of timers by due tick modulo number of slots
+    std::unordered_map<uint64_t, std::pair<size_t, std::list<timer>::iterator>> m_timers; // timer id to its slot and position
+    size_t m_cursor;                              // slot of the current tick
+    uint64_t m_next_id;
+    bool m_is_closing;
+    boost::thread m_timer_thread;
+
+    void run_timer();
+  };
+}
+
+#endif /* monero_scheduler_h */
@@ -217,6 +217,12 @@ void monero_utils::add_json_member(std::string key, std::string val, rapidjson::
   root.AddMember(field_key, field, allocator);
 }
 
+void monero_utils::add_json_member(std::string key, double val, rapidjson::Document::AllocatorType& allocator, rapidjson::Value& root, rapidjson::Value& field) {
+  rapidjson::Value field_key(key.c_str(), key.size(), allocator);
+  field.SetDouble(val);
+  root.AddMember(field_key, field, allocator);
+}
+
 void monero_utils::add_json_member(std::string key, bool val, rapidjson::Document::AllocatorType& allocator, rapidjson::Value& root) {
   rapidjson::Value field_key(key.c_str(), key.size(), allocator);
   if (val) {
@@ -0,0 +1,621 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#include "monero_sync_coordinator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include "net/http_client.h"
+#include "crypto/hash.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "rpc/core_rpc_server_commands_defs.h"
+#include "storages/portable_storage_template_helper.h"
+#include "string_tools.h"
+
+/**
+ * Implements monero_sync_coordinator.h.
+ */
+namespace monero {
+
+  // ------------------------- INITIALIZE CONSTANTS ---------------------------
+
+  static const char* const CACHED_URIS[] = { "/getblocks.bin", "/gethashes.bin" }; // daemon requests whose responses are shared between wallets
+  static const char* const BLOCKS_URI = "/getblocks.bin";                             // daemon request whose blocks are also cached by height range
+  static const uint64_t MAX_BLOCKS_PER_RESPONSE = 1000;                               // maximum blocks the daemon returns per /getblocks.bin request
+  static thread_local monero_wallet_full* t_syncing_wallet = nullptr; // wallet being synced by the current worker thread, if any
+
+  // ------------------------------ BLOCK CACHE -------------------------------
+
+  /**
+   * Blocks of a daemon /getblocks.bin response, which can be served to a wallet
+   * from any height in the range.
+   */
+  struct monero_block_range {
+    epee::net_utils::http::http_response_info m_response_info;                  // response without body
+    cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::response m_response;               // parsed response without blocks and output indices
+    std::vector<cryptonote::block_complete_entry> m_blocks;                     // blocks from the start height
+    std::vector<cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices> m_output_indices; // output indices per block
+    std::vector<crypto::hash> m_block_hashes;                                   // hash per block
+    size_t m_num_bytes = 0;                                                     // size of block and tx blobs
+    uint64_t start_height() const { return m_response.start_height; }
+    uint64_t end_height() const { return m_response.start_height + m_block_hashes.size(); } // exclusive
+  };
+
+  /**
+   * Bounded cache of daemon responses keyed by daemon and request.
+   *
+   * Identical requests from wallets at the same sync position receive the same
+   * response, so the first request fetches from the daemon while concurrent
+   * identical requests wait for it. Blocks are also cached by height range, so
+   * wallets at other positions within a range are served from their own start
+   * height. Responses expire after a short time so wallets at the chain tip see
+   * new blocks, and the least recently used responses are evicted when the
+   * cache is full.
+   */
+  struct monero_block_cache {
+
+    monero_block_cache(size_t max_bytes, uint64_t ttl_ms) : m_max_bytes(max_bytes), m_ttl_ms(ttl_ms), m_num_bytes(0), m_num_hits(0), m_num_misses(0) { }
+
+    /**
+     * Get the cached response to a request or fetch it once for all concurrent requesters.
+     *
+     * @param request uniquely identifies the daemon request
+     * @param fetcher fetches the response from the daemon, returning null on failure
+     * @return the response or null if the fetch failed
+     */
+    std::shared_ptr<const epee::net_utils::http::http_response_info> get(const std::string& request, const std::function<std::shared_ptr<const epee::net_utils::http::http_response_info>()>& fetcher) {
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+
+      // return cached response or wait for in-flight fetch
+      while (true) {
+        std::unordered_map<std::string, entry>::iterator iter = m_entries.find(request);
+        if (iter == m_entries.end()) break;
+        if (iter->second.m_is_fetching) {
+          m_cv.wait(lock);
+          continue;
+        }
+        if (std::chrono::steady_clock::now() - iter->second.m_fetch_time >= std::chrono::milliseconds(m_ttl_ms)) {
+          erase(iter);
+          break;
+        }
+        m_lru.splice(m_lru.begin(), m_lru, iter->second.m_lru_iter);
+        m_num_hits++;
+        return iter->second.m_response;
+      }
+
+      // claim fetch
+      m_entries[request].m_is_fetching = true;
+      m_num_misses++;
+      lock.unlock();
+      std::shared_ptr<const epee::net_utils::http::http_response_info> response;
+      try {
+        response = fetcher();
+      } catch (...) {
+        lock.lock();
+        m_entries.erase(request);
+        m_cv.notify_all();
+        throw;
+      }
+      lock.lock();
+
+      // cache successful response within budget
+      std::unordered_map<std::string, entry>::iterator iter = m_entries.find(request);
+      if (response == nullptr || response->m_response_code != 200 || size_of(request, *response) > m_max_bytes) m_entries.erase(iter);
+      else {
+        iter->second.m_response = response;
+        iter->second.m_is_fetching = false;
+        iter->second.m_fetch_time = std::chrono::steady_clock::now();
+        m_lru.push_front(lru_item(&iter->first));
+        iter->second.m_lru_iter = m_lru.begin();
+        m_num_bytes += size_of(request, *response);
+        evict();
+      }
+      m_cv.notify_all(); // waiters use cached response or fetch themselves
+      return response;
+    }
+
+    /**
+     * Get a cached range of blocks which contains a block at a height and
+     * at least one block after it.
+     *
+     * @param prefix identifies the daemon and request options of the range
+     * @param height is the height of the block
+     * @param block_hash is the expected hash of the block, which confirms the range is on the requester's chain
+     * @return the range containing the block or null if not cached
+     */
+    std::shared_ptr<const monero_block_range> get_range(const std::string& prefix, uint64_t height, const crypto::hash& block_hash) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      std::unordered_map<std::string, std::map<uint64_t, range_entry>>::iterator prefix_iter = m_ranges.find(prefix);
+      if (prefix_iter == m_ranges.end()) return nullptr;
+      std::map<uint64_t, range_entry>& ranges = prefix_iter->second;
+
+      // check ranges which start at or below the height, the latest first
+      std::map<uint64_t, range_entry>::iterator iter = ranges.upper_bound(height);
+      while (iter != ranges.begin()) {
+        iter--;
+        if (iter->first + MAX_BLOCKS_PER_RESPONSE <= height) break; // daemon responses are bounded
+        const monero_block_range& range = *iter->second.m_range;
+        if (height + 1 >= range.end_height() || range.m_block_hashes[height - range.start_height()] != block_hash) continue;
+        if (std::chrono::steady_clock::now() - iter->second.m_fetch_time >= std::chrono::milliseconds(m_ttl_ms)) continue;
+        m_lru.splice(m_lru.begin(), m_lru, iter->second.m_lru_iter);
+        m_num_hits++;
+        return iter->second.m_range;
+      }
+      return nullptr;
+    }
+
+    /**
+     * Cache a range of blocks fetched from the daemon.
+     *
+     * @param prefix identifies the daemon and request options of the range
+     * @param range is the range of blocks to cache
+     */
+    void add_range(const std::string& prefix, const std::shared_ptr<const monero_block_range>& range) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (range->m_num_bytes > m_max_bytes) return;
+      std::unordered_map<std::string, std::map<uint64_t, range_entry>>::iterator prefix_iter = m_ranges.find(prefix);
+      if (prefix_iter == m_ranges.end()) prefix_iter = m_ranges.insert(std::make_pair(prefix, std::map<uint64_t, range_entry>())).first;
+      std::map<uint64_t, range_entry>::iterator iter = prefix_iter->second.find(range->start_height());
+      if (iter != prefix_iter->second.end()) erase_range(prefix_iter, iter); // replace older range from the same height
+      range_entry& entry = prefix_iter->second[range->start_height()];
+      entry.m_range = range;
+      entry.m_fetch_time = std::chrono::steady_clock::now();
+      m_lru.push_front(lru_item(&prefix_iter->first, range->start_height()));
+      entry.m_lru_iter = m_lru.begin();
+      m_num_bytes += range->m_num_bytes;
+      evict();
+    }
+
+    /**
+     * Remove expired responses.
+     */
+    void prune() {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      for (std::unordered_map<std::string, entry>::iterator iter = m_entries.begin(); iter != m_entries.end(); ) {
+        if (iter->second.m_is_fetching || now - iter->second.m_fetch_time < std::chrono::milliseconds(m_ttl_ms)) iter++;
+        else iter = erase(iter);
+      }
+      for (std::unordered_map<std::string, std::map<uint64_t, range_entry>>::iterator prefix_iter = m_ranges.begin(); prefix_iter != m_ranges.end(); ) {
+        std::map<uint64_t, range_entry>& ranges = prefix_iter->second;
+        for (std::map<uint64_t, range_entry>::iterator iter = ranges.begin(); iter != ranges.end(); ) {
+          if (now - iter->second.m_fetch_time < std::chrono::milliseconds(m_ttl_ms)) iter++;
+          else iter = erase_range(prefix_iter, iter);
+        }
+        if (ranges.empty()) prefix_iter = m_ranges.erase(prefix_iter);
+        else prefix_iter++;
+      }
+    }
+
+    uint64_t get_num_hits() const { return m_num_hits; }
+    uint64_t get_num_misses() const { return m_num_misses; }
+
+  private:
+
+    // cached response or range in recency list, identified by request or by range prefix and start height
+    struct lru_item {
+      lru_item(const std::string* request) : m_request(request), m_prefix(nullptr), m_start_height(0) { }
+      lru_item(const std::string* prefix, uint64_t start_height) : m_request(nullptr), m_prefix(prefix), m_start_height(start_height) { }
+      const std::string* m_request;
+      const std::string* m_prefix;
+      uint64_t m_start_height;
+    };
+
+    // cached or in-flight response
+    struct entry {
+      std::shared_ptr<const epee::net_utils::http::http_response_info> m_response;
+      bool m_is_fetching = false;
+      std::chrono::steady_clock::time_point m_fetch_time;
+      std::list<lru_item>::iterator m_lru_iter;           // position in recency list if cached
+    };
+
+    // cached range of blocks
+    struct range_entry {
+      std::shared_ptr<const monero_block_range> m_range;
+      std::chrono::steady_clock::time_point m_fetch_time;
+      std::list<lru_item>::iterator m_lru_iter;           // position in recency list
+    };
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_cv;                       // wakes requests waiting for an in-flight fetch
+    const size_t m_max_bytes;
+    const uint64_t m_ttl_ms;
+    std::unordered_map<std::string, entry> m_entries;     // responses by request
+    std::unordered_map<std::string, std::map<uint64_t, range_entry>> m_ranges; // block ranges by prefix and start height
+    std::list<lru_item> m_lru;                            // cached responses and ranges from most to least recently used
+    size_t m_num_bytes;                                   // size of cached requests, responses, and ranges
+    std::atomic<uint64_t> m_num_hits;
+    std::atomic<uint64_t> m_num_misses;
+
+    static size_t size_of(const std::string& request, const epee::net_utils::http::http_response_info& response) {
+      return request.size() + response.m_body.size();
+    }
+
+    // erase a cached response; caller must hold m_mutex
+    std::unordered_map<std::string, entry>::iterator erase(std::unordered_map<std::string, entry>::iterator iter) {
+      m_num_bytes -= size_of(iter->first, *iter->second.m_response);
+      m_lru.erase(iter->second.m_lru_iter);
+      return m_entries.erase(iter);
+    }
+
+    // erase a cached range, leaving its prefix; caller must hold m_mutex
+    std::map<uint64_t, range_entry>::iterator erase_range(std::unordered_map<std::string, std::map<uint64_t, range_entry>>::iterator prefix_iter, std::map<uint64_t, range_entry>::iterator iter) {
+      m_num_bytes -= iter->second.m_range->m_num_bytes;
+      m_lru.erase(iter->second.m_lru_iter);
+      return prefix_iter->second.erase(iter);
+    }
+
+    // evict least recently used responses and ranges until within budget; caller must hold m_mutex
+    void evict() {
+      while (m_num_bytes > m_max_bytes) {
+        const lru_item& item = m_lru.back();
+        if (item.m_request != nullptr) erase(m_entries.find(*item.m_request));
+        else {
+          std::unordered_map<std::string, std::map<uint64_t, range_entry>>::iterator prefix_iter = m_ranges.find(*item.m_prefix);
+          erase_range(prefix_iter, prefix_iter->second.find(item.m_start_height));
+          if (prefix_iter->second.empty()) m_ranges.erase(prefix_iter);
+        }
+      }
+    }
+  };
+
+  // ------------------------- CACHING HTTP CLIENT ----------------------------
+
+  /**
+   * Http client which serves daemon block requests from the shared cache and
+   * forwards all other requests to the underlying client.
+   *
+   * The client remembers the last block it returned to its wallet, which is
+   * the top of the wallet's chain when it requests the next blocks, so a cached
+   * range containing that block can serve the wallet from its own height.
+   */
+  class monero_caching_http_client : public epee::net_utils::http::abstract_http_client {
+  public:
+    monero_caching_http_client(std::unique_ptr<epee::net_utils::http::abstract_http_client> client, std::shared_ptr<monero_block_cache> cache) : m_client(std::move(client)), m_cache(cache) { }
+
+    using epee::net_utils::http::abstract_http_client::set_server;
+
+    bool set_proxy(const std::string& address) override {
+      return m_client->set_proxy(address);
+    }
+
+    void set_server(std::string host, std::string port, boost::optional<epee::net_utils::http::login> user, epee::net_utils::ssl_options_t ssl_options = epee::net_utils::ssl_support_t::e_ssl_support_autodetect) override {
+      m_server = host + ":" + port;
+      if (user) {
+        crypto::hash password_hash;
+        crypto::cn_fast_hash(user->password.data(), user->password.size(), password_hash);
+        m_server += '\0' + user->username + '\0' + epee::string_tools::pod_to_hex(password_hash);
+      }
+      m_client->set_server(std::move(host), std::move(port), std::move(user), std::move(ssl_options));
+    }
+
+    void set_auto_connect(bool auto_connect) override {
+      m_client->set_auto_connect(auto_connect);
+    }
+
+    bool connect(std::chrono::milliseconds timeout) override {
+      return m_client->connect(timeout);
+    }
+
+    bool disconnect() override {
+      return m_client->disconnect();
+    }
+
+    bool is_connected(bool *ssl = NULL) override {
+      return m_client->is_connected(ssl);
+    }
+
+    bool invoke(const boost::string_ref uri, const boost::string_ref method, const boost::string_ref body, std::chrono::milliseconds timeout, const epee::net_utils::http::http_response_info** ppresponse_info = NULL, const epee::net_utils::http::fields_list& additional_params = epee::net_utils::http::fields_list()) override {
+      if (method != "POST" || !is_cached(uri)) return m_client->invoke(uri, method, body, timeout, ppresponse_info, additional_params);
+      return invoke_cached(uri, body, [&](const epee::net_utils::http::http_response_info** response_info) { return m_client->invoke(uri, method, body, timeout, response_info, additional_params); }, ppresponse_info);
+    }
+
+    bool invoke_get(const boost::string_ref uri, std::chrono::milliseconds timeout, const std::string& body = std::string(), const epee::net_utils::http::http_response_info** ppresponse_info = NULL, const epee::net_utils::http::fields_list& additional_params = epee::net_utils::http::fields_list()) override {
+      return m_client->invoke_get(uri, timeout, body, ppresponse_info, additional_params);
+    }
+
+    bool invoke_post(const boost::string_ref uri, const std::string& body, std::chrono::milliseconds timeout, const epee::net_utils::http::http_response_info** ppresponse_info = NULL, const epee::net_utils::http::fields_list& additional_params = epee::net_utils::http::fields_list()) override {
+      if (!is_cached(uri)) return m_client->invoke_post(uri, body, timeout, ppresponse_info, additional_params);
+      return invoke_cached(uri, body, [&](const epee::net_utils::http::http_response_info** response_info) { return m_client->invoke_post(uri, body, timeout, response_info, additional_params); }, ppresponse_info);
+    }
+
+    uint64_t get_bytes_sent() const override {
+      return m_client->get_bytes_sent();
+    }
+
+    uint64_t get_bytes_received() const override {
+      return m_client->get_bytes_received();
+    }
+
+  private:
+    std::unique_ptr<epee::net_utils::http::abstract_http_client> m_client;  // underlying client connected to the daemon
+    std::shared_ptr<monero_block_cache> m_cache;                           // cache shared with other wallets' clients
+    std::shared_ptr<const epee::net_utils::http::http_response_info> m_response; // last cached response, valid until the next request like the underlying client's
+    std::string m_server;                                                  // daemon address and login (password hashed) which prefix cache keys
+    boost::optional<uint64_t> m_top_height;                                // height of the last block returned, expected to top the wallet's next block request
+    crypto::hash m_top_hash;                                               // hash of the last block returned
+
+    static bool is_cached(const boost::string_ref uri) {
+      for (const char* cached_uri : CACHED_URIS) if (uri == cached_uri) return true;
+      return false;
+    }
+
+    bool invoke_cached(const boost::string_ref uri, const boost::string_ref body, const std::function<bool(const epee::net_utils::http::http_response_info**)>& invoke_client, const epee::net_utils::http::http_response_info** ppresponse_info) {
+
+      // serve blocks from a cached range which contains the wallet's top block
+      std::string range_prefix;
+      if (uri == BLOCKS_URI) {
+        cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::request blocks_request;
+        if (epee::serialization::load_t_from_binary(blocks_request, std::string(body.data(), body.size())) && !blocks_request.block_ids.empty()) {
+          range_prefix = m_server + '\0' + (blocks_request.prune ? '1' : '0') + (blocks_request.no_miner_tx ? '1' : '0');
+          if (serve_range(range_prefix, blocks_request, ppresponse_info)) return true;
+        }
+        m_top_height = boost::none;
+      }
+
+      // otherwise fetch identical requests once
+      std::string request(m_server);
+      request.push_back('\0');
+      request.append(uri.data(), uri.size());
+      request.push_back('\0');
+      request.append(body.data(), body.size());
+      bool is_fetched = false;
+      m_response = m_cache->get(request, [&]() -> std::shared_ptr<const epee::net_utils::http::http_response_info> {
+        const epee::net_utils::http::http_response_info* response_info = nullptr;
+        if (!invoke_client(&response_info) || response_info == nullptr) return nullptr;
+        is_fetched = true;
+        return std::make_shared<epee::net_utils::http::http_response_info>(*response_info);
+      });
+      if (m_response == nullptr) return false;
+      if (is_fetched && !range_prefix.empty()) add_range(range_prefix, *m_response); // requesters of identical requests stay on the identical path
+      if (ppresponse_info) *ppresponse_info = m_response.get();
+      return true;
+    }
+
+    // serve blocks from the wallet's top block like the daemon if a cached range contains them
+    bool serve_range(const std::string& prefix, const cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::request& blocks_request, const epee::net_utils::http::http_response_info** ppresponse_info) {
+      if (m_top_height == boost::none || blocks_request.block_ids.front() != m_top_hash || blocks_request.start_height > *m_top_height) return false;
+      std::shared_ptr<const monero_block_range> range = m_cache->get_range(prefix, *m_top_height, m_top_hash);
+      if (range == nullptr) return false;
+
+      // build response with the range's blocks from the wallet's top block
+      size_t offset = *m_top_height - range->start_height();
+      cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::response blocks_response = range->m_response;
+      blocks_response.start_height = *m_top_height;
+      blocks_response.blocks.assign(range->m_blocks.begin() + offset, range->m_blocks.end());
+      blocks_response.output_indices.assign(range->m_output_indices.begin() + offset, range->m_output_indices.end());
+      std::shared_ptr<epee::net_utils::http::http_response_info> response = std::make_shared<epee::net_utils::http::http_response_info>(range->m_response_info);
+      if (!epee::serialization::store_t_to_binary(blocks_response, response->m_body)) return false;
+      m_response = response;
+      m_top_height = range->end_height() - 1;
+      m_top_hash = range->m_block_hashes.back();
+      if (ppresponse_info) *ppresponse_info = m_response.get();
+      return true;
+    }
+
+    // cache the blocks of a daemon response by height range and remember the last block returned
+    void add_range(const std::string& prefix, const epee::net_utils::http::http_response_info& response_info) {
+      if (response_info.m_response_code != 200) return;
+      std::shared_ptr<monero_block_range> range = std::make_shared<monero_block_range>();
+      if (!epee::serialization::load_t_from_binary(range->m_response, response_info.m_body) || range->m_response.status != CORE_RPC_STATUS_OK) return;
+      range->m_blocks.swap(range->m_response.blocks);
+      range->m_output_indices.swap(range->m_response.output_indices);
+      if (range->m_blocks.empty() || range->m_output_indices.size() != range->m_blocks.size()) return;
+      for (const cryptonote::block_complete_entry& block_entry : range->m_blocks) {
+        cryptonote::block block;
+        if (!cryptonote::parse_and_validate_block_from_blob(block_entry.block, block)) return;
+        range->m_block_hashes.push_back(cryptonote::get_block_hash(block));
+        range->m_num_bytes += block_entry.block.size();
+        for (const cryptonote::tx_blob_entry& tx_entry : block_entry.txs) range->m_num_bytes += tx_entry.blob.size();
+      }
+      range->m_response_info.m_response_code = response_info.m_response_code;
+      range->m_response_info.m_response_comment = response_info.m_response_comment;
+      range->m_response_info.m_header_info = response_info.m_header_info;
+      range->m_response_info.m_mime_tipe = response_info.m_mime_tipe;
+      range->m_response_info.m_http_ver_hi = response_info.m_http_ver_hi;
+      range->m_response_info.m_http_ver_lo = response_info.m_http_ver_lo;
+      m_top_height = range->end_height() - 1;
+      m_top_hash = range->m_block_hashes.back();
+      m_cache->add_range(prefix, range);
+    }
+  };
+
+  /**
+   * Creates caching http clients around clients from another factory.
+   */
+  class monero_caching_http_client_factory : public epee::net_utils::http::http_client_factory {
+  public:
+    monero_caching_http_client_factory(std::unique_ptr<epee::net_utils::http::http_client_factory> http_client_factory, std::shared_ptr<monero_block_cache> cache) : m_http_client_factory(std::move(http_client_factory)), m_cache(cache) { }
+
+    std::unique_ptr<epee::net_utils::http::abstract_http_client> create() override {
+      return std::unique_ptr<epee::net_utils::http::abstract_http_client>(new monero_caching_http_client(m_http_client_factory->create(), m_cache));
+    }
+
+  private:
+    std::unique_ptr<epee::net_utils::http::http_client_factory> m_http_client_factory;
+    std::shared_ptr<monero_block_cache> m_cache;
+  };
+
+  // -------------------------- SYNC COORDINATOR ------------------------------
+
+  monero_sync_coordinator::monero_sync_coordinator(uint32_t num_workers, size_t cache_max_bytes, uint64_t cache_ttl_ms) {
+    m_cache = std::make_shared<monero_block_cache>(cache_max_bytes, cache_ttl_ms);
+    m_num_pending = 0;
+    m_is_closing = false;
+    m_syncing_enabled = false;
+    m_syncing_interval = 0;
+    if (num_workers == 0) num_workers = std::max(1u, boost::thread::hardware_concurrency());
+    for (uint32_t i = 0; i < num_workers; i++) m_workers.push_back(boost::thread([this]() { run_worker(); }));
+  }
+
+  monero_sync_coordinator::~monero_sync_coordinator() {
+    MTRACE("~monero_sync_coordinator()");
+    stop_syncing();
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_is_closing = true;
+    }
+    m_queue_cv.notify_all();
+    for (boost::thread& worker : m_workers) worker.join();
+  }
+
+  std::unique_ptr<epee::net_utils::http::http_client_factory> monero_sync_coordinator::create_http_client_factory(std::unique_ptr<epee::net_utils::http::http_client_factory> http_client_factory) {
+    if (http_client_factory == nullptr) http_client_factory = std::unique_ptr<epee::net_utils::http::http_client_factory>(new epee::net_utils::http::http_simple_client_factory());
+    return std::unique_ptr<epee::net_utils::http::http_client_factory>(new monero_caching_http_client_factory(std::move(http_client_factory), m_cache));
+  }
+
+  void monero_sync_coordinator::add_wallet(monero_wallet_full* wallet) {
+    MTRACE("add_wallet()");
+    if (wallet == nullptr) throw std::runtime_error("Wallet is null");
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    if (std::find(m_wallets.begin(), m_wallets.end(), wallet) == m_wallets.end()) m_wallets.push_back(wallet);
+  }
+
+  void monero_sync_coordinator::remove_wallet(monero_wallet_full* wallet) {
+    MTRACE("remove_wallet()");
+    if (wallet != nullptr && wallet == t_syncing_wallet) throw std::runtime_error("Cannot remove wallet from its own sync (e.g. from its listener) because removal waits for the sync to finish");
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_wallets.erase(std::remove(m_wallets.begin(), m_wallets.end(), wallet), m_wallets.end());
+    size_t num_queued = m_queue.size();
+    m_queue.erase(std::remove(m_queue.begin(), m_queue.end(), wallet), m_queue.end());
+    m_num_pending -= num_queued - m_queue.size();
+    if (num_queued != m_queue.size()) m_done_cv.notify_all();
+    while (m_syncing_wallets.find(wallet) != m_syncing_wallets.end()) m_done_cv.wait(lock);
+  }
+
+  std::vector<monero_wallet_full*> monero_sync_coordinator::get_wallets() const {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_wallets;
+  }
+
+  void monero_sync_coordinator::sync() {
+    MTRACE("sync()");
+    boost::lock_guard<boost::mutex> sync_lock(m_sync_mutex); // one round at a time
+    m_cache->prune();
+
+    // queue registered wallets and wait for workers to sync them
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    for (monero_wallet_full* wallet : m_wallets) m_queue.push_back(wallet);
+    m_num_pending += m_wallets.size();
+    m_queue_cv.notify_all();
+    while (m_num_pending > 0) m_done_cv.wait(lock);
+  }
+
+  void monero_sync_coordinator::start_syncing(uint64_t sync_period_in_ms) {
+    m_syncing_interval = sync_period_in_ms;
+    if (m_syncing_enabled.exchange(true)) return;
+    if (m_syncing_thread.joinable()) m_syncing_thread.join();
+
+    // sync wallets on loop in background
+    m_syncing_thread = boost::thread([this]() {
+      while (m_syncing_enabled) {
+        auto start = std::chrono::system_clock::now();
+        sync();
+
+        // only wait if syncing still enabled
+        if (m_syncing_enabled) {
+          boost::mutex::scoped_lock lock(m_syncing_mutex);
+          boost::posix_time::milliseconds wait_for_ms(m_syncing_interval.load());
+          boost::posix_time::milliseconds elapsed_time = boost::posix_time::milliseconds(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start).count());
+          m_sync_cv.timed_wait(lock, elapsed_time > wait_for_ms ? boost::posix_time::milliseconds(0) : wait_for_ms - elapsed_time); // target regular sync period by accounting for sync time
+        }
+      }
+    });
+  }
+
+  void monero_sync_coordinator::stop_syncing() {
+    {
+      boost::lock_guard<boost::mutex> lock(m_syncing_mutex);
+      m_syncing_enabled = false;
+    }
+    m_sync_cv.notify_one();
+    if (m_syncing_thread.joinable()) m_syncing_thread.join();
+  }
+
+  uint64_t monero_sync_coordinator::get_num_cache_hits() const {
+    return m_cache->get_num_hits();
+  }
+
+  uint64_t monero_sync_coordinator::get_num_cache_misses() const {
+    return m_cache->get_num_misses();
+  }
+
+  // ------------------------------- PRIVATE HELPERS ----------------------------
+
+  void monero_sync_coordinator::run_worker() {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (true) {
+      while (!m_is_closing && m_queue.empty()) m_queue_cv.wait(lock);
+      if (m_is_closing) return;
+
+      // sync next wallet, which notifies its listeners of progress
+      monero_wallet_full* wallet = m_queue.front();
+      m_queue.pop_front();
+      m_syncing_wallets.insert(wallet);
+      lock.unlock();
+      t_syncing_wallet = wallet;
+      try { wallet->sync(); }
+      catch (std::exception const& e) { std::cout << "monero_sync_coordinator failed to synchronize wallet: " << e.what() << std::endl; }
+      catch (...) { std::cout << "monero_sync_coordinator failed to synchronize wallet" << std::endl; }
+      t_syncing_wallet = nullptr;
+      lock.lock();
+      m_syncing_wallets.erase(wallet);
+      m_num_pending--;
+      m_done_cv.notify_all();
+    }
+  }
+}
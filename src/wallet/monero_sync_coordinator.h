@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) woodser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Parts of this file are originally copyright (c) 2014-2019, The Monero Project
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * All rights reserved.
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ *    conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *    of conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+ */
+
+#pragma once
+
+#include "monero_wallet_full.h"
+#include "net/abstract_http_client.h"
+
+#include <deque>
+
+/**
+ * Synchronizes many full wallets with one shared block download.
+ */
+namespace monero {
+
+  // forward declaration of internal cache of daemon block responses
+  struct monero_block_cache;
+
+  /**
+   * Synchronizes registered wallets on a shared worker pool.
+   *
+   * Wallets created with an http client factory from this coordinator share
+   * a bounded in-memory cache of the daemon's block responses, so a block range
+   * requested by many wallets is fetched from the daemon once while concurrent
+   * requests for it wait for the first.
+   *
+   * Each wallet notifies its own listeners of sync progress as it scans.
+   */
+  class monero_sync_coordinator {
+
+  public:
+
+    /**
+     * Construct a sync coordinator.
+     *
+     * @param num_workers is the number of wallets to sync concurrently (default number of cores)
+     * @param cache_max_bytes is the maximum size of cached daemon responses (default 256 MB)
+     * @param cache_ttl_ms is the maximum age of a cached daemon response (default 5 seconds)
+     */
+    monero_sync_coordinator(uint32_t num_workers = 0, size_t cache_max_bytes = 256 * 1024 * 1024, uint64_t cache_ttl_ms = 5000);
+
+    /**
+     * Stop syncing and destroy the coordinator.
+     */
+    ~monero_sync_coordinator();
+
+    /**
+     * Create an http client factory whose clients fetch blocks through this
+     * coordinator's shared cache.
+     *
+     * Pass the factory when opening or creating a wallet. The factory may
+     * outlive the coordinator.
+     *
+     * @param http_client_factory creates the clients which connect to the daemon (default http_simple_client)
+     * @return the http client factory to create the wallet with
+     */
+    std::unique_ptr<epee::net_utils::http::http_client_factory> create_http_client_factory(std::unique_ptr<epee::net_utils::http::http_client_factory> http_client_factory = nullptr);
+
+    /**
+     * Register a wallet to sync.
+     *
+     * @param wallet is the wallet to sync, which must be unregistered before it is closed
+     */
+    void add_wallet(monero_wallet_full* wallet);
+
+    /**
+     * Unregister a wallet, waiting for it to finish syncing if it is syncing.
+     *
+     * Throws if called from the wallet's own sync (e.g. from its listener),
+     * which would otherwise wait on itself forever.
+     *
+     * @param wallet is the wallet to stop syncing
+     */
+    void remove_wallet(monero_wallet_full* wallet);
+
+    /**
+     * Get the registered wallets.
+     *
+     * @return the registered wallets
+     */
+    std::vector<monero_wallet_full*> get_wallets() const;
+
+    /**
+     * Sync all registered wallets once on the worker pool.
+     *
+     * Blocks until every wallet is synced. A wallet which fails to sync does
+     * not stop the others from syncing.
+     */
+    void sync();
+
+    /**
+     * Sync all registered wallets in the background on a regular period.
+     *
+     * @param sync_period_in_ms is the time between syncs in milliseconds
+     */
+    void start_syncing(uint64_t sync_period_in_ms = 10000);
+
+    /**
+     * Stop syncing in the background.
+     */
+    void stop_syncing();
+
+    /**
+     * Get the number of daemon block requests served from the shared cache.
+     */
+    uint64_t get_num_cache_hits() const;
+
+    /**
+     * Get the number of daemon block requests fetched from the daemon.
+     */
+    uint64_t get_num_cache_misses() const;
+
+    // --------------------------------- PRIVATE --------------------------------
+
+  private:
+    std::shared_ptr<monero_block_cache> m_cache;        // cache of daemon block responses shared with http clients
+    mutable boost::mutex m_mutex;                       // synchronizes registered wallets and work queue
+    boost::condition_variable m_queue_cv;               // wakes workers when wallets are queued
+    boost::condition_variable m_done_cv;                // wakes waiters when wallets finish syncing
+    std::vector<monero_wallet_full*> m_wallets;         // registered wallets
+    std::deque<monero_wallet_full*> m_queue;            // wallets queued to sync
+    std::set<monero_wallet_full*> m_syncing_wallets;    // wallets being synced by workers
+    size_t m_num_pending;                               // number of queued and syncing wallets
+    bool m_is_closing;                                  // stops workers
+    std::vector<boost::thread> m_workers;               // worker pool which syncs wallets
+    boost::mutex m_sync_mutex;                          // synchronizes sync rounds
+    boost::mutex m_syncing_mutex;                       // synchronizes background sync loop waits
+    boost::condition_variable m_sync_cv;                // wakes background sync loop
+    std::atomic<bool> m_syncing_enabled;                // background sync loop is enabled
+    std::atomic<uint64_t> m_syncing_interval;           // background sync loop interval in milliseconds
+    boost::thread m_syncing_thread;                     // thread for background sync loop
+
+    void run_worker();                                  // sync queued wallets until closing
+  };
+}
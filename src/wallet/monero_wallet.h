@@ -55,6 +55,8 @@
 #include "monero_wallet_model.h"
 #include <vector>
 #include <set>
+#include <functional>
+#include <algorithm>
 
 using namespace monero;
 
@@ -110,6 +112,47 @@ namespace monero {
      * @param output - the spent output
      */
     virtual void on_output_spent(const monero_output_wallet& output) {};
+
+    /**
+     * Invoked when a sync completes with the time spent in each of its stages.
+     *
+     * @param timings - time spent in the sync's stages
+     */
+    virtual void on_sync_timings(const monero_sync_timings& timings) {};
+
+    /**
+     * Invoked when a batch of consecutive blocks is processed.
+     *
+     * Invokes on_new_block() per block by default.
+     *
+     * @param start_height - height of the first processed block
+     * @param num_blocks - number of processed blocks
+     */
+    virtual void on_new_blocks(uint64_t start_height, uint64_t num_blocks) {
+      for (uint64_t height = start_height; height < start_height + num_blocks; height++) on_new_block(height);
+    }
+
+    /**
+     * Invoked when the wallet receives a batch of outputs.
+     *
+     * Invokes on_output_received() per output by default.
+     *
+     * @param outputs - the received outputs
+     */
+    virtual void on_outputs_received(const std::vector<std::shared_ptr<monero_output_wallet>>& outputs) {
+      for (const std::shared_ptr<monero_output_wallet>& output : outputs) on_output_received(*output);
+    }
+
+    /**
+     * Invoked when the wallet spends a batch of outputs.
+     *
+     * Invokes on_output_spent() per output by default.
+     *
+     * @param outputs - the spent outputs
+     */
+    virtual void on_outputs_spent(const std::vector<std::shared_ptr<monero_output_wallet>>& outputs) {
+      for (const std::shared_ptr<monero_output_wallet>& output : outputs) on_output_spent(*output);
+    }
   };
 
   // forward declaration of internal wallet2 listener
@@ -699,6 +742,20 @@ namespace monero {
       throw std::runtime_error("get_txs(query) not supported");
     }
 
+    /**
+     * Same as get_txs(query) but consumes the query instead of copying it.
+     * The query and its sub-queries may be modified.
+     *
+     * @param query filters query results
+     * @return wallet transactions per the query
+     */
+    virtual std::vector<std::shared_ptr<monero_tx_wallet>> get_txs(monero_tx_query&& query) const {
+      return get_txs(static_cast<const monero_tx_query&>(query));
+    }
+    virtual std::vector<std::shared_ptr<monero_tx_wallet>> get_txs(const std::shared_ptr<monero_tx_query>& query) const {
+      return get_txs(static_cast<const monero_tx_query&>(*query));
+    }
+
     /**
      * Same as get_txs(query) but collects missing tx hashes instead of throwing an error.
      * This method is separated because WebAssembly does not support exception handling.
@@ -731,6 +788,20 @@ namespace monero {
       throw std::runtime_error("get_transfers() not supported");
     }
 
+    /**
+     * Same as get_transfers(query) but consumes the query instead of copying
+     * it.  The query and its tx query may be modified.
+     *
+     * @param query filters query results
+     * @return wallet transfers per the query
+     */
+    virtual std::vector<std::shared_ptr<monero_transfer>> get_transfers(monero_transfer_query&& query) const {
+      return get_transfers(static_cast<const monero_transfer_query&>(query));
+    }
+    virtual std::vector<std::shared_ptr<monero_transfer>> get_transfers(const std::shared_ptr<monero_transfer_query>& query) const {
+      return get_transfers(static_cast<const monero_transfer_query&>(*query));
+    }
+
     /**
      * Get outputs created from previous transactions that belong to the wallet
      * (i.e. that the wallet can spend one time).  Outputs are part of
@@ -747,6 +818,103 @@ namespace monero {
       throw std::runtime_error("get_outputs() not supported");
     }
 
+    /**
+     * Same as get_outputs(query) but consumes the query instead of copying
+     * it.  The query and its tx query may be modified.
+     *
+     * @param query specifies query options
+     * @return wallet outputs per the query
+     */
+    virtual std::vector<std::shared_ptr<monero_output_wallet>> get_outputs(monero_output_query&& query) const {
+      return get_outputs(static_cast<const monero_output_query&>(query));
+    }
+    virtual std::vector<std::shared_ptr<monero_output_wallet>> get_outputs(const std::shared_ptr<monero_output_query>& query) const {
+      return get_outputs(static_cast<const monero_output_query&>(*query));
+    }
+
+    /**
+     * Visit wallet transactions which meet the query in height order without
+     * collecting them all in memory.
+     *
+     * Visited transactions are only valid for the duration of the visit;
+     * implementations may release each batch's model graph afterwards, so the
+     * visitor must copy anything it retains.
+     *
+     * @param query filters the transactions
+     * @param visitor is invoked per transaction and returns false to stop
+     * @param sort_order sorts transactions by height, unconfirmed last (default ascending)
+     */
+    virtual void for_each_tx(const monero_tx_query& query, const std::function<bool(const std::shared_ptr<monero_tx_wallet>&)>& visitor, monero_sort_order sort_order = ASCENDING) const {
+      std::vector<std::string> missing_tx_hashes;
+      std::vector<std::shared_ptr<monero_tx_wallet>> txs = get_txs(query, missing_tx_hashes);
+      visit_sorted(txs, visitor, sort_order);
+    }
+
+    /**
+     * Visit wallet transfers which meet the query in height order without
+     * collecting them all in memory.
+     *
+     * @param query filters the transfers
+     * @param visitor is invoked per transfer and returns false to stop
+     * @param sort_order sorts transfers by height, unconfirmed last (default ascending)
+     */
+    virtual void for_each_transfer(const monero_transfer_query& query, const std::function<bool(const std::shared_ptr<monero_transfer>&)>& visitor, monero_sort_order sort_order = ASCENDING) const {
+      std::vector<std::shared_ptr<monero_transfer>> transfers = get_transfers(query);
+      visit_sorted(transfers, visitor, sort_order);
+    }
+
+    /**
+     * Visit wallet outputs which meet the query in height order without
+     * collecting them all in memory.
+     *
+     * @param query filters the outputs
+     * @param visitor is invoked per output and returns false to stop
+     * @param sort_order sorts outputs by height (default ascending)
+     */
+    virtual void for_each_output(const monero_output_query& query, const std::function<bool(const std::shared_ptr<monero_output_wallet>&)>& visitor, monero_sort_order sort_order = ASCENDING) const {
+      std::vector<std::shared_ptr<monero_output_wallet>> outputs = get_outputs(query);
+      visit_sorted(outputs, visitor, sort_order);
+    }
+
+    /**
+     * Get a page of wallet transactions which meet the query in height order.
+     *
+     * @param query filters the transactions
+     * @param request specifies the page limit, offset, resume token, and sort order
+     * @return the page of transactions and a token to resume after it
+     */
+    virtual monero_page<monero_tx_wallet> get_txs_page(const monero_tx_query& query, const monero_page_request& request) const {
+      monero_pager<monero_tx_wallet> pager(request);
+      for_each_tx(query, [&pager](const std::shared_ptr<monero_tx_wallet>& tx) { return pager.add(tx); }, request.m_sort_order);
+      return pager.get_page();
+    }
+
+    /**
+     * Get a page of wallet transfers which meet the query in height order.
+     *
+     * @param query filters the transfers
+     * @param request specifies the page limit, offset, resume token, and sort order
+     * @return the page of transfers and a token to resume after it
+     */
+    virtual monero_page<monero_transfer> get_transfers_page(const monero_transfer_query& query, const monero_page_request& request) const {
+      monero_pager<monero_transfer> pager(request);
+      for_each_transfer(query, [&pager](const std::shared_ptr<monero_transfer>& transfer) { return pager.add(transfer); }, request.m_sort_order);
+      return pager.get_page();
+    }
+
+    /**
+     * Get a page of wallet outputs which meet the query in height order.
+     *
+     * @param query filters the outputs
+     * @param request specifies the page limit, offset, resume token, and sort order
+     * @return the page of outputs and a token to resume after it
+     */
+    virtual monero_page<monero_output_wallet> get_outputs_page(const monero_output_query& query, const monero_page_request& request) const {
+      monero_pager<monero_output_wallet> pager(request);
+      for_each_output(query, [&pager](const std::shared_ptr<monero_output_wallet>& output) { return pager.add(output); }, request.m_sort_order);
+      return pager.get_page();
+    }
+
     /**
      * Export outputs in hex format.
      *
@@ -1362,5 +1530,23 @@ namespace monero {
     virtual void close(bool save = false) {
       throw std::runtime_error("close() not supported");
     }
+
+  protected:
+
+    /**
+     * Sort query results into page order and visit them until the visitor stops.
+     *
+     * @return true if all results were visited, false if the visitor stopped
+     */
+    template <class T>
+    static bool visit_sorted(std::vector<std::shared_ptr<T>>& results, const std::function<bool(const std::shared_ptr<T>&)>& visitor, monero_sort_order sort_order) {
+      std::stable_sort(results.begin(), results.end(), [sort_order](const std::shared_ptr<T>& result1, const std::shared_ptr<T>& result2) {
+        return monero_page_cursor::of(*result1).is_before(monero_page_cursor::of(*result2), sort_order);
+      });
+      for (const std::shared_ptr<T>& result : results) {
+        if (!visitor(result)) return false;
+      }
+      return true;
+    }
   };
 }
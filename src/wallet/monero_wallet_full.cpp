@@ -53,6 +53,7 @@
 #include "monero_wallet_full.h"
 
 #include "utils/monero_utils.h"
+#include "utils/monero_scheduler.h"
 #include <chrono>
 #include <iostream>
 #include "mnemonics/electrum-words.h"
@@ -60,7 +61,9 @@
 #include "wallet/wallet_rpc_server_commands_defs.h"
 #include "serialization/binary_utils.h"
 #include "serialization/string.h"
-#include "common/threadpool.h"
+#include "rpc/core_rpc_server_commands_defs.h"
+#include "storages/http_abstract_invoke.h"
+#include "net/http.h"
 
 #ifdef WIN32
 #include <boost/locale.hpp>
@@ -78,6 +81,351 @@ namespace monero {
 
   static const int DEFAULT_CONNECTION_TIMEOUT_MILLIS = 1000 * 30; // default connection timeout 30 sec
   static const bool STRICT = false; // relies exclusively on blockchain data if true, includes local wallet data if false TODO: good use case to expose externally?
+  static const size_t WINDOW_NUM_ROWS = 1000; // approximate number of indexed rows per height window when streaming query results
+  static const uint64_t NOTIFICATION_BATCH_NUM_BLOCKS = 100; // maximum number of blocks to notify listeners of in one batch while syncing
+  static const int NOTIFICATION_BATCH_MILLIS = 1000;          // maximum time to batch notifications while syncing
+  static const uint64_t DAEMON_POLL_MAX_BACKOFF_MS = 60000;   // maximum period between daemon polls or sync retries after errors when syncing adaptively
+  static const int STATE_LOCK_YIELD_MILLIS = 10;              // maximum time sync waits for readers to acquire the wallet state between blocks
+  static const uint64_t DAEMON_INFO_TTL_MS = 2000;            // maximum age of cached daemon status shared by wallets with the same daemon connection
+  static const uint32_t DAEMON_POLLER_NUM_WORKERS = 2;        // number of threads which run daemon polls and status refreshes
+
+  // ------------------------------ QUERY ARENA -------------------------------
+
+  /**
+   * Monotonic memory region which a query's models are allocated from.
+   *
+   * Allocations bump a pointer within chunks and are never freed individually;
+   * all chunks are released at once when the last model allocated from the
+   * arena is destroyed.
+   */
+  class monero_query_arena {
+  public:
+    monero_query_arena() : m_pos(nullptr), m_remaining(0), m_num_allocations(0) { }
+
+    void* allocate(size_t size, size_t alignment) {
+      size_t padding = m_pos == nullptr ? 0 : (alignment - reinterpret_cast<uintptr_t>(m_pos) % alignment) % alignment;
+      if (m_pos == nullptr || padding + size > m_remaining) {
+        size_t chunk_size = size + alignment > CHUNK_SIZE ? size + alignment : CHUNK_SIZE;
+        m_chunks.push_back(std::unique_ptr<char[]>(new char[chunk_size]));
+        m_pos = m_chunks.back().get();
+        m_remaining = chunk_size;
+        padding = (alignment - reinterpret_cast<uintptr_t>(m_pos) % alignment) % alignment;
+      }
+      void* ptr = m_pos + padding;
+      m_pos += padding + size;
+      m_remaining -= padding + size;
+      m_num_allocations++;
+      return ptr;
+    }
+
+    uint64_t get_num_allocations() const { return m_num_allocations; }
+    size_t get_num_chunks() const { return m_chunks.size(); }
+
+  private:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    char* m_pos;
+    size_t m_remaining;
+    uint64_t m_num_allocations;
+  };
+
+  /**
+   * Allocator of a query arena which keeps the arena alive while anything
+   * allocated from it is.
+   */
+  template <class T>
+  struct arena_allocator {
+    typedef T value_type;
+    std::shared_ptr<monero_query_arena> m_arena;
+    arena_allocator(const std::shared_ptr<monero_query_arena>& arena) : m_arena(arena) { }
+    template <class U> arena_allocator(const arena_allocator<U>& other) : m_arena(other.m_arena) { }
+    T* allocate(size_t n) { return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) { } // released with the arena
+  };
+
+  template <class T, class U>
+  bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.m_arena == b.m_arena; }
+
+  template <class T, class U>
+  bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.m_arena != b.m_arena; }
+
+  /**
+   * Makes models for a query, from the query's arena if one is used.
+   */
+  struct model_factory {
+    std::shared_ptr<monero_query_arena> m_arena; // allocate models individually if null
+
+    template <class T>
+    std::shared_ptr<T> make() const {
+      if (m_arena == nullptr) return std::make_shared<T>();
+      return std::allocate_shared<T>(arena_allocator<T>(m_arena));
+    }
+  };
+
+  // ------------------------------- QUERY PLAN -------------------------------
+
+  /**
+   * Tx query compiled into a flat program of predicates.
+   *
+   * The program depends only on the query's shape, i.e. which criteria are
+   * set, and is compiled into a fixed array with each plan, which costs one
+   * pass over the opcodes and no allocation or locking.  Predicates run in the
+   * order of their opcodes: flags first, then lookups and heights, then the
+   * sub-queries of transfers, inputs, and outputs.  Criteria already applied
+   * when fetching from wallet2 are skipped, and sets of hashes and payment
+   * ids are built once per query instead of searched per tx.
+   */
+  class monero_tx_query_plan {
+  public:
+
+    // criteria applied when fetching from wallet2 which the plan skips
+    static const uint32_t PUSHDOWN_NONE = 0;
+    static const uint32_t PUSHDOWN_HASHES = 1;
+
+    /**
+     * Plan a query, which must outlive the plan.
+     *
+     * @param query is the query to plan
+     * @param pushdown specifies criteria applied when fetching from wallet2
+     * @param query_children specifies if sub-queries of transfers, inputs, and outputs are evaluated
+     */
+    monero_tx_query_plan(const monero_tx_query& query, uint32_t pushdown, bool query_children) : m_query(query) {
+      uint32_t shape = 0;
+      if (query.m_is_confirmed != boost::none) shape |= 1 << IS_CONFIRMED;
+      if (query.m_in_tx_pool != boost::none) shape |= 1 << IN_TX_POOL;
+      if (query.m_is_failed != boost::none) shape |= 1 << IS_FAILED;
+      if (query.m_is_locked != boost::none) shape |= 1 << IS_LOCKED;
+      if (query.m_relay != boost::none) shape |= 1 << RELAY;
+      if (query.m_is_miner_tx != boost::none) shape |= 1 << IS_MINER_TX;
+      if (query.m_is_incoming != boost::none) shape |= 1 << IS_INCOMING;
+      if (query.m_is_outgoing != boost::none) shape |= 1 << IS_OUTGOING;
+      if (query.m_has_payment_id != boost::none) shape |= 1 << HAS_PAYMENT_ID;
+      if (query.m_hash != boost::none) shape |= 1 << HASH;
+      if (query.m_payment_id != boost::none) shape |= 1 << PAYMENT_ID;
+      if (!query.m_hashes.empty() && !(pushdown & PUSHDOWN_HASHES)) shape |= 1 << HASHES;
+      if (!query.m_payment_ids.empty()) shape |= 1 << PAYMENT_IDS;
+      if (query.m_height != boost::none) shape |= 1 << HEIGHT;
+      if (query.m_min_height != boost::none) shape |= 1 << MIN_HEIGHT;
+      if (query.m_max_height != boost::none) shape |= 1 << MAX_HEIGHT;
+      if (query_children && query.m_transfer_query != boost::none) shape |= 1 << TRANSFER_QUERY;
+      if (query_children && query.m_input_query != boost::none) shape |= 1 << INPUT_QUERY;
+      if (query_children && query.m_output_query != boost::none) shape |= 1 << OUTPUT_QUERY;
+      m_num_ops = 0;
+      for (uint32_t opcode = 0; opcode < NUM_OPS; opcode++) {
+        if (shape & (1 << opcode)) m_program[m_num_ops++] = static_cast<op>(opcode);
+      }
+
+      // bind parameters
+      if (shape & (1 << HASHES)) m_hashes.insert(query.m_hashes.begin(), query.m_hashes.end());
+      if (shape & (1 << PAYMENT_IDS)) m_payment_ids.insert(query.m_payment_ids.begin(), query.m_payment_ids.end());
+      m_is_transfer_query_parent = query.m_transfer_query != boost::none && (*query.m_transfer_query)->m_tx_query != boost::none && (*query.m_transfer_query)->m_tx_query->get() == &query;
+    }
+
+    /**
+     * Indicates if a tx meets the query, equivalent to monero_tx_query::meets_criteria().
+     */
+    bool matches(const monero_tx_wallet& tx) const {
+      for (uint8_t idx = 0; idx < m_num_ops; idx++) {
+        switch (m_program[idx]) {
+          case IS_CONFIRMED: if (!bool_matches(m_query.m_is_confirmed, tx.m_is_confirmed)) return false; break;
+          case IN_TX_POOL: if (!bool_matches(m_query.m_in_tx_pool, tx.m_in_tx_pool)) return false; break;
+          case IS_FAILED: if (!bool_matches(m_query.m_is_failed, tx.m_is_failed)) return false; break;
+          case IS_LOCKED: if (!bool_matches(m_query.m_is_locked, tx.m_is_locked)) return false; break;
+          case RELAY: if (!bool_matches(m_query.m_relay, tx.m_relay)) return false; break;
+          case IS_MINER_TX: if (!bool_matches(m_query.m_is_miner_tx, tx.m_is_miner_tx)) return false; break;
+          case IS_INCOMING: if (!bool_matches(m_query.m_is_incoming, tx.m_is_incoming)) return false; break;
+          case IS_OUTGOING: if (!bool_matches(m_query.m_is_outgoing, tx.m_is_outgoing)) return false; break;
+          case HAS_PAYMENT_ID: if (*m_query.m_has_payment_id != (tx.m_payment_id != boost::none)) return false; break;
+          case HASH: if (tx.m_hash == boost::none || *tx.m_hash != *m_query.m_hash) return false; break;
+          case PAYMENT_ID: if (tx.m_payment_id == boost::none || *tx.m_payment_id != *m_query.m_payment_id) return false; break;
+          case HASHES: if (tx.m_hash == boost::none || m_hashes.count(*tx.m_hash) == 0) return false; break;
+          case PAYMENT_IDS: if (tx.m_payment_id == boost::none || m_payment_ids.count(*tx.m_payment_id) == 0) return false; break;
+          case HEIGHT: if (!height_matches(tx, [this](uint64_t height) { return height == *m_query.m_height; })) return false; break;
+          case MIN_HEIGHT: if (!height_matches(tx, [this](uint64_t height) { return height >= *m_query.m_min_height; })) return false; break;
+          case MAX_HEIGHT: if (!height_matches(tx, [this](uint64_t height) { return height <= *m_query.m_max_height; })) return false; break;
+          case TRANSFER_QUERY: if (!transfer_matches(tx)) return false; break;
+          case INPUT_QUERY: if (!output_matches(**m_query.m_input_query, tx.m_inputs)) return false; break;
+          case OUTPUT_QUERY: if (!output_matches(**m_query.m_output_query, tx.m_outputs)) return false; break;
+          case NUM_OPS: break;
+        }
+      }
+      return true;
+    }
+
+  private:
+
+    // predicates in order of evaluation, cheapest and most selective first
+    enum op : uint8_t {
+      IS_CONFIRMED, IN_TX_POOL, IS_FAILED, IS_LOCKED, RELAY, IS_MINER_TX, IS_INCOMING, IS_OUTGOING, HAS_PAYMENT_ID,
+      HASH, PAYMENT_ID, HASHES, PAYMENT_IDS, HEIGHT, MIN_HEIGHT, MAX_HEIGHT,
+      TRANSFER_QUERY, INPUT_QUERY, OUTPUT_QUERY,
+      NUM_OPS
+    };
+
+    const monero_tx_query& m_query;
+    op m_program[NUM_OPS];            // predicates of the query's shape in order of evaluation
+    uint8_t m_num_ops;                // number of predicates in the program
+    std::unordered_set<std::string> m_hashes;
+    std::unordered_set<std::string> m_payment_ids;
+    bool m_is_transfer_query_parent;  // the transfer query's tx query is the planned query, which is already evaluated
+
+    static bool bool_matches(const boost::optional<bool>& criteria, const boost::optional<bool>& value) {
+      return value != boost::none && *value == *criteria;
+    }
+
+    static bool height_matches(const monero_tx_wallet& tx, const std::function<bool(uint64_t)>& criteria) {
+      boost::optional<uint64_t> height = tx.get_height();
+      return height != boost::none && criteria(*height);
+    }
+
+    bool transfer_matches(const monero_tx_wallet& tx) const {
+      const monero_transfer_query& transfer_query = **m_query.m_transfer_query;
+      if (tx.m_outgoing_transfer != boost::none && transfer_query.meets_criteria(tx.m_outgoing_transfer.get().get(), !m_is_transfer_query_parent)) return true;
+      for (const std::shared_ptr<monero_incoming_transfer>& incoming_transfer : tx.m_incoming_transfers) {
+        if (transfer_query.meets_criteria(incoming_transfer.get(), false)) return true;
+      }
+      return false;
+    }
+
+    static bool output_matches(const monero_output_query& output_query, const std::vector<std::shared_ptr<monero_output>>& outputs) {
+      for (const std::shared_ptr<monero_output>& output : outputs) {
+        if (output_query.meets_criteria(static_cast<monero_output_wallet*>(output.get()), false)) return true;
+      }
+      return false;
+    }
+  };
+
+  // -------------------------------- RPC TIMER -------------------------------
+
+  static const char* const BLOCK_FETCH_URIS[] = { "/getblocks.bin", "/gethashes.bin" }; // daemon requests which fetch blocks while syncing
+
+  /**
+   * Accumulates the time and traffic of wallet2's daemon requests, including
+   * block requests on its fetch thread while it scans previously fetched blocks.
+   */
+  struct monero_rpc_timer {
+    std::atomic<uint64_t> m_rpc_us{0};
+    std::atomic<uint64_t> m_num_rpcs{0};
+    std::atomic<uint64_t> m_fetch_us{0};
+    std::atomic<uint64_t> m_num_fetches{0};
+    std::atomic<uint64_t> m_bytes_received{0};
+    std::atomic<uint64_t> m_bytes_sent{0};
+  };
+
+  /**
+   * Http client which times requests and forwards them to the underlying
+   * client.
+   */
+  class monero_timed_http_client : public epee::net_utils::http::abstract_http_client {
+  public:
+    monero_timed_http_client(std::unique_ptr<epee::net_utils::http::abstract_http_client> client, std::shared_ptr<monero_rpc_timer> timer) : m_client(std::move(client)), m_timer(timer) { }
+
+    using epee::net_utils::http::abstract_http_client::set_server;
+
+    bool set_proxy(const std::string& address) override {
+      return m_client->set_proxy(address);
+    }
+
+    void set_server(std::string host, std::string port, boost::optional<epee::net_utils::http::login> user, epee::net_utils::ssl_options_t ssl_options = epee::net_utils::ssl_support_t::e_ssl_support_autodetect) override {
+      m_client->set_server(std::move(host), std::move(port), std::move(user), std::move(ssl_options));
+    }
+
+    void set_auto_connect(bool auto_connect) override {
+      m_client->set_auto_connect(auto_connect);
+    }
+
+    bool connect(std::chrono::milliseconds timeout) override {
+      return m_client->connect(timeout);
+    }
+
+    bool disconnect() override {
+      return m_client->disconnect();
+    }
+
+    bool is_connected(bool *ssl = NULL) override {
+      return m_client->is_connected(ssl);
+    }
+
+    bool invoke(const boost::string_ref uri, const boost::string_ref method, const boost::string_ref body, std::chrono::milliseconds timeout, const epee::net_utils::http::http_response_info** ppresponse_info = NULL, const epee::net_utils::http::fields_list& additional_params = epee::net_utils::http::fields_list()) override {
+      return invoke_timed(uri, [&]() { return m_client->invoke(uri, method, body, timeout, ppresponse_info, additional_params); });
+    }
+
+    bool invoke_get(const boost::string_ref uri, std::chrono::milliseconds timeout, const std::string& body = std::string(), const epee::net_utils::http::http_response_info** ppresponse_info = NULL, const epee::net_utils::http::fields_list& additional_params = epee::net_utils::http::fields_list()) override {
+      return invoke_timed(uri, [&]() { return m_client->invoke_get(uri, timeout, body, ppresponse_info, additional_params); });
+    }
+
+    bool invoke_post(const boost::string_ref uri, const std::string& body, std::chrono::milliseconds timeout, const epee::net_utils::http::http_response_info** ppresponse_info = NULL, const epee::net_utils::http::fields_list& additional_params = epee::net_utils::http::fields_list()) override {
+      return invoke_timed(uri, [&]() { return m_client->invoke_post(uri, body, timeout, ppresponse_info, additional_params); });
+    }
+
+    uint64_t get_bytes_sent() const override {
+      return m_client->get_bytes_sent();
+    }
+
+    uint64_t get_bytes_received() const override {
+      return m_client->get_bytes_received();
+    }
+
+  private:
+    std::unique_ptr<epee::net_utils::http::abstract_http_client> m_client;  // underlying client connected to the daemon
+    std::shared_ptr<monero_rpc_timer> m_timer;                           // timer shared with the wallet
+
+    bool invoke_timed(const boost::string_ref uri, const std::function<bool()>& invoke_client) {
+      uint64_t bytes_received = m_client->get_bytes_received();
+      uint64_t bytes_sent = m_client->get_bytes_sent();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      bool result = invoke_client();
+      uint64_t elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+      m_timer->m_rpc_us += elapsed_us;
+      m_timer->m_num_rpcs++;
+      m_timer->m_bytes_received += count_since(m_client->get_bytes_received(), bytes_received);
+      m_timer->m_bytes_sent += count_since(m_client->get_bytes_sent(), bytes_sent);
+      for (const char* fetch_uri : BLOCK_FETCH_URIS) {
+        if (uri != fetch_uri) continue;
+        m_timer->m_fetch_us += elapsed_us;
+        m_timer->m_num_fetches++;
+      }
+      return result;
+    }
+
+    // count since a previous count which resets on reconnect
+    static uint64_t count_since(uint64_t count, uint64_t prev_count) {
+      return count >= prev_count ? count - prev_count : count;
+    }
+  };
+
+  /**
+   * Creates timed http clients around clients from another factory.
+   */
+  class monero_timed_http_client_factory : public epee::net_utils::http::http_client_factory {
+  public:
+    monero_timed_http_client_factory(std::unique_ptr<epee::net_utils::http::http_client_factory> http_client_factory, std::shared_ptr<monero_rpc_timer> timer) : m_http_client_factory(std::move(http_client_factory)), m_timer(timer) { }
+
+    std::unique_ptr<epee::net_utils::http::abstract_http_client> create() override {
+      return std::unique_ptr<epee::net_utils::http::abstract_http_client>(new monero_timed_http_client(m_http_client_factory->create(), m_timer));
+    }
+
+  private:
+    std::unique_ptr<epee::net_utils::http::http_client_factory> m_http_client_factory;
+    std::shared_ptr<monero_rpc_timer> m_timer;
+  };
+
+  /**
+   * Create a wallet2 whose daemon requests are timed.
+   *
+   * @param network_type is the wallet's network type
+   * @param http_client_factory creates the clients which connect to the daemon (default wallet2's)
+   * @param rpc_timer is set to the timer of the wallet's daemon requests
+   * @param w2_http_client_factory is set to the factory of wallet2's clients, which wallet2 owns
+   * @return the wallet2 instance
+   */
+  static std::unique_ptr<tools::wallet2> create_wallet2(const monero_network_type network_type, std::unique_ptr<epee::net_utils::http::http_client_factory> http_client_factory, std::shared_ptr<monero_rpc_timer>& rpc_timer, epee::net_utils::http::http_client_factory*& w2_http_client_factory) {
+    if (http_client_factory == nullptr) http_client_factory = std::unique_ptr<epee::net_utils::http::http_client_factory>(new net::http::client_factory());
+    rpc_timer = std::make_shared<monero_rpc_timer>();
+    std::unique_ptr<epee::net_utils::http::http_client_factory> timed_http_client_factory(new monero_timed_http_client_factory(std::move(http_client_factory), rpc_timer));
+    w2_http_client_factory = timed_http_client_factory.get();
+    return std::unique_ptr<tools::wallet2>(new tools::wallet2(static_cast<cryptonote::network_type>(network_type), 1, true, std::move(timed_http_client_factory)));
+  }
 
   // ----------------------- INTERNAL PRIVATE HELPERS -----------------------
 
@@ -106,6 +454,98 @@ namespace monero {
     return query;
   }
 
+  // ---------------------------- QUERY NORMALIZATION ---------------------------
+
+  // Queries run normalized: owned by the call, which may modify them, with the
+  // root query and its tx query referencing each other.  Queries given by const
+  // reference are deep copied once to normalize them; queries given by rvalue
+  // or shared pointer are consumed and normalized in place.
+
+  /**
+   * Get a shared pointer to a query without owning it, e.g. to call copy().
+   */
+  template <class T>
+  std::shared_ptr<T> borrow_query(const T& query) {
+    return std::shared_ptr<T>(std::shared_ptr<T>(), const_cast<T*>(&query));
+  }
+
+  std::shared_ptr<monero_tx_query> normalize_query(const std::shared_ptr<monero_tx_query>& query) {
+    if (query->m_transfer_query != boost::none) query->m_transfer_query.get()->m_tx_query = query;
+    if (query->m_input_query != boost::none) query->m_input_query.get()->m_tx_query = query;
+    if (query->m_output_query != boost::none) query->m_output_query.get()->m_tx_query = query;
+    return query;
+  }
+
+  std::shared_ptr<monero_transfer_query> normalize_query(const std::shared_ptr<monero_transfer_query>& query) {
+    if (query->m_tx_query == boost::none) query->m_tx_query = std::make_shared<monero_tx_query>();
+    query->m_tx_query.get()->m_transfer_query = query;
+    return query;
+  }
+
+  std::shared_ptr<monero_output_query> normalize_query(const std::shared_ptr<monero_output_query>& query) {
+    if (query->m_tx_query == boost::none) query->m_tx_query = std::make_shared<monero_tx_query>();
+    else if (query->m_tx_query.get()->m_output_query != boost::none && query->m_tx_query.get()->m_output_query.get() != query) throw std::runtime_error("Output query's tx query must be a circular reference or null");
+    return query;
+  }
+
+  std::shared_ptr<monero_tx_query> normalize_query(monero_tx_query&& query) {
+    return normalize_query(std::make_shared<monero_tx_query>(std::move(query)));
+  }
+
+  std::shared_ptr<monero_transfer_query> normalize_query(monero_transfer_query&& query) {
+    return normalize_query(std::make_shared<monero_transfer_query>(std::move(query)));
+  }
+
+  std::shared_ptr<monero_output_query> normalize_query(monero_output_query&& query) {
+    bool is_circular = query.m_tx_query != boost::none && query.m_tx_query.get()->m_output_query != boost::none && query.m_tx_query.get()->m_output_query.get().get() == &query;
+    std::shared_ptr<monero_output_query> _query = std::make_shared<monero_output_query>(std::move(query));
+    if (is_circular) _query->m_tx_query.get()->m_output_query = _query;
+    return normalize_query(_query);
+  }
+
+  std::shared_ptr<monero_tx_query> copy_query(const monero_tx_query& query) {
+    std::shared_ptr<monero_tx_query> query_ptr = borrow_query(query);
+    return query_ptr->copy(query_ptr, std::make_shared<monero_tx_query>());
+  }
+
+  std::shared_ptr<monero_transfer_query> copy_query(const monero_transfer_query& query) {
+    if (query.m_tx_query != boost::none && query.m_tx_query.get()->m_transfer_query != boost::none && query.m_tx_query.get()->m_transfer_query.get().get() == &query) {
+      return copy_query(*query.m_tx_query.get())->m_transfer_query.get();
+    }
+    std::shared_ptr<monero_transfer_query> query_ptr = borrow_query(query);
+    std::shared_ptr<monero_transfer_query> _query = query_ptr->copy(query_ptr, std::make_shared<monero_transfer_query>());
+    if (query.m_tx_query != boost::none) _query->m_tx_query = copy_query(*query.m_tx_query.get());
+    return normalize_query(_query);
+  }
+
+  std::shared_ptr<monero_output_query> copy_query(const monero_output_query& query) {
+    if (query.m_tx_query != boost::none && query.m_tx_query.get()->m_output_query != boost::none && query.m_tx_query.get()->m_output_query.get().get() == &query) {
+      return copy_query(*query.m_tx_query.get())->m_output_query.get();
+    }
+    if (query.m_tx_query != boost::none && query.m_tx_query.get()->m_output_query != boost::none) throw std::runtime_error("Output query's tx query must be a circular reference or null");
+    std::shared_ptr<monero_output_query> query_ptr = borrow_query(query);
+    std::shared_ptr<monero_output_query> _query = query_ptr->copy(query_ptr, std::make_shared<monero_output_query>());
+    if (query.m_tx_query != boost::none) _query->m_tx_query = copy_query(*query.m_tx_query.get());
+    return normalize_query(_query);
+  }
+
+  /**
+   * Break the reference cycles of txs and their blocks, transfers, and outputs
+   * so their model graph is released once callers drop their references.
+   *
+   * @param txs are the txs to free
+   */
+  void free_txs(const std::vector<std::shared_ptr<monero_tx_wallet>>& txs) {
+    std::set<std::shared_ptr<monero_block>> blocks;
+    std::shared_ptr<monero_block> unconfirmed_block = std::make_shared<monero_block>(); // groups txs without a block
+    for (const std::shared_ptr<monero_tx_wallet>& tx : txs) {
+      if (tx->m_block != boost::none) blocks.insert(tx->m_block.get());
+      else unconfirmed_block->m_txs.push_back(tx);
+    }
+    for (const std::shared_ptr<monero_block>& block : blocks) monero_utils::free(block);
+    monero_utils::free(unconfirmed_block);
+  }
+
   bool is_contextual(const monero_transfer_query& query) {
     if (query.m_tx_query == boost::none) return false;
     if (query.m_tx_query.get()->m_is_incoming != boost::none) return true;    // requires context of all transfers
@@ -127,6 +567,60 @@ namespace monero {
     return opt_val == boost::none ? false : val == *opt_val;
   }
 
+  /**
+   * Parse tx hashes to filter into a binary hash set.
+   *
+   * Only canonical lowercase hex is parsed so set membership matches comparing
+   * against wallet2 hashes converted with pod_to_hex(); other strings cannot
+   * match any tx and are skipped.
+   *
+   * @param tx_hashes are the hex tx hashes to parse
+   * @param hashes receives the parsed hashes
+   */
+  void parse_tx_hashes(const std::vector<std::string>& tx_hashes, std::unordered_set<crypto::hash>& hashes) {
+    hashes.reserve(hashes.size() + tx_hashes.size());
+    for (const std::string& tx_hash : tx_hashes) {
+      if (tx_hash.size() != sizeof(crypto::hash) * 2 || tx_hash.find_first_not_of("0123456789abcdef") != std::string::npos) continue;
+      crypto::hash hash;
+      if (epee::string_tools::hex_to_pod(tx_hash, hash)) hashes.insert(hash);
+    }
+  }
+
+  /**
+   * Parse a hex hash or key into 32 bytes, leaving zeros if absent or invalid.
+   */
+  void to_hash32(const boost::optional<std::string>& hex, monero_hash32& hash32) {
+    static_assert(sizeof(crypto::hash) == sizeof(monero_hash32), "Unexpected hash size");
+    crypto::hash hash;
+    if (hex != boost::none && epee::string_tools::hex_to_pod(*hex, hash)) memcpy(hash32.data(), hash.data, hash32.size());
+  }
+
+  /**
+   * Add a tx to compact txs unless it is the last tx added, which is the case
+   * for consecutive transfers or outputs of the same tx in sorted results.
+   *
+   * @return the index of the compact tx
+   */
+  uint32_t add_compact_tx(const monero_tx_wallet& tx, std::vector<monero_compact_tx>& compact_txs) {
+    monero_hash32 hash = monero_hash32();
+    to_hash32(tx.m_hash, hash);
+    if (!compact_txs.empty() && compact_txs.back().m_hash == hash) return compact_txs.size() - 1;
+    monero_compact_tx compact_tx;
+    compact_tx.m_hash = hash;
+    if (tx.m_block != boost::none) {
+      compact_tx.m_height = tx.m_block.get()->m_height == boost::none ? 0 : *tx.m_block.get()->m_height;
+      compact_tx.m_timestamp = tx.m_block.get()->m_timestamp == boost::none ? 0 : *tx.m_block.get()->m_timestamp;
+    }
+    compact_tx.m_fee = tx.m_fee == boost::none ? 0 : *tx.m_fee;
+    compact_tx.m_unlock_height = tx.m_unlock_height == boost::none ? 0 : *tx.m_unlock_height;
+    compact_tx.m_is_confirmed = bool_equals(true, tx.m_is_confirmed);
+    compact_tx.m_in_tx_pool = bool_equals(true, tx.m_in_tx_pool);
+    compact_tx.m_is_failed = bool_equals(true, tx.m_is_failed);
+    compact_tx.m_is_locked = bool_equals(true, tx.m_is_locked);
+    compact_txs.push_back(compact_tx);
+    return compact_txs.size() - 1;
+  }
+
   // compute m_num_confirmations TODO monero-project: this logic is based on wallet_rpc_server.cpp `set_confirmations` but it should be encapsulated in wallet2
   void set_num_confirmations(std::shared_ptr<monero_tx_wallet>& tx, uint64_t blockchain_height) {
     std::shared_ptr<monero_block>& block = tx->m_block.get();
@@ -146,38 +640,32 @@ namespace monero {
     }
   }
 
-  std::shared_ptr<monero_tx_wallet> build_tx_with_incoming_transfer(tools::wallet2& m_w2, uint64_t height, const crypto::hash &payment_id, const tools::wallet2::payment_details &pd) {
-
-    // construct block
-    std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
-    block->m_height = pd.m_block_height;
-    block->m_timestamp = pd.m_timestamp;
+  std::shared_ptr<monero_tx_wallet> build_tx_with_incoming_transfer_unconfirmed(const tools::wallet2& m_w2, uint64_t height, const crypto::hash &payment_id, const tools::wallet2::pool_payment_details &ppd, const model_factory& factory = model_factory()) {
 
     // construct tx
-    std::shared_ptr<monero_tx_wallet> tx = std::make_shared<monero_tx_wallet>();
-    tx->m_block = block;
-    block->m_txs.push_back(tx);
+    const tools::wallet2::payment_details &pd = ppd.m_pd;
+    std::shared_ptr<monero_tx_wallet> tx = factory.make<monero_tx_wallet>();
     tx->m_hash = epee::string_tools::pod_to_hex(pd.m_tx_hash);
     tx->m_is_incoming = true;
     tx->m_payment_id = epee::string_tools::pod_to_hex(payment_id);
     if (tx->m_payment_id->substr(16).find_first_not_of('0') == std::string::npos) tx->m_payment_id = tx->m_payment_id->substr(0, 16);  // TODO monero-project: this should be part of core wallet
     if (tx->m_payment_id == monero_tx::DEFAULT_PAYMENT_ID) tx->m_payment_id = boost::none;  // clear default payment id
     tx->m_unlock_height = pd.m_unlock_time;
-    tx->m_is_locked = !m_w2.is_transfer_unlocked(pd.m_unlock_time, pd.m_block_height);
+    tx->m_is_locked = true;
     tx->m_fee = pd.m_fee;
     tx->m_note = m_w2.get_tx_note(pd.m_tx_hash);
     if (tx->m_note->empty()) tx->m_note = boost::none; // clear empty note
-    tx->m_is_miner_tx = pd.m_coinbase ? true : false;
-    tx->m_is_confirmed = true;
+    tx->m_is_miner_tx = false;
+    tx->m_is_confirmed = false;
     tx->m_is_failed = false;
     tx->m_is_relayed = true;
-    tx->m_in_tx_pool = false;
+    tx->m_in_tx_pool = true;
     tx->m_relay = true;
-    tx->m_is_double_spend_seen = false;
-    set_num_confirmations(tx, height);
+    tx->m_is_double_spend_seen = ppd.m_double_spend_seen;
+    tx->m_num_confirmations = 0;
 
     // construct transfer
-    std::shared_ptr<monero_incoming_transfer> incoming_transfer = std::make_shared<monero_incoming_transfer>();
+    std::shared_ptr<monero_incoming_transfer> incoming_transfer = factory.make<monero_incoming_transfer>();
     incoming_transfer->m_tx = tx;
     tx->m_incoming_transfers.push_back(incoming_transfer);
     incoming_transfer->m_amount = pd.m_amount;
@@ -190,42 +678,34 @@ namespace monero {
     return tx;
   }
 
-  std::shared_ptr<monero_tx_wallet> build_tx_with_outgoing_transfer(tools::wallet2& m_w2, uint64_t height, const crypto::hash &txid, const tools::wallet2::confirmed_transfer_details &pd) {
-
-    // construct block
-    std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
-    block->m_height = pd.m_block_height;
-    block->m_timestamp = pd.m_timestamp;
+  std::shared_ptr<monero_tx_wallet> build_tx_with_outgoing_transfer_unconfirmed(const tools::wallet2& m_w2, const crypto::hash &txid, const tools::wallet2::unconfirmed_transfer_details &pd, const model_factory& factory = model_factory()) {
 
     // construct tx
-    std::shared_ptr<monero_tx_wallet> tx = std::make_shared<monero_tx_wallet>();
-    tx->m_block = block;
-    block->m_txs.push_back(tx);
+    std::shared_ptr<monero_tx_wallet> tx = factory.make<monero_tx_wallet>();
+    tx->m_is_failed = pd.m_state == tools::wallet2::unconfirmed_transfer_details::failed;
     tx->m_hash = epee::string_tools::pod_to_hex(txid);
     tx->m_is_outgoing = true;
     tx->m_payment_id = epee::string_tools::pod_to_hex(pd.m_payment_id);
     if (tx->m_payment_id->substr(16).find_first_not_of('0') == std::string::npos) tx->m_payment_id = tx->m_payment_id->substr(0, 16);  // TODO monero-project: this should be part of core wallet
     if (tx->m_payment_id == monero_tx::DEFAULT_PAYMENT_ID) tx->m_payment_id = boost::none;  // clear default payment id
-    tx->m_unlock_height = pd.m_unlock_time;
-    tx->m_is_locked = !m_w2.is_transfer_unlocked(pd.m_unlock_time, pd.m_block_height);
+    tx->m_unlock_height = pd.m_tx.unlock_time;
+    tx->m_is_locked = true;
     tx->m_fee = pd.m_amount_in - pd.m_amount_out;
     tx->m_note = m_w2.get_tx_note(txid);
     if (tx->m_note->empty()) tx->m_note = boost::none; // clear empty note
     tx->m_is_miner_tx = false;
-    tx->m_is_confirmed = true;
-    tx->m_is_failed = false;
-    tx->m_is_relayed = true;
-    tx->m_in_tx_pool = false;
+    tx->m_is_confirmed = false;
+    tx->m_is_relayed = !tx->m_is_failed.get();
+    tx->m_in_tx_pool = !tx->m_is_failed.get();
     tx->m_relay = true;
-    tx->m_is_double_spend_seen = false;
-    set_num_confirmations(tx, height);
+    if (!tx->m_is_failed.get() && tx->m_is_relayed.get()) tx->m_is_double_spend_seen = false;  // TODO: test and handle if true
+    tx->m_num_confirmations = 0;
 
     // construct transfer
-    std::shared_ptr<monero_outgoing_transfer> outgoing_transfer = std::make_shared<monero_outgoing_transfer>();
+    std::shared_ptr<monero_outgoing_transfer> outgoing_transfer = factory.make<monero_outgoing_transfer>();
     outgoing_transfer->m_tx = tx;
     tx->m_outgoing_transfer = outgoing_transfer;
-    uint64_t change = pd.m_change == (uint64_t)-1 ? 0 : pd.m_change; // change may not be known
-    outgoing_transfer->m_amount = pd.m_amount_in - change - *tx->m_fee;
+    outgoing_transfer->m_amount = pd.m_amount_in - pd.m_change - tx->m_fee.get();
     outgoing_transfer->m_account_index = pd.m_subaddr_account;
     std::vector<uint32_t> subaddress_indices;
     std::vector<std::string> addresses;
@@ -238,7 +718,7 @@ namespace monero {
 
     // initialize destinations
     for (const auto &d: pd.m_dests) {
-      std::shared_ptr<monero_destination> destination = std::make_shared<monero_destination>();
+      std::shared_ptr<monero_destination> destination = factory.make<monero_destination>();
       destination->m_amount = d.amount;
       destination->m_address = d.address(m_w2.nettype(), pd.m_payment_id);
       outgoing_transfer->m_destinations.push_back(destination);
@@ -256,140 +736,123 @@ namespace monero {
     return tx;
   }
 
-  std::shared_ptr<monero_tx_wallet> build_tx_with_incoming_transfer_unconfirmed(const tools::wallet2& m_w2, uint64_t height, const crypto::hash &payment_id, const tools::wallet2::pool_payment_details &ppd) {
+  std::shared_ptr<monero_tx_wallet> build_tx_with_vout(tools::wallet2& m_w2, const tools::wallet2::transfer_details& td, const model_factory& factory = model_factory()) {
+
+    // construct block
+    std::shared_ptr<monero_block> block = factory.make<monero_block>();
+    block->m_height = td.m_block_height;
 
     // construct tx
-    const tools::wallet2::payment_details &pd = ppd.m_pd;
-    std::shared_ptr<monero_tx_wallet> tx = std::make_shared<monero_tx_wallet>();
-    tx->m_hash = epee::string_tools::pod_to_hex(pd.m_tx_hash);
-    tx->m_is_incoming = true;
-    tx->m_payment_id = epee::string_tools::pod_to_hex(payment_id);
-    if (tx->m_payment_id->substr(16).find_first_not_of('0') == std::string::npos) tx->m_payment_id = tx->m_payment_id->substr(0, 16);  // TODO monero-project: this should be part of core wallet
-    if (tx->m_payment_id == monero_tx::DEFAULT_PAYMENT_ID) tx->m_payment_id = boost::none;  // clear default payment id
-    tx->m_unlock_height = pd.m_unlock_time;
-    tx->m_is_locked = true;
-    tx->m_fee = pd.m_fee;
-    tx->m_note = m_w2.get_tx_note(pd.m_tx_hash);
-    if (tx->m_note->empty()) tx->m_note = boost::none; // clear empty note
-    tx->m_is_miner_tx = false;
-    tx->m_is_confirmed = false;
+    std::shared_ptr<monero_tx_wallet> tx = factory.make<monero_tx_wallet>();
+    tx->m_block = block;
+    block->m_txs.push_back(tx);
+    tx->m_hash = epee::string_tools::pod_to_hex(td.m_txid);
+    tx->m_is_confirmed = true;
     tx->m_is_failed = false;
     tx->m_is_relayed = true;
-    tx->m_in_tx_pool = true;
+    tx->m_in_tx_pool = false;
     tx->m_relay = true;
-    tx->m_is_double_spend_seen = ppd.m_double_spend_seen;
-    tx->m_num_confirmations = 0;
+    tx->m_is_double_spend_seen = false;
+    tx->m_is_locked = !m_w2.is_transfer_unlocked(td);
 
-    // construct transfer
-    std::shared_ptr<monero_incoming_transfer> incoming_transfer = std::make_shared<monero_incoming_transfer>();
-    incoming_transfer->m_tx = tx;
-    tx->m_incoming_transfers.push_back(incoming_transfer);
-    incoming_transfer->m_amount = pd.m_amount;
-    incoming_transfer->m_account_index = pd.m_subaddr_index.major;
-    incoming_transfer->m_subaddress_index = pd.m_subaddr_index.minor;
-    incoming_transfer->m_address = m_w2.get_subaddress_as_str(pd.m_subaddr_index);
-    set_num_suggested_confirmations(incoming_transfer, height, m_w2.get_last_block_reward(), pd.m_unlock_time);
+    // construct output
+    std::shared_ptr<monero_output_wallet> output = factory.make<monero_output_wallet>();
+    output->m_tx = tx;
+    tx->m_outputs.push_back(output);
+    output->m_amount = td.amount();
+    output->m_index = td.m_global_output_index;
+    output->m_account_index = td.m_subaddr_index.major;
+    output->m_subaddress_index = td.m_subaddr_index.minor;
+    output->m_is_spent = td.m_spent;
+    output->m_is_frozen = td.m_frozen;
+    //output->m_stealth_public_key = epee::string_tools::pod_to_hex(td.get_public_key()); // TODO (monero-wallet-rpc): provide this field
+    if (td.m_key_image_known) {
+      output->m_key_image = factory.make<monero_key_image>();
+      output->m_key_image.get()->m_hex = epee::string_tools::pod_to_hex(td.m_key_image);
+    }
 
     // return pointer to new tx
     return tx;
   }
 
-  std::shared_ptr<monero_tx_wallet> build_tx_with_outgoing_transfer_unconfirmed(const tools::wallet2& m_w2, const crypto::hash &txid, const tools::wallet2::unconfirmed_transfer_details &pd) {
+  /**
+   * Evaluates the cheap criteria of an output query directly against wallet2's
+   * transfer details so models are only built for outputs which can match.
+   *
+   * Only rejects outputs which monero_output_query::meets_criteria() would also
+   * reject; remaining criteria are applied to the built models.
+   */
+  struct output_prefilter {
 
-    // construct tx
-    std::shared_ptr<monero_tx_wallet> tx = std::make_shared<monero_tx_wallet>();
-    tx->m_is_failed = pd.m_state == tools::wallet2::unconfirmed_transfer_details::failed;
-    tx->m_hash = epee::string_tools::pod_to_hex(txid);
-    tx->m_is_outgoing = true;
-    tx->m_payment_id = epee::string_tools::pod_to_hex(pd.m_payment_id);
-    if (tx->m_payment_id->substr(16).find_first_not_of('0') == std::string::npos) tx->m_payment_id = tx->m_payment_id->substr(0, 16);  // TODO monero-project: this should be part of core wallet
-    if (tx->m_payment_id == monero_tx::DEFAULT_PAYMENT_ID) tx->m_payment_id = boost::none;  // clear default payment id
-    tx->m_unlock_height = pd.m_tx.unlock_time;
-    tx->m_is_locked = true;
-    tx->m_fee = pd.m_amount_in - pd.m_amount_out;
-    tx->m_note = m_w2.get_tx_note(txid);
-    if (tx->m_note->empty()) tx->m_note = boost::none; // clear empty note
-    tx->m_is_miner_tx = false;
-    tx->m_is_confirmed = false;
-    tx->m_is_relayed = !tx->m_is_failed.get();
-    tx->m_in_tx_pool = !tx->m_is_failed.get();
-    tx->m_relay = true;
-    if (!tx->m_is_failed.get() && tx->m_is_relayed.get()) tx->m_is_double_spend_seen = false;  // TODO: test and handle if true
-    tx->m_num_confirmations = 0;
-
-    // construct transfer
-    std::shared_ptr<monero_outgoing_transfer> outgoing_transfer = std::make_shared<monero_outgoing_transfer>();
-    outgoing_transfer->m_tx = tx;
-    tx->m_outgoing_transfer = outgoing_transfer;
-    outgoing_transfer->m_amount = pd.m_amount_in - pd.m_change - tx->m_fee.get();
-    outgoing_transfer->m_account_index = pd.m_subaddr_account;
-    std::vector<uint32_t> subaddress_indices;
-    std::vector<std::string> addresses;
-    for (uint32_t i: pd.m_subaddr_indices) {
-      subaddress_indices.push_back(i);
-      addresses.push_back(m_w2.get_subaddress_as_str({pd.m_subaddr_account, i}));
-    }
-    outgoing_transfer->m_subaddress_indices = subaddress_indices;
-    outgoing_transfer->m_addresses = addresses;
+    output_prefilter(const monero_output_query& query) : m_query(query), m_excludes_all(false), m_min_height(0), m_max_height(CRYPTONOTE_MAX_BLOCK_NUMBER), m_filter_hashes(false) {
+      m_subaddress_indices.insert(query.m_subaddress_indices.begin(), query.m_subaddress_indices.end());
 
-    // initialize destinations
-    for (const auto &d: pd.m_dests) {
-      std::shared_ptr<monero_destination> destination = std::make_shared<monero_destination>();
-      destination->m_amount = d.amount;
-      destination->m_address = d.address(m_w2.nettype(), pd.m_payment_id);
-      outgoing_transfer->m_destinations.push_back(destination);
-    }
+      // parse key image to filter
+      if (query.m_key_image != boost::none) {
+        if ((*query.m_key_image)->m_signature != boost::none) m_excludes_all = true; // outputs are built without signatures
+        if ((*query.m_key_image)->m_hex != boost::none) {
+          m_key_image = crypto::key_image();
+          if (!epee::string_tools::hex_to_pod(*(*query.m_key_image)->m_hex, *m_key_image)) m_excludes_all = true;
+        }
+      }
 
-    // replace transfer amount with destination sum
-    // TODO monero-project: confirmed tx from/to same account has amount 0 but cached transfer destinations
-    if (*outgoing_transfer->m_amount == 0 && !outgoing_transfer->m_destinations.empty()) {
-      uint64_t amount = 0;
-      for (const std::shared_ptr<monero_destination>& destination : outgoing_transfer->m_destinations) amount += *destination->m_amount;
-      outgoing_transfer->m_amount = amount;
+      // translate tx criteria, all outputs are confirmed and relayed
+      if (query.m_tx_query == boost::none) return;
+      const std::shared_ptr<monero_tx_query>& tx_query = *query.m_tx_query;
+      if (bool_equals(false, tx_query->m_is_confirmed) || bool_equals(true, tx_query->m_in_tx_pool) || bool_equals(true, tx_query->m_is_failed)) m_excludes_all = true;
+      if (tx_query->m_min_height != boost::none) m_min_height = *tx_query->m_min_height;
+      if (tx_query->m_max_height != boost::none) m_max_height = *tx_query->m_max_height;
+      if (tx_query->m_height != boost::none) {
+        m_min_height = std::max(m_min_height, *tx_query->m_height);
+        m_max_height = std::min(m_max_height, *tx_query->m_height);
+      }
+      if (m_min_height > m_max_height) m_excludes_all = true;
+      if (tx_query->m_hash != boost::none) add_hash_filter(std::vector<std::string>{ *tx_query->m_hash });
+      if (!tx_query->m_hashes.empty()) add_hash_filter(tx_query->m_hashes);
+    }
+
+    bool excludes_all() const { return m_excludes_all; }
+
+    bool excludes(const tools::wallet2::transfer_details& td) const {
+      if (m_query.m_account_index != boost::none && *m_query.m_account_index != td.m_subaddr_index.major) return true;
+      if (m_query.m_subaddress_index != boost::none && *m_query.m_subaddress_index != td.m_subaddr_index.minor) return true;
+      if (!m_subaddress_indices.empty() && m_subaddress_indices.count(td.m_subaddr_index.minor) == 0) return true;
+      if (m_query.m_is_spent != boost::none && *m_query.m_is_spent != td.m_spent) return true;
+      if (m_query.m_is_frozen != boost::none && *m_query.m_is_frozen != td.m_frozen) return true;
+      if (m_query.m_amount != boost::none && *m_query.m_amount != td.amount()) return true;
+      if (m_query.m_min_amount != boost::none && td.amount() < *m_query.m_min_amount) return true;
+      if (m_query.m_max_amount != boost::none && td.amount() > *m_query.m_max_amount) return true;
+      if (m_key_image != boost::none && (!td.m_key_image_known || td.m_key_image != *m_key_image)) return true;
+      if (td.m_block_height < m_min_height || td.m_block_height > m_max_height) return true;
+      if (m_filter_hashes && m_hashes.count(td.m_txid) == 0) return true;
+      return false;
     }
 
-    // return pointer to new tx
-    return tx;
-  }
-
-  std::shared_ptr<monero_tx_wallet> build_tx_with_vout(tools::wallet2& m_w2, const tools::wallet2::transfer_details& td) {
-
-    // construct block
-    std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
-    block->m_height = td.m_block_height;
-
-    // construct tx
-    std::shared_ptr<monero_tx_wallet> tx = std::make_shared<monero_tx_wallet>();
-    tx->m_block = block;
-    block->m_txs.push_back(tx);
-    tx->m_hash = epee::string_tools::pod_to_hex(td.m_txid);
-    tx->m_is_confirmed = true;
-    tx->m_is_failed = false;
-    tx->m_is_relayed = true;
-    tx->m_in_tx_pool = false;
-    tx->m_relay = true;
-    tx->m_is_double_spend_seen = false;
-    tx->m_is_locked = !m_w2.is_transfer_unlocked(td);
-
-    // construct output
-    std::shared_ptr<monero_output_wallet> output = std::make_shared<monero_output_wallet>();
-    output->m_tx = tx;
-    tx->m_outputs.push_back(output);
-    output->m_amount = td.amount();
-    output->m_index = td.m_global_output_index;
-    output->m_account_index = td.m_subaddr_index.major;
-    output->m_subaddress_index = td.m_subaddr_index.minor;
-    output->m_is_spent = td.m_spent;
-    output->m_is_frozen = td.m_frozen;
-    //output->m_stealth_public_key = epee::string_tools::pod_to_hex(td.get_public_key()); // TODO (monero-wallet-rpc): provide this field
-    if (td.m_key_image_known) {
-      output->m_key_image = std::make_shared<monero_key_image>();
-      output->m_key_image.get()->m_hex = epee::string_tools::pod_to_hex(td.m_key_image);
+  private:
+    const monero_output_query& m_query;
+    bool m_excludes_all;
+    std::set<uint32_t> m_subaddress_indices;
+    boost::optional<crypto::key_image> m_key_image;
+    uint64_t m_min_height;
+    uint64_t m_max_height;
+    bool m_filter_hashes;
+    std::unordered_set<crypto::hash> m_hashes;
+
+    // intersect tx hashes to filter
+    void add_hash_filter(const std::vector<std::string>& tx_hashes) {
+      std::unordered_set<crypto::hash> hashes;
+      parse_tx_hashes(tx_hashes, hashes);
+      if (m_filter_hashes) {
+        for (std::unordered_set<crypto::hash>::iterator iter = hashes.begin(); iter != hashes.end(); ) {
+          if (m_hashes.count(*iter) == 0) iter = hashes.erase(iter);
+          else ++iter;
+        }
+      }
+      m_hashes = std::move(hashes);
+      m_filter_hashes = true;
+      if (m_hashes.empty()) m_excludes_all = true;
     }
-
-    // return pointer to new tx
-    return tx;
-  }
+  };
 
   /**
    * Merges a transaction into a unique std::set of transactions.
@@ -690,238 +1153,1590 @@ namespace monero {
     return true;
   }
 
-  // ----------------------------- WALLET LISTENER ----------------------------
+  // -------------------------------- TX INDEX --------------------------------
 
   /**
-   * Listens to wallet2 notifications in order to notify external wallet listeners.
+   * Incrementally maintained index of wallet2's confirmed incoming and outgoing
+   * payments.
+   *
+   * Rows are appended in height order as wallet2 processes blocks, so confirmed
+   * transfers can be looked up by hash, height range, and account without
+   * walking and rebuilding every wallet2 payment on each query.  Rows hold the
+   * fields which lookups and the transfer model builders use, so queries build
+   * models from rows without reading wallet2's payment containers.  wallet2
+   * callbacks record which heights changed, and the index pulls only those
+   * heights from wallet2 when next queried.  Unconfirmed, pool, and failed
+   * transfers are few and remain live wallet2 queries.
    */
-  struct wallet2_listener : public tools::i_wallet2_callback {
+  struct monero_tx_index {
 
-  public:
+    /**
+     * Confirmed incoming payment row.
+     */
+    struct incoming_row {
+      crypto::hash m_tx_hash;
+      crypto::hash m_payment_id;
+      uint64_t m_height;
+      uint64_t m_timestamp;
+      uint64_t m_unlock_time;
+      uint64_t m_amount;
+      uint64_t m_fee;
+      cryptonote::subaddress_index m_subaddr_index;   // one row per subaddress which the tx pays
+      bool m_coinbase;
+      uint64_t height() const { return m_height; }
+      const crypto::hash& tx_hash() const { return m_tx_hash; }
+      uint32_t account_index() const { return m_subaddr_index.major; }
+      bool has_subaddress(const std::set<uint32_t>& subaddress_indices) const { return subaddress_indices.count(m_subaddr_index.minor) > 0; }
+    };
 
     /**
-     * Constructs the listener.
-     *
-     * @param wallet provides context to notify external listeners
-     * @param wallet2 provides source notifications which this listener propagates to external listeners
+     * Confirmed outgoing payment row.
      */
-    wallet2_listener(monero_wallet_full& wallet, tools::wallet2& wallet2) : m_wallet(wallet), m_w2(wallet2) {
-      this->m_sync_start_height = boost::none;
-      this->m_sync_end_height = boost::none;
-      m_prev_balance = wallet.get_balance();
-      m_prev_unlocked_balance = wallet.get_unlocked_balance();
-      m_notification_pool = std::unique_ptr<tools::threadpool>(tools::threadpool::getNewForUnitTests(1));  // TODO (monero-project): utility can be for general use
-    }
+    struct outgoing_row {
+      crypto::hash m_tx_hash;
+      crypto::hash m_payment_id;
+      uint64_t m_height;
+      uint64_t m_timestamp;
+      uint64_t m_unlock_time;
+      uint64_t m_amount_in;
+      uint64_t m_amount_out;
+      uint64_t m_change;
+      uint32_t m_account_index;
+      std::vector<uint32_t> m_subaddress_indices;     // subaddresses spent from
+      std::vector<cryptonote::tx_destination_entry> m_dests;
+      uint64_t height() const { return m_height; }
+      const crypto::hash& tx_hash() const { return m_tx_hash; }
+      uint32_t account_index() const { return m_account_index; }
+      bool has_subaddress(const std::set<uint32_t>& subaddress_indices) const {
+        for (uint32_t subaddress_idx : m_subaddress_indices) if (subaddress_indices.count(subaddress_idx) > 0) return true;
+        return false;
+      }
+    };
 
-    ~wallet2_listener() {
-      MTRACE("~wallet2_listener()");
-      m_w2.callback(nullptr);
-      m_notification_pool->recycle();
-    }
+    /**
+     * Criteria to look up rows.  Heights are inclusive.
+     */
+    struct index_query {
+      uint64_t m_min_height = 0;
+      uint64_t m_max_height = CRYPTONOTE_MAX_BLOCK_NUMBER;
+      boost::optional<uint32_t> m_account_index;
+      std::set<uint32_t> m_subaddress_indices;
+      bool m_filter_hashes = false;
+      std::vector<crypto::hash> m_hashes;             // unique tx hashes to look up
+    };
 
-    void update_listening() {
+    boost::mutex m_mutex; // guards the index; held while updating and visiting rows
 
-      // if starting to listen, cache locked txs for later comparison
-      if (!m_wallet.get_listeners().empty() && m_w2.callback() == nullptr) check_for_changed_unlocked_txs();
+    monero_tx_index(tools::wallet2& wallet2) : m_w2(wallet2), m_height(0), m_rebuild(true) { }
 
-      // update callback
-      m_w2.callback(m_wallet.get_listeners().empty() ? nullptr : this);
+    /**
+     * Mark the index for a full rebuild on next use, e.g. after a rescan or
+     * import which changes wallet2's payments without block callbacks.
+     */
+    void invalidate() {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_rebuild = true;
     }
 
-    void on_sync_start(uint64_t start_height) {
-      tools::threadpool::waiter waiter(*m_notification_pool);
-      m_notification_pool->submit(&waiter, [this, start_height]() {
-        if (m_sync_start_height != boost::none || m_sync_end_height != boost::none) throw std::runtime_error("Sync start or end height should not already be allocated, is previous sync in progress?");
-        m_sync_start_height = start_height;
-        m_sync_end_height = m_wallet.get_daemon_height();
-      });
+    /**
+     * Record that wallet2 received or spent funds at the given height.
+     */
+    void on_money_event(uint64_t height) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (height < m_height) truncate(height); // block re-processed after reorg
+      m_dirty_heights.insert(height);
     }
 
-    void on_sync_end() {
-      tools::threadpool::waiter waiter(*m_notification_pool);
-      m_notification_pool->submit(&waiter, [this]() {
-        check_for_changed_balances();
-        if (m_prev_locked_tx_hashes.size() > 0) check_for_changed_unlocked_txs();
-        m_sync_start_height = boost::none;
-        m_sync_end_height = boost::none;
-      });
-      m_notification_pool->recycle();
+    /**
+     * Record that wallet2 processed the given block.
+     */
+    void on_new_block(uint64_t height, const cryptonote::block& cn_block) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (height < m_height) truncate(height); // block re-processed after reorg
+
+      // outgoing txs confirm without money callbacks if key images are unknown (e.g. multisig)
+      if (!m_pending_out_hashes.empty()) {
+        for (const crypto::hash& tx_hash : cn_block.tx_hashes) {
+          if (m_pending_out_hashes.erase(tx_hash) > 0) m_dirty_heights.insert(height);
+        }
+      }
     }
 
-    void on_new_block(uint64_t height, const cryptonote::block& cn_block) override {
-      if (m_wallet.get_listeners().empty()) return;
-
-      // ignore notifications before sync start height, irrelevant to clients
-      if (m_sync_start_height == boost::none || height < *m_sync_start_height) return;
+    /**
+     * Record outgoing txs relayed from this wallet so their confirmation is indexed.
+     */
+    void on_relay(const std::vector<crypto::hash>& tx_hashes) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_pending_out_hashes.insert(tx_hashes.begin(), tx_hashes.end());
+    }
 
-      // queue notification processing off main thread
-      tools::threadpool::waiter waiter(*m_notification_pool);
-      m_notification_pool->submit(&waiter, [this, height]() {
+    /**
+     * Bring the index up to date with wallet2.  Caller must hold m_mutex.
+     */
+    void update() {
+
+      // rows below the wallet's height are final in wallet2
+      uint64_t height = m_w2.get_blockchain_current_height();
+
+      // rebuild from scratch if invalidated
+      boost::optional<uint64_t> fetch_from_height;
+      if (m_rebuild) {
+        clear();
+        m_rebuild = false;
+        fetch_from_height = 0;
+
+        // watch for confirmation of unconfirmed outgoing txs
+        std::list<std::pair<crypto::hash, tools::wallet2::unconfirmed_transfer_details>> upayments;
+        m_w2.get_unconfirmed_payments_out(upayments);
+        for (const auto& upayment : upayments) m_pending_out_hashes.insert(upayment.first);
+      } else {
+        if (height < m_height) truncate(height);
+        std::set<uint64_t>::const_iterator dirty_iter = m_dirty_heights.begin();
+        if (dirty_iter != m_dirty_heights.end() && *dirty_iter < height) fetch_from_height = std::max(*dirty_iter, m_height);
+      }
 
-        // notify listeners of new block
-        for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-          listener->on_new_block(height);
+      // fetch changed heights from wallet2
+      if (fetch_from_height != boost::none && height > 0 && *fetch_from_height < height) {
+        uint64_t min_height = to_exclusive_min_height(*fetch_from_height);
+
+        std::list<std::pair<crypto::hash, tools::wallet2::payment_details>> payments;
+        m_w2.get_payments(payments, min_height, height - 1);
+        std::vector<incoming_row> incoming_rows;
+        incoming_rows.reserve(payments.size());
+        for (const auto& payment : payments) {
+          const tools::wallet2::payment_details& pd = payment.second;
+          incoming_rows.push_back(incoming_row());
+          incoming_row& row = incoming_rows.back();
+          row.m_tx_hash = pd.m_tx_hash;
+          row.m_payment_id = payment.first;
+          row.m_height = pd.m_block_height;
+          row.m_timestamp = pd.m_timestamp;
+          row.m_unlock_time = pd.m_unlock_time;
+          row.m_amount = pd.m_amount;
+          row.m_fee = pd.m_fee;
+          row.m_subaddr_index = pd.m_subaddr_index;
+          row.m_coinbase = pd.m_coinbase;
         }
-
-        // notify listeners of sync progress
-        if (height >= *m_sync_end_height) m_sync_end_height = height + 1; // increase end height if necessary
-        double percent_done = (double) (height - *m_sync_start_height + 1) / (double) (*m_sync_end_height - *m_sync_start_height);
-        std::string message = std::string("Synchronizing");
-        for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-          listener->on_sync_progress(height, *m_sync_start_height, *m_sync_end_height, percent_done, message);
+        append(incoming_rows, m_incoming, m_incoming_by_hash, m_incoming_by_account);
+
+        std::list<std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>> payments_out;
+        m_w2.get_payments_out(payments_out, min_height, height - 1);
+        std::vector<outgoing_row> outgoing_rows;
+        outgoing_rows.reserve(payments_out.size());
+        for (const auto& payment_out : payments_out) {
+          const tools::wallet2::confirmed_transfer_details& ctd = payment_out.second;
+          outgoing_rows.push_back(outgoing_row());
+          outgoing_row& row = outgoing_rows.back();
+          row.m_tx_hash = payment_out.first;
+          row.m_payment_id = ctd.m_payment_id;
+          row.m_height = ctd.m_block_height;
+          row.m_timestamp = ctd.m_timestamp;
+          row.m_unlock_time = ctd.m_unlock_time;
+          row.m_amount_in = ctd.m_amount_in;
+          row.m_amount_out = ctd.m_amount_out;
+          row.m_change = ctd.m_change;
+          row.m_account_index = ctd.m_subaddr_account;
+          row.m_subaddress_indices.assign(ctd.m_subaddr_indices.begin(), ctd.m_subaddr_indices.end());
+          row.m_dests = ctd.m_dests;
+          m_pending_out_hashes.erase(payment_out.first);
         }
+        append(outgoing_rows, m_outgoing, m_outgoing_by_hash, m_outgoing_by_account);
+      }
 
-        // notify if balances change
-        bool balances_changed = check_for_changed_balances();
+      // index is complete below the wallet's height
+      m_dirty_heights.erase(m_dirty_heights.begin(), m_dirty_heights.lower_bound(height));
+      m_height = height;
+    }
 
-        // notify when txs unlock after wallet is synced
-        if (balances_changed && m_wallet.is_synced()) check_for_changed_unlocked_txs();
-      });
+    /**
+     * Visit confirmed incoming rows which meet the query in height order, or
+     * in hash order if the query filters hashes.  Caller must hold m_mutex.
+     */
+    void for_each_incoming(const index_query& query, const std::function<void(const incoming_row&)>& visitor) const {
+      std::vector<size_t> matches;
+      find(query, m_incoming, m_incoming_by_hash, m_incoming_by_account, matches);
+      for (size_t idx : matches) visitor(m_incoming[idx]);
     }
 
-    void on_unconfirmed_money_received(uint64_t height, const crypto::hash &txid, const cryptonote::transaction& cn_tx, uint64_t amount, const cryptonote::subaddress_index& subaddr_index) override {
-      if (m_wallet.get_listeners().empty()) return;
+    /**
+     * Visit confirmed outgoing rows which meet the query in height order, or
+     * in hash order if the query filters hashes.  Caller must hold m_mutex.
+     */
+    void for_each_outgoing(const index_query& query, const std::function<void(const outgoing_row&)>& visitor) const {
+      std::vector<size_t> matches;
+      find(query, m_outgoing, m_outgoing_by_hash, m_outgoing_by_account, matches);
+      for (size_t idx : matches) visitor(m_outgoing[idx]);
+    }
 
-      // queue notification processing off main thread
-      tools::threadpool::waiter waiter(*m_notification_pool);
-      m_notification_pool->submit(&waiter, [this, height, txid, cn_tx, amount, subaddr_index]() {
-
-        // create library tx
-        std::shared_ptr<monero_tx_wallet> tx = std::static_pointer_cast<monero_tx_wallet>(monero_utils::cn_tx_to_tx(cn_tx, true));
-        tx->m_hash = epee::string_tools::pod_to_hex(txid);
-        tx->m_is_confirmed = false;
-        tx->m_is_locked = true;
-        std::shared_ptr<monero_output_wallet> output = std::make_shared<monero_output_wallet>();
-        tx->m_outputs.push_back(output);
-        output->m_tx = tx;
-        output->m_amount = amount;
-        output->m_account_index = subaddr_index.major;
-        output->m_subaddress_index = subaddr_index.minor;
+    /**
+     * Get the far height of a window starting at the given height which spans
+     * about the given number of incoming and outgoing rows.  Caller must hold m_mutex.
+     *
+     * @param from_height is the height the window starts at (inclusive)
+     * @param num_rows is the approximate number of rows to span
+     * @param sort_order is the direction the window extends from the start height
+     * @return the far height of the window (inclusive)
+     */
+    uint64_t get_window_bound(uint64_t from_height, size_t num_rows, monero_sort_order sort_order) const {
+      if (sort_order == ASCENDING) return std::min(get_window_bound_ascending(from_height, num_rows, m_incoming), get_window_bound_ascending(from_height, num_rows, m_outgoing));
+      else return std::max(get_window_bound_descending(from_height, num_rows, m_incoming), get_window_bound_descending(from_height, num_rows, m_outgoing));
+    }
 
-        // notify listeners of output
-        for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-          listener->on_output_received(*output);
+  private:
+    tools::wallet2& m_w2;
+    uint64_t m_height;                                                      // rows at heights below this height are indexed
+    bool m_rebuild;                                                         // rebuild index from wallet2 on next update
+    std::set<uint64_t> m_dirty_heights;                                     // heights with changes not yet indexed
+    std::unordered_set<crypto::hash> m_pending_out_hashes;                  // unconfirmed outgoing txs to watch for in blocks
+    std::vector<incoming_row> m_incoming;                                   // confirmed incoming rows sorted by height
+    std::unordered_multimap<crypto::hash, size_t> m_incoming_by_hash;       // tx hash to incoming rows (one per subaddress)
+    std::unordered_map<uint32_t, std::vector<size_t>> m_incoming_by_account; // account index to ascending incoming rows
+    std::vector<outgoing_row> m_outgoing;                                   // confirmed outgoing rows sorted by height
+    std::unordered_multimap<crypto::hash, size_t> m_outgoing_by_hash;       // tx hash to outgoing row
+    std::unordered_map<uint32_t, std::vector<size_t>> m_outgoing_by_account; // account index to ascending outgoing rows
+
+    // convert an inclusive min height to wallet2's exclusive min height
+    static uint64_t to_exclusive_min_height(uint64_t min_height) {
+      return min_height == 0 ? 0 : min_height - 1;
+    }
+
+    void clear() {
+      m_height = 0;
+      m_dirty_heights.clear();
+      m_pending_out_hashes.clear();
+      m_incoming.clear();
+      m_incoming_by_hash.clear();
+      m_incoming_by_account.clear();
+      m_outgoing.clear();
+      m_outgoing_by_hash.clear();
+      m_outgoing_by_account.clear();
+    }
+
+    // remove rows at or above the given height
+    void truncate(uint64_t height) {
+      truncate(height, m_incoming, m_incoming_by_hash, m_incoming_by_account);
+      truncate(height, m_outgoing, m_outgoing_by_hash, m_outgoing_by_account);
+      m_height = std::min(m_height, height);
+    }
+
+    template <class row_t>
+    static void truncate(uint64_t height, std::vector<row_t>& rows, std::unordered_multimap<crypto::hash, size_t>& by_hash, std::unordered_map<uint32_t, std::vector<size_t>>& by_account) {
+      while (!rows.empty() && rows.back().height() >= height) {
+        size_t idx = rows.size() - 1;
+        auto range = by_hash.equal_range(rows.back().tx_hash());
+        for (auto iter = range.first; iter != range.second; ++iter) {
+          if (iter->second == idx) {
+            by_hash.erase(iter);
+            break;
+          }
         }
+        std::vector<size_t>& account_rows = by_account[rows.back().account_index()];
+        if (!account_rows.empty() && account_rows.back() == idx) account_rows.pop_back();
+        rows.pop_back();
+      }
+    }
 
-        // notify if balances changed
-        check_for_changed_balances();
-
-        // watch for unlock
-        m_prev_locked_tx_hashes.insert(tx->m_hash.get());
-
-        // free memory
-        output.reset();
-        tx.reset();
-      });
+    // append rows from wallet2 which are newer than the indexed rows
+    template <class row_t>
+    static void append(std::vector<row_t>& new_rows, std::vector<row_t>& rows, std::unordered_multimap<crypto::hash, size_t>& by_hash, std::unordered_map<uint32_t, std::vector<size_t>>& by_account) {
+      std::stable_sort(new_rows.begin(), new_rows.end(), [](const row_t& row1, const row_t& row2) { return row1.height() < row2.height(); });
+      rows.reserve(rows.size() + new_rows.size());
+      for (row_t& row : new_rows) {
+        size_t idx = rows.size();
+        by_hash.insert(std::make_pair(row.tx_hash(), idx));
+        by_account[row.account_index()].push_back(idx);
+        rows.push_back(std::move(row));
+      }
     }
 
-    void on_money_received(uint64_t height, const crypto::hash &txid, const cryptonote::transaction& cn_tx, uint64_t amount, const cryptonote::subaddress_index& subaddr_index, bool is_change, uint64_t unlock_height) override {
-      if (m_wallet.get_listeners().empty()) return;
+    template <class row_t>
+    static uint64_t get_window_bound_ascending(uint64_t from_height, size_t num_rows, const std::vector<row_t>& rows) {
+      typename std::vector<row_t>::const_iterator iter = std::lower_bound(rows.begin(), rows.end(), from_height, [](const row_t& row, uint64_t height) { return row.height() < height; });
+      if (static_cast<size_t>(rows.end() - iter) <= num_rows) return std::numeric_limits<uint64_t>::max();
+      return (iter + num_rows)->height();
+    }
 
-      // queue notification processing off main thread
-      tools::threadpool::waiter waiter(*m_notification_pool);
-      m_notification_pool->submit(&waiter, [this, height, txid, cn_tx, amount, subaddr_index, is_change, unlock_height]() {
-
-        // create native library tx
-        std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
-        block->m_height = height;
-        std::shared_ptr<monero_tx_wallet> tx = std::static_pointer_cast<monero_tx_wallet>(monero_utils::cn_tx_to_tx(cn_tx, true));
-        block->m_txs.push_back(tx);
-        tx->m_block = block;
-        tx->m_hash = epee::string_tools::pod_to_hex(txid);
-        tx->m_is_confirmed = true;
-        tx->m_is_locked = true;
-        tx->m_unlock_height = unlock_height;
-        std::shared_ptr<monero_output_wallet> output = std::make_shared<monero_output_wallet>();
-        tx->m_outputs.push_back(output);
-        output->m_tx = tx;
-        output->m_amount = amount;
-        output->m_account_index = subaddr_index.major;
-        output->m_subaddress_index = subaddr_index.minor;
+    template <class row_t>
+    static uint64_t get_window_bound_descending(uint64_t from_height, size_t num_rows, const std::vector<row_t>& rows) {
+      typename std::vector<row_t>::const_iterator iter = std::upper_bound(rows.begin(), rows.end(), from_height, [](uint64_t height, const row_t& row) { return height < row.height(); });
+      if (static_cast<size_t>(iter - rows.begin()) <= num_rows) return 0;
+      return (iter - num_rows - 1)->height();
+    }
 
-        // notify listeners of output
-        for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-          listener->on_output_received(*output);
+    // collect indices of rows which meet the query using the most selective index
+    template <class row_t>
+    static void find(const index_query& query, const std::vector<row_t>& rows, const std::unordered_multimap<crypto::hash, size_t>& by_hash, const std::unordered_map<uint32_t, std::vector<size_t>>& by_account, std::vector<size_t>& matches) {
+      auto meets_query = [&](const row_t& row) {
+        if (row.height() < query.m_min_height || row.height() > query.m_max_height) return false;
+        if (query.m_account_index != boost::none && row.account_index() != *query.m_account_index) return false;
+        if (!query.m_subaddress_indices.empty() && !row.has_subaddress(query.m_subaddress_indices)) return false;
+        return true;
+      };
+      if (query.m_min_height > query.m_max_height) return;
+
+      // look up by hash in O(1) per hash; rows are visited in hash order since callers sort their results
+      if (query.m_filter_hashes) {
+        for (const crypto::hash& tx_hash : query.m_hashes) {
+          auto range = by_hash.equal_range(tx_hash);
+          for (auto iter = range.first; iter != range.second; ++iter) {
+            if (meets_query(rows[iter->second])) matches.push_back(iter->second);
+          }
         }
+        return;
+      }
 
-        // watch for unlock
-        m_prev_locked_tx_hashes.insert(tx->m_hash.get());
+      // look up by account within height range
+      if (query.m_account_index != boost::none) {
+        std::unordered_map<uint32_t, std::vector<size_t>>::const_iterator account_iter = by_account.find(*query.m_account_index);
+        if (account_iter == by_account.end()) return;
+        const std::vector<size_t>& account_rows = account_iter->second;
+        std::vector<size_t>::const_iterator iter = std::lower_bound(account_rows.begin(), account_rows.end(), query.m_min_height, [&](size_t idx, uint64_t height) { return rows[idx].height() < height; });
+        for (; iter != account_rows.end() && rows[*iter].height() <= query.m_max_height; ++iter) {
+          if (meets_query(rows[*iter])) matches.push_back(*iter);
+        }
+        return;
+      }
 
-        // free memory
-        monero_utils::free(block);
-        output.reset();
-        tx.reset();
-      });
+      // look up by height range
+      typename std::vector<row_t>::const_iterator iter = std::lower_bound(rows.begin(), rows.end(), query.m_min_height, [](const row_t& row, uint64_t height) { return row.height() < height; });
+      for (; iter != rows.end() && iter->height() <= query.m_max_height; ++iter) {
+        if (meets_query(*iter)) matches.push_back(iter - rows.begin());
+      }
     }
+  };
 
-    void on_money_spent(uint64_t height, const crypto::hash &txid, const cryptonote::transaction& cn_tx_in, uint64_t amount, const cryptonote::transaction& cn_tx_out, const cryptonote::subaddress_index& subaddr_index) override {
-      if (m_wallet.get_listeners().empty()) return;
-      if (&cn_tx_in != &cn_tx_out) throw std::runtime_error("on_money_spent() in tx is different than out tx");
+  std::shared_ptr<monero_tx_wallet> build_tx_with_incoming_transfer(tools::wallet2& m_w2, uint64_t height, const monero_tx_index::incoming_row& row, const model_factory& factory = model_factory()) {
 
-      // queue notification processing off main thread
-      tools::threadpool::waiter waiter(*m_notification_pool);
-      m_notification_pool->submit(&waiter, [this, height, txid, cn_tx_in, amount, cn_tx_out, subaddr_index]() {
-
-        // create native library tx
-        std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
-        block->m_height = height;
-        std::shared_ptr<monero_tx_wallet> tx = std::static_pointer_cast<monero_tx_wallet>(monero_utils::cn_tx_to_tx(cn_tx_in, true));
-        block->m_txs.push_back(tx);
-        tx->m_block = block;
-        tx->m_hash = epee::string_tools::pod_to_hex(txid);
-        tx->m_is_confirmed = true;
-        tx->m_is_locked = true;
-        std::shared_ptr<monero_output_wallet> output = std::make_shared<monero_output_wallet>();
-        tx->m_inputs.push_back(output);
-        output->m_tx = tx;
-        output->m_amount = amount;
-        output->m_account_index = subaddr_index.major;
-        output->m_subaddress_index = subaddr_index.minor;
+    // construct block
+    std::shared_ptr<monero_block> block = factory.make<monero_block>();
+    block->m_height = row.m_height;
+    block->m_timestamp = row.m_timestamp;
 
-        // notify listeners of output
-        for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
-          listener->on_output_spent(*output);
-        }
+    // construct tx
+    std::shared_ptr<monero_tx_wallet> tx = factory.make<monero_tx_wallet>();
+    tx->m_block = block;
+    block->m_txs.push_back(tx);
+    tx->m_hash = epee::string_tools::pod_to_hex(row.m_tx_hash);
+    tx->m_is_incoming = true;
+    tx->m_payment_id = epee::string_tools::pod_to_hex(row.m_payment_id);
+    if (tx->m_payment_id->substr(16).find_first_not_of('0') == std::string::npos) tx->m_payment_id = tx->m_payment_id->substr(0, 16);  // TODO monero-project: this should be part of core wallet
+    if (tx->m_payment_id == monero_tx::DEFAULT_PAYMENT_ID) tx->m_payment_id = boost::none;  // clear default payment id
+    tx->m_unlock_height = row.m_unlock_time;
+    tx->m_is_locked = !m_w2.is_transfer_unlocked(row.m_unlock_time, row.m_height);
+    tx->m_fee = row.m_fee;
+    tx->m_note = m_w2.get_tx_note(row.m_tx_hash);
+    if (tx->m_note->empty()) tx->m_note = boost::none; // clear empty note
+    tx->m_is_miner_tx = row.m_coinbase ? true : false;
+    tx->m_is_confirmed = true;
+    tx->m_is_failed = false;
+    tx->m_is_relayed = true;
+    tx->m_in_tx_pool = false;
+    tx->m_relay = true;
+    tx->m_is_double_spend_seen = false;
+    set_num_confirmations(tx, height);
+
+    // construct transfer
+    std::shared_ptr<monero_incoming_transfer> incoming_transfer = factory.make<monero_incoming_transfer>();
+    incoming_transfer->m_tx = tx;
+    tx->m_incoming_transfers.push_back(incoming_transfer);
+    incoming_transfer->m_amount = row.m_amount;
+    incoming_transfer->m_account_index = row.m_subaddr_index.major;
+    incoming_transfer->m_subaddress_index = row.m_subaddr_index.minor;
+    incoming_transfer->m_address = m_w2.get_subaddress_as_str(row.m_subaddr_index);
+    set_num_suggested_confirmations(incoming_transfer, height, m_w2.get_last_block_reward(), row.m_unlock_time);
+
+    // return pointer to new tx
+    return tx;
+  }
+
+  std::shared_ptr<monero_tx_wallet> build_tx_with_outgoing_transfer(tools::wallet2& m_w2, uint64_t height, const monero_tx_index::outgoing_row& row, const model_factory& factory = model_factory()) {
+
+    // construct block
+    std::shared_ptr<monero_block> block = factory.make<monero_block>();
+    block->m_height = row.m_height;
+    block->m_timestamp = row.m_timestamp;
+
+    // construct tx
+    std::shared_ptr<monero_tx_wallet> tx = factory.make<monero_tx_wallet>();
+    tx->m_block = block;
+    block->m_txs.push_back(tx);
+    tx->m_hash = epee::string_tools::pod_to_hex(row.m_tx_hash);
+    tx->m_is_outgoing = true;
+    tx->m_payment_id = epee::string_tools::pod_to_hex(row.m_payment_id);
+    if (tx->m_payment_id->substr(16).find_first_not_of('0') == std::string::npos) tx->m_payment_id = tx->m_payment_id->substr(0, 16);  // TODO monero-project: this should be part of core wallet
+    if (tx->m_payment_id == monero_tx::DEFAULT_PAYMENT_ID) tx->m_payment_id = boost::none;  // clear default payment id
+    tx->m_unlock_height = row.m_unlock_time;
+    tx->m_is_locked = !m_w2.is_transfer_unlocked(row.m_unlock_time, row.m_height);
+    tx->m_fee = row.m_amount_in - row.m_amount_out;
+    tx->m_note = m_w2.get_tx_note(row.m_tx_hash);
+    if (tx->m_note->empty()) tx->m_note = boost::none; // clear empty note
+    tx->m_is_miner_tx = false;
+    tx->m_is_confirmed = true;
+    tx->m_is_failed = false;
+    tx->m_is_relayed = true;
+    tx->m_in_tx_pool = false;
+    tx->m_relay = true;
+    tx->m_is_double_spend_seen = false;
+    set_num_confirmations(tx, height);
+
+    // construct transfer
+    std::shared_ptr<monero_outgoing_transfer> outgoing_transfer = factory.make<monero_outgoing_transfer>();
+    outgoing_transfer->m_tx = tx;
+    tx->m_outgoing_transfer = outgoing_transfer;
+    uint64_t change = row.m_change == (uint64_t)-1 ? 0 : row.m_change; // change may not be known
+    outgoing_transfer->m_amount = row.m_amount_in - change - *tx->m_fee;
+    outgoing_transfer->m_account_index = row.m_account_index;
+    std::vector<uint32_t> subaddress_indices;
+    std::vector<std::string> addresses;
+    for (uint32_t i: row.m_subaddress_indices) {
+      subaddress_indices.push_back(i);
+      addresses.push_back(m_w2.get_subaddress_as_str({row.m_account_index, i}));
+    }
+    outgoing_transfer->m_subaddress_indices = subaddress_indices;
+    outgoing_transfer->m_addresses = addresses;
 
-        // watch for unlock
-        m_prev_locked_tx_hashes.insert(tx->m_hash.get());
+    // initialize destinations
+    for (const auto &d: row.m_dests) {
+      std::shared_ptr<monero_destination> destination = factory.make<monero_destination>();
+      destination->m_amount = d.amount;
+      destination->m_address = d.address(m_w2.nettype(), row.m_payment_id);
+      outgoing_transfer->m_destinations.push_back(destination);
+    }
+
+    // replace transfer amount with destination sum
+    // TODO monero-project: confirmed tx from/to same account has amount 0 but cached transfer destinations
+    if (*outgoing_transfer->m_amount == 0 && !outgoing_transfer->m_destinations.empty()) {
+      uint64_t amount = 0;
+      for (const std::shared_ptr<monero_destination>& destination : outgoing_transfer->m_destinations) amount += *destination->m_amount;
+      outgoing_transfer->m_amount = amount;
+    }
+
+    // return pointer to new tx
+    return tx;
+  }
+
+  // ----------------------------- BALANCE TRACKER ----------------------------
+
+  /**
+   * Running balances and output statistics per subaddress maintained from
+   * wallet2 callbacks so balance and subaddress queries do not walk every
+   * transfer.
+   *
+   * Received outputs are added as wallet2 processes them and move to the
+   * unlocked balance once their unlock height is reached.  Spends, relays,
+   * frozen outputs, and outgoing txs leaving the pool adjust the balances of
+   * the transfers and txs they touch, found by key image and tx hash.  Bulk
+   * changes (rescans, imports, reorgs) invalidate the balances, which are then
+   * rebuilt in one pass over wallet2's transfers on next use.
+   */
+  struct monero_balance_tracker {
+
+    /**
+     * Balance and unlocked balance of a subaddress, account, or wallet.
+     */
+    struct balances {
+      uint64_t m_balance = 0;
+      uint64_t m_unlocked_balance = 0;
+    };
+
+    /**
+     * Statistics of the outputs received by a subaddress.
+     */
+    struct subaddress_stats {
+      uint64_t m_num_outputs = 0;                 // number of outputs received
+      uint64_t m_num_unspent_outputs = 0;         // number of outputs not spent, including frozen outputs
+      boost::optional<uint64_t> m_first_height;   // height of the first output received
+      boost::optional<uint64_t> m_last_height;    // height of the last output received
+    };
+
+    monero_balance_tracker(tools::wallet2& wallet2) : m_w2(wallet2), m_rebuild(true), m_check_enabled(false) { }
+
+    /**
+     * Rebuild balances from wallet2 on next use.
+     */
+    void invalidate() {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_rebuild = true;
+    }
+
+    /**
+     * Verify balances against wallet2's full computation on each use and
+     * throw if they differ (for tests).
+     */
+    void set_check_enabled(bool check_enabled) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_check_enabled = check_enabled;
+    }
+
+    /**
+     * Add the outputs which wallet2 received in a block.
+     */
+    void on_money_received(uint64_t height) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (m_rebuild) return;
+
+      // rebuild if block re-processed after reorg or wallet2 removed transfers
+      size_t num_transfers = m_w2.get_num_transfer_details();
+      if ((m_last_block_height != boost::none && height <= *m_last_block_height) || num_transfers < m_transfers.size()) {
+        m_rebuild = true;
+        return;
+      }
+      while (m_transfers.size() < num_transfers) add_transfer(m_transfers.size());
+    }
+
+    /**
+     * Update the transfers spent by a tx which wallet2 processed in a block.
+     */
+    void on_money_spent(const cryptonote::transaction& cn_tx) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (m_rebuild) return;
+      update_inputs(cn_tx);
+    }
+
+    /**
+     * Update the transfers spent by relayed txs and count their change.
+     */
+    void on_relay() {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (m_rebuild) return;
+      update_unconfirmed_out();
+    }
+
+    /**
+     * Update a transfer which was frozen or thawed.
+     */
+    void on_frozen_changed(const crypto::key_image& key_image) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (m_rebuild) return;
+      std::unordered_map<crypto::key_image, size_t>::const_iterator iter = m_key_images.find(key_image);
+      if (iter == m_key_images.end() || !is_transfer(iter->second, key_image)) m_rebuild = true;
+      else update_transfer(iter->second);
+    }
+
+    /**
+     * Record that wallet2 processed a block, which may confirm outgoing txs.
+     */
+    void on_new_block(uint64_t height) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (m_last_block_height != boost::none && height <= *m_last_block_height) m_rebuild = true; // reorg
+      m_last_block_height = height;
+      if (!m_rebuild && !m_unconfirmed_out.empty()) update_unconfirmed_out();
+    }
+
+    /**
+     * Record that wallet2 finished refreshing, which may change the pool state of outgoing txs.
+     */
+    void on_refresh_end() {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (!m_rebuild && !m_unconfirmed_out.empty()) update_unconfirmed_out();
+    }
+
+    /**
+     * Get the wallet's balances.
+     */
+    balances get_balances() {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      update();
+      if (m_check_enabled) check(m_total, m_w2.balance_all(STRICT), m_w2.unlocked_balance_all(STRICT));
+      return m_total;
+    }
+
+    /**
+     * Get an account's balances.
+     */
+    balances get_balances(uint32_t account_idx) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      update();
+      std::unordered_map<uint32_t, balances>::const_iterator iter = m_account_balances.find(account_idx);
+      balances account_balances = iter == m_account_balances.end() ? balances() : iter->second;
+      if (m_check_enabled) check(account_balances, m_w2.balance(account_idx, STRICT), m_w2.unlocked_balance(account_idx, STRICT));
+      return account_balances;
+    }
+
+    /**
+     * Get a subaddress's balances.
+     */
+    balances get_balances(uint32_t account_idx, uint32_t subaddress_idx) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      update();
+      std::unordered_map<uint64_t, balances>::const_iterator iter = m_subaddress_balances.find(to_key({account_idx, subaddress_idx}));
+      balances subaddress_balances = iter == m_subaddress_balances.end() ? balances() : iter->second;
+      if (m_check_enabled) {
+        std::map<uint32_t, uint64_t> balance_per_subaddress = m_w2.balance_per_subaddress(account_idx, STRICT);
+        std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> unlocked_balance_per_subaddress = m_w2.unlocked_balance_per_subaddress(account_idx, STRICT);
+        auto balance_iter = balance_per_subaddress.find(subaddress_idx);
+        auto unlocked_balance_iter = unlocked_balance_per_subaddress.find(subaddress_idx);
+        check(subaddress_balances, balance_iter == balance_per_subaddress.end() ? 0 : balance_iter->second, unlocked_balance_iter == unlocked_balance_per_subaddress.end() ? 0 : unlocked_balance_iter->second.first);
+      }
+      return subaddress_balances;
+    }
+
+    /**
+     * Get the number of blocks until all locked outputs of each subaddress in
+     * an account unlock per wallet2::unlocked_balance_per_subaddress(), read
+     * from the locked transfers pending unlock.
+     */
+    std::map<uint32_t, uint64_t> get_blocks_to_unlock(uint32_t account_idx) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      update();
+      uint64_t height = m_w2.get_blockchain_current_height();
+      std::map<uint32_t, uint64_t> blocks_to_unlock;
+      for (const unlock_entry& entry : m_unlock_heap) {
+        const counted_transfer& counted = m_transfers[entry.m_idx];
+        if (!counted.m_is_available || counted.m_is_unlocked) continue; // stale entry
+        const tools::wallet2::transfer_details& td = m_w2.get_transfer_details(entry.m_idx);
+        if (td.m_subaddr_index.major != account_idx) continue;
+        uint64_t unlock_height = td.m_block_height + std::max<uint64_t>(CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE, CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_BLOCKS);
+        if (td.m_tx.unlock_time < CRYPTONOTE_MAX_BLOCK_NUMBER && td.m_tx.unlock_time > unlock_height) unlock_height = td.m_tx.unlock_time;
+        if (unlock_height > height) blocks_to_unlock[td.m_subaddr_index.minor] = std::max(blocks_to_unlock[td.m_subaddr_index.minor], unlock_height - height);
+      }
+      if (m_check_enabled) {
+        for (const auto& unlocked_balance : m_w2.unlocked_balance_per_subaddress(account_idx, STRICT)) {
+          std::map<uint32_t, uint64_t>::const_iterator iter = blocks_to_unlock.find(unlocked_balance.first);
+          uint64_t tracked_blocks = iter == blocks_to_unlock.end() ? 0 : iter->second;
+          if (tracked_blocks != unlocked_balance.second.second.first) throw std::runtime_error("Tracked blocks to unlock (" + std::to_string(tracked_blocks) + ") do not match wallet2 blocks to unlock (" + std::to_string(unlocked_balance.second.second.first) + ")");
+        }
+      }
+      return blocks_to_unlock;
+    }
+
+    /**
+     * Get a subaddress's output statistics.
+     */
+    subaddress_stats get_subaddress_stats(uint32_t account_idx, uint32_t subaddress_idx) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (m_rebuild) rebuild();
+      std::unordered_map<uint64_t, subaddress_stats>::const_iterator iter = m_subaddress_stats.find(to_key({account_idx, subaddress_idx}));
+      subaddress_stats stats = iter == m_subaddress_stats.end() ? subaddress_stats() : iter->second;
+      if (m_check_enabled) {
+        cryptonote::subaddress_index index = {account_idx, subaddress_idx};
+        uint64_t num_outputs = 0;
+        uint64_t num_unspent_outputs = 0;
+        for (size_t idx = 0; idx < m_w2.get_num_transfer_details(); idx++) {
+          const tools::wallet2::transfer_details& td = m_w2.get_transfer_details(idx);
+          if (td.m_subaddr_index != index) continue;
+          num_outputs++;
+          if (!td.m_spent) num_unspent_outputs++;
+        }
+        if (stats.m_num_outputs != num_outputs || stats.m_num_unspent_outputs != num_unspent_outputs) {
+          throw std::runtime_error("Tracked output counts (" + std::to_string(stats.m_num_outputs) + ", " + std::to_string(stats.m_num_unspent_outputs) + ") do not match wallet2 output counts (" + std::to_string(num_outputs) + ", " + std::to_string(num_unspent_outputs) + ")");
+        }
+      }
+      return stats;
+    }
+
+  private:
+
+    // state of a wallet2 transfer as counted in the balances
+    struct counted_transfer {
+      bool m_is_spent = false;                      // excluded from unspent output counts
+      bool m_is_available = false;                  // included in balances (not spent or frozen)
+      bool m_is_unlocked = false;                   // included in unlocked balances
+    };
+
+    // change of an unconfirmed outgoing tx as counted in the balances
+    struct counted_change {
+      cryptonote::subaddress_index m_subaddr_index; // primary subaddress of the spending account, which receives all change
+      uint64_t m_amount;
+      bool m_is_counted;                            // false once the tx failed
+    };
+
+    // locked transfer pending unlock
+    struct unlock_entry {
+      uint64_t m_unlock_height;                     // height at which the transfer is expected to unlock
+      size_t m_idx;                                 // index of the transfer in wallet2
+      bool operator>(const unlock_entry& other) const { return m_unlock_height > other.m_unlock_height; }
+    };
+
+    tools::wallet2& m_w2;
+    boost::mutex m_mutex;
+    bool m_rebuild;                                             // rebuild balances from wallet2 on next use
+    bool m_check_enabled;                                       // verify balances against wallet2 on each use
+    boost::optional<uint64_t> m_last_block_height;              // height of the last block processed to detect reorgs
+    balances m_total;                                           // balances of the wallet
+    std::unordered_map<uint32_t, balances> m_account_balances;  // balances per account index
+    std::unordered_map<uint64_t, balances> m_subaddress_balances; // balances per subaddress index
+    std::unordered_map<uint64_t, subaddress_stats> m_subaddress_stats; // output statistics per subaddress index
+    std::vector<counted_transfer> m_transfers;                  // counted state per wallet2 transfer index
+    std::unordered_map<crypto::key_image, size_t> m_key_images; // wallet2 transfer indices by known key image
+    std::unordered_map<crypto::hash, counted_change> m_unconfirmed_out; // counted change per unconfirmed outgoing tx hash
+    std::vector<unlock_entry> m_unlock_heap;                    // min-heap of locked transfers by unlock height
+
+    static uint64_t to_key(const cryptonote::subaddress_index& subaddr_index) {
+      return (static_cast<uint64_t>(subaddr_index.major) << 32) | subaddr_index.minor;
+    }
+
+    void add(const cryptonote::subaddress_index& subaddr_index, uint64_t amount, bool is_unlocked) {
+      balances* balances_list[] = { &m_total, &m_account_balances[subaddr_index.major], &m_subaddress_balances[to_key(subaddr_index)] };
+      for (balances* scope_balances : balances_list) {
+        if (is_unlocked) scope_balances->m_unlocked_balance += amount;
+        else scope_balances->m_balance += amount;
+      }
+    }
+
+    void subtract(const cryptonote::subaddress_index& subaddr_index, uint64_t amount, bool is_unlocked) {
+      balances* balances_list[] = { &m_total, &m_account_balances[subaddr_index.major], &m_subaddress_balances[to_key(subaddr_index)] };
+      for (balances* scope_balances : balances_list) {
+        if (is_unlocked) scope_balances->m_unlocked_balance -= amount;
+        else scope_balances->m_balance -= amount;
+      }
+    }
+
+    void schedule_unlock(size_t idx, const tools::wallet2::transfer_details& td) {
+      unlock_entry entry;
+      entry.m_unlock_height = td.m_block_height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE;
+      if (td.m_tx.unlock_time < CRYPTONOTE_MAX_BLOCK_NUMBER) entry.m_unlock_height = std::max(entry.m_unlock_height, td.m_tx.unlock_time);
+      entry.m_idx = idx;
+      m_unlock_heap.push_back(entry);
+      std::push_heap(m_unlock_heap.begin(), m_unlock_heap.end(), std::greater<unlock_entry>());
+    }
+
+    // count a transfer which wallet2 appended; caller must hold m_mutex
+    void add_transfer(size_t idx) {
+      const tools::wallet2::transfer_details& td = m_w2.get_transfer_details(idx);
+      m_transfers.push_back(counted_transfer());
+      m_transfers.back().m_is_spent = true; // counted unspent by update_transfer()
+      if (td.m_key_image_known) m_key_images[td.m_key_image] = idx;
+      subaddress_stats& stats = m_subaddress_stats[to_key(td.m_subaddr_index)];
+      stats.m_num_outputs++;
+      if (stats.m_first_height == boost::none || td.m_block_height < *stats.m_first_height) stats.m_first_height = td.m_block_height;
+      if (stats.m_last_height == boost::none || td.m_block_height > *stats.m_last_height) stats.m_last_height = td.m_block_height;
+      update_transfer(idx);
+    }
+
+    // apply the difference between a transfer's state in wallet2 and its counted state; caller must hold m_mutex
+    void update_transfer(size_t idx) {
+      const tools::wallet2::transfer_details& td = m_w2.get_transfer_details(idx);
+      counted_transfer& counted = m_transfers[idx];
+      if (td.m_spent != counted.m_is_spent) {
+        subaddress_stats& stats = m_subaddress_stats[to_key(td.m_subaddr_index)];
+        if (td.m_spent) stats.m_num_unspent_outputs--;
+        else stats.m_num_unspent_outputs++;
+        counted.m_is_spent = td.m_spent;
+      }
+      bool is_available = !td.m_spent && !td.m_frozen;
+      if (is_available == counted.m_is_available) return;
+      counted.m_is_available = is_available;
+      if (is_available) {
+        add(td.m_subaddr_index, td.amount(), false);
+        counted.m_is_unlocked = m_w2.is_transfer_unlocked(td);
+        if (counted.m_is_unlocked) add(td.m_subaddr_index, td.amount(), true);
+        else schedule_unlock(idx, td);
+      } else {
+        subtract(td.m_subaddr_index, td.amount(), false);
+        if (counted.m_is_unlocked) subtract(td.m_subaddr_index, td.amount(), true);
+        counted.m_is_unlocked = false; // stale unlock entries are skipped
+      }
+    }
+
+    // update the transfers whose key images a tx spends; caller must hold m_mutex
+    void update_inputs(const cryptonote::transaction& cn_tx) {
+      for (const cryptonote::txin_v& in : cn_tx.vin) {
+        if (in.type() != typeid(cryptonote::txin_to_key)) continue;
+        const crypto::key_image& key_image = boost::get<cryptonote::txin_to_key>(in).k_image;
+        std::unordered_map<crypto::key_image, size_t>::const_iterator iter = m_key_images.find(key_image);
+        if (iter == m_key_images.end()) continue;
+        if (!is_transfer(iter->second, key_image)) {
+          m_rebuild = true; // wallet2 removed or replaced transfers (e.g. reorg)
+          return;
+        }
+        update_transfer(iter->second);
+      }
+    }
+
+    // check that a counted transfer index still holds a key image in wallet2
+    bool is_transfer(size_t idx, const crypto::key_image& key_image) const {
+      if (idx >= m_transfers.size() || idx >= m_w2.get_num_transfer_details()) return false;
+      const tools::wallet2::transfer_details& td = m_w2.get_transfer_details(idx);
+      return td.m_key_image_known && td.m_key_image == key_image;
+    }
+
+    // count change and spent inputs of new unconfirmed outgoing txs and uncount txs which confirmed or failed; caller must hold m_mutex
+    void update_unconfirmed_out() {
+      std::list<std::pair<crypto::hash, tools::wallet2::unconfirmed_transfer_details>> upayments;
+      m_w2.get_unconfirmed_payments_out(upayments);
+      std::unordered_set<crypto::hash> tx_hashes;
+      for (const auto& upayment : upayments) {
+        tx_hashes.insert(upayment.first);
+        bool is_counted = upayment.second.m_state != tools::wallet2::unconfirmed_transfer_details::failed;
+        std::unordered_map<crypto::hash, counted_change>::iterator iter = m_unconfirmed_out.find(upayment.first);
+        if (iter == m_unconfirmed_out.end()) {
+          counted_change change;
+          change.m_subaddr_index = {upayment.second.m_subaddr_account, 0};
+          change.m_amount = upayment.second.m_change;
+          change.m_is_counted = is_counted;
+          if (is_counted) add(change.m_subaddr_index, change.m_amount, false);
+          m_unconfirmed_out[upayment.first] = change;
+        } else if (iter->second.m_is_counted != is_counted) {
+          if (is_counted) add(iter->second.m_subaddr_index, iter->second.m_amount, false);
+          else subtract(iter->second.m_subaddr_index, iter->second.m_amount, false);
+          iter->second.m_is_counted = is_counted;
+        } else {
+          continue;
+        }
+        update_inputs(upayment.second.m_tx); // spent on relay, unspent on failure
+      }
+
+      // confirmed txs count their change as received outputs
+      for (std::unordered_map<crypto::hash, counted_change>::iterator iter = m_unconfirmed_out.begin(); iter != m_unconfirmed_out.end(); ) {
+        if (tx_hashes.find(iter->first) != tx_hashes.end()) iter++;
+        else {
+          if (iter->second.m_is_counted) subtract(iter->second.m_subaddr_index, iter->second.m_amount, false);
+          iter = m_unconfirmed_out.erase(iter);
+        }
+      }
+    }
+
+    // rebuild if invalidated and unlock transfers which reached their unlock height; caller must hold m_mutex
+    void update() {
+      if (m_rebuild) rebuild();
+      uint64_t height = m_w2.get_blockchain_current_height();
+      std::vector<unlock_entry> relocked_entries;
+      while (!m_unlock_heap.empty() && m_unlock_heap.front().m_unlock_height <= height) {
+        std::pop_heap(m_unlock_heap.begin(), m_unlock_heap.end(), std::greater<unlock_entry>());
+        unlock_entry& entry = m_unlock_heap.back();
+        counted_transfer& counted = m_transfers[entry.m_idx];
+        if (counted.m_is_available && !counted.m_is_unlocked) {
+          const tools::wallet2::transfer_details& td = m_w2.get_transfer_details(entry.m_idx);
+          if (m_w2.is_transfer_unlocked(td)) {
+            add(td.m_subaddr_index, td.amount(), true);
+            counted.m_is_unlocked = true;
+          } else {
+            entry.m_unlock_height = height + 1; // unlocks by timestamp
+            relocked_entries.push_back(entry);
+          }
+        }
+        m_unlock_heap.pop_back();
+      }
+      for (const unlock_entry& entry : relocked_entries) {
+        m_unlock_heap.push_back(entry);
+        std::push_heap(m_unlock_heap.begin(), m_unlock_heap.end(), std::greater<unlock_entry>());
+      }
+    }
+
+    // rebuild balances in one pass over wallet2's transfers; caller must hold m_mutex
+    void rebuild() {
+      m_total = balances();
+      m_account_balances.clear();
+      m_subaddress_balances.clear();
+      m_subaddress_stats.clear();
+      m_transfers.clear();
+      m_key_images.clear();
+      m_unconfirmed_out.clear();
+      m_unlock_heap.clear();
+
+      // group outputs by subaddress and count unspent outputs per wallet2::balance_per_subaddress() and unlocked_balance_per_subaddress()
+      size_t num_transfers = m_w2.get_num_transfer_details();
+      m_transfers.reserve(num_transfers);
+      for (size_t idx = 0; idx < num_transfers; idx++) add_transfer(idx);
+
+      // count change of unconfirmed outgoing txs to the account's primary subaddress
+      update_unconfirmed_out();
+      m_rebuild = false;
+    }
+
+    static void check(const balances& tracked, uint64_t balance, uint64_t unlocked_balance) {
+      if (tracked.m_balance != balance || tracked.m_unlocked_balance != unlocked_balance) {
+        throw std::runtime_error("Tracked balances (" + std::to_string(tracked.m_balance) + ", " + std::to_string(tracked.m_unlocked_balance) + ") do not match wallet2 balances (" + std::to_string(balance) + ", " + std::to_string(unlocked_balance) + ")");
+      }
+    }
+  };
+
+  // ------------------------------ DAEMON POLLER -----------------------------
+
+  /**
+   * Get the process-wide executor of daemon polls and status refreshes.
+   *
+   * Polls are short requests which must run on time, so they do not share
+   * the scheduler's executor with wallet syncs, which can hold its workers
+   * for a long time.
+   */
+  static monero_executor& get_poller_executor() {
+    static monero_executor* executor = new monero_executor(DAEMON_POLLER_NUM_WORKERS); // never destroyed, so the scheduler can submit to it until exit
+    return *executor;
+  }
+
+  /**
+   * Caches and polls the status of a daemon connection shared by wallets.
+   *
+   * One poller is shared by all wallets with the same daemon connection. It
+   * caches the daemon's get_info response for a short time, so status queries
+   * from many wallets cost one request, and refreshes it in the background
+   * before it expires.
+   *
+   * Wallets syncing adaptively subscribe to be woken when the daemon's chain
+   * or pool changes, so idle wallets make no requests while the daemon is
+   * unchanged. Polls identify the daemon's state by its height, top block hash,
+   * and pool size, and back off exponentially up to DAEMON_POLL_MAX_BACKOFF_MS
+   * after errors.
+   */
+  class monero_daemon_poller : public std::enable_shared_from_this<monero_daemon_poller> {
+  public:
+
+    /**
+     * Daemon status from one get_info request.
+     */
+    struct daemon_info {
+      bool m_is_connected = false;
+      uint64_t m_height = 0;
+      uint64_t m_target_height = 0;
+      uint64_t m_tx_pool_size = 0;
+      std::string m_top_block_hash;
+      std::chrono::steady_clock::time_point m_fetch_time;
+
+      bool is_synced() const { return m_height >= m_target_height && m_height > 1; }
+    };
+
+    /**
+     * Get the shared poller of a daemon connection.
+     *
+     * A new poller requests through a client from the given factory, i.e. the
+     * first wallet's, connected with the same settings as that wallet.
+     *
+     * @param http_client_factory creates the client of a new poller
+     * @param uri is the daemon's uri
+     * @param login is the daemon's login
+     * @param ssl_support is the ssl support of the connection
+     * @param proxy is the proxy of the connection, empty if none
+     */
+    static std::shared_ptr<monero_daemon_poller> get(epee::net_utils::http::http_client_factory& http_client_factory, const std::string& uri, const boost::optional<epee::net_utils::http::login>& login, epee::net_utils::ssl_support_t ssl_support, const std::string& proxy) {
+      static boost::mutex pollers_mutex;
+      static std::map<std::string, std::weak_ptr<monero_daemon_poller>> pollers; // pollers by connection, with hashed passwords
+      std::string key = uri + "\n" + std::to_string(static_cast<int>(ssl_support)) + "\n" + proxy;
+      if (login) {
+        crypto::hash password_hash;
+        crypto::cn_fast_hash(login->password.data(), login->password.size(), password_hash);
+        key += "\n" + login->username + "\n" + epee::string_tools::pod_to_hex(password_hash);
+      }
+      boost::lock_guard<boost::mutex> lock(pollers_mutex);
+      std::shared_ptr<monero_daemon_poller> poller = pollers[key].lock();
+      if (poller == nullptr) {
+        poller = std::shared_ptr<monero_daemon_poller>(new monero_daemon_poller(http_client_factory.create(), uri, login, ssl_support, proxy));
+        pollers[key] = poller;
+      }
+      for (std::map<std::string, std::weak_ptr<monero_daemon_poller>>::iterator iter = pollers.begin(); iter != pollers.end(); ) {
+        if (iter->second.expired()) iter = pollers.erase(iter);
+        else iter++;
+      }
+      return poller;
+    }
+
+    /**
+     * Get the daemon's status, fetching it if the cached status is expired.
+     *
+     * @param ttl_ms is the maximum age of the cached status, which is refreshed in the background after half
+     * @return the daemon's status
+     */
+    daemon_info get_info(uint64_t ttl_ms) {
+      std::chrono::steady_clock::duration age;
+      {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        age = std::chrono::steady_clock::now() - m_info.m_fetch_time;
+        if (m_info.m_fetch_time != std::chrono::steady_clock::time_point() && age < std::chrono::milliseconds(ttl_ms)) {
+          if (age >= std::chrono::milliseconds(ttl_ms / 2) && !m_is_refreshing) {
+            m_is_refreshing = true;
+            std::weak_ptr<monero_daemon_poller> weak_self = shared_from_this();
+            monero_scheduler::get_instance().schedule(0, [weak_self]() {
+              std::shared_ptr<monero_daemon_poller> self = weak_self.lock();
+              if (self) self->fetch_info();
+            }, &get_poller_executor());
+          }
+          return m_info;
+        }
+      }
+      return fetch_info();
+    }
+
+    /**
+     * Wake a subscriber when the daemon changes.
+     *
+     * @param poll_period_ms is the subscriber's maximum period between polls
+     * @param on_change is invoked off the caller's thread when the synchronized daemon changes
+     * @return the subscription id to unsubscribe
+     */
+    uint64_t subscribe(uint64_t poll_period_ms, const std::function<void()>& on_change) {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      uint64_t subscription_id = m_next_subscription_id++;
+      m_subscriptions[subscription_id] = std::make_pair(poll_period_ms, on_change);
+      update_poll_period();
+      if (!m_is_polling) {
+        m_is_polling = true;
+        schedule_poll();
+      }
+      return subscription_id;
+    }
+
+    /**
+     * Stop waking a subscriber, waiting for its wake in progress if any.
+     */
+    void unsubscribe(uint64_t subscription_id) {
+      {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_subscriptions.erase(subscription_id);
+        update_poll_period();
+      }
+      boost::lock_guard<boost::mutex> notify_lock(m_notify_mutex);
+    }
+
+    /**
+     * Get the current period between polls including back off after errors.
+     */
+    uint64_t get_interval_ms() const {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      return m_interval_ms;
+    }
+
+  private:
+    std::unique_ptr<epee::net_utils::http::abstract_http_client> m_http_client;
+    boost::mutex m_http_client_mutex;               // serializes requests so concurrent fetches share one response
+    mutable boost::mutex m_mutex;
+    boost::mutex m_notify_mutex;                    // held while waking subscribers
+    daemon_info m_info;                             // last fetched daemon status
+    bool m_is_refreshing;                           // a background refresh is scheduled
+    std::map<uint64_t, std::pair<uint64_t, std::function<void()>>> m_subscriptions; // subscription id to poll period and wake callback
+    uint64_t m_next_subscription_id;
+    uint64_t m_poll_period_ms;                      // minimum poll period of subscribers
+    uint64_t m_interval_ms;                         // current poll period including back off
+    bool m_is_polling;                              // a poll is scheduled or running
+    boost::optional<daemon_info> m_polled_info;     // daemon status at last successful poll
+
+    monero_daemon_poller(std::unique_ptr<epee::net_utils::http::abstract_http_client> http_client, const std::string& uri, const boost::optional<epee::net_utils::http::login>& login, epee::net_utils::ssl_support_t ssl_support, const std::string& proxy) : m_http_client(std::move(http_client)), m_is_refreshing(false), m_next_subscription_id(0), m_poll_period_ms(0), m_interval_ms(0), m_is_polling(false) {
+      if (!proxy.empty() && !m_http_client->set_proxy(proxy)) throw std::runtime_error("Failed to initialize daemon poller with daemon proxy");
+      if (!m_http_client->set_server(uri, login, ssl_support)) throw std::runtime_error("Failed to initialize daemon poller with daemon connection");
+    }
+
+    daemon_info fetch_info() {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      boost::lock_guard<boost::mutex> http_lock(m_http_client_mutex);
+
+      // share status fetched while waiting
+      {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        if (m_info.m_fetch_time > start) {
+          m_is_refreshing = false;
+          return m_info;
+        }
+      }
+
+      // fetch daemon info
+      cryptonote::COMMAND_RPC_GET_INFO::request req;
+      cryptonote::COMMAND_RPC_GET_INFO::response res;
+      daemon_info info;
+      try { info.m_is_connected = epee::net_utils::invoke_http_json("/get_info", req, res, *m_http_client, std::chrono::milliseconds(DEFAULT_CONNECTION_TIMEOUT_MILLIS)) && res.status == CORE_RPC_STATUS_OK; }
+      catch (...) { info.m_is_connected = false; }
+      if (info.m_is_connected) {
+        info.m_height = res.height;
+        info.m_target_height = res.target_height == 0 ? res.height : res.target_height; // target height is 0 when daemon is synced
+        info.m_tx_pool_size = res.tx_pool_size;
+        info.m_top_block_hash = res.top_block_hash;
+      }
+      info.m_fetch_time = std::chrono::steady_clock::now();
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_info = info;
+      m_is_refreshing = false;
+      return info;
+    }
+
+    // caller must hold m_mutex
+    void update_poll_period() {
+      if (m_subscriptions.empty()) return;
+      uint64_t poll_period_ms = std::numeric_limits<uint64_t>::max();
+      for (const auto& subscription : m_subscriptions) poll_period_ms = std::min(poll_period_ms, subscription.second.first);
+      if (m_interval_ms == m_poll_period_ms || poll_period_ms < m_interval_ms) m_interval_ms = poll_period_ms; // keep back off unless period shortened
+      m_poll_period_ms = poll_period_ms;
+    }
+
+    // caller must hold m_mutex
+    void schedule_poll() {
+      std::weak_ptr<monero_daemon_poller> weak_self = shared_from_this();
+      monero_scheduler::get_instance().schedule(m_interval_ms, [weak_self]() {
+        std::shared_ptr<monero_daemon_poller> self = weak_self.lock();
+        if (self) self->poll();
+      }, &get_poller_executor());
+    }
+
+    void poll() {
+      daemon_info info = fetch_info();
+
+      // update state and collect subscribers to wake
+      std::vector<std::function<void()>> on_changes;
+      {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        if (m_subscriptions.empty()) {
+          m_is_polling = false;
+          return;
+        }
+        if (!info.m_is_connected) m_interval_ms = std::min(std::max(m_interval_ms * 2, m_poll_period_ms), std::max(DAEMON_POLL_MAX_BACKOFF_MS, m_poll_period_ms));
+        else {
+          m_interval_ms = m_poll_period_ms;
+          bool is_changed = m_polled_info == boost::none || info.m_height != m_polled_info->m_height || info.m_top_block_hash != m_polled_info->m_top_block_hash || info.m_tx_pool_size != m_polled_info->m_tx_pool_size || info.is_synced() != m_polled_info->is_synced();
+          if (is_changed && info.is_synced()) {
+            for (const auto& subscription : m_subscriptions) on_changes.push_back(subscription.second.second);
+          }
+          m_polled_info = info;
+        }
+        schedule_poll();
+      }
+
+      // wake subscribers
+      boost::lock_guard<boost::mutex> notify_lock(m_notify_mutex);
+      for (const std::function<void()>& on_change : on_changes) on_change();
+    }
+  };
+
+  /**
+   * Get a daemon connection's cached status unless bypassed or unavailable.
+   */
+  static boost::optional<monero_daemon_poller::daemon_info> get_cached_daemon_info(const std::shared_ptr<monero_daemon_poller>& daemon_poller, bool bypass_cache) {
+    if (bypass_cache || daemon_poller == nullptr) return boost::none;
+    monero_daemon_poller::daemon_info info = daemon_poller->get_info(DAEMON_INFO_TTL_MS);
+    if (!info.m_is_connected) return boost::none; // request directly for error
+    return info;
+  }
+
+  // ------------------------------- STATE LOCK -------------------------------
+
+  // wallets whose state is locked by or on behalf of the current thread, innermost last
+  static thread_local std::vector<const monero_wallet_full*> t_state_lock_wallets;
+
+  /**
+   * Shared or exclusive lock of a wallet's state.
+   *
+   * Queries share the state while sync and other changes hold it exclusively.
+   * The lock is skipped if the current thread already holds it, including
+   * in listener notifications, which run on the notifying thread. Sync yields
+   * its exclusive lock to waiting readers between blocks, while writers wait
+   * for the whole sync on the wallet's writer mutex. Other exclusive locks
+   * publish the wallet's snapshot when released.
+   */
+  class monero_state_lock {
+  public:
+    monero_state_lock(const monero_wallet_full& wallet, bool is_exclusive, bool is_sync = false) : m_wallet(wallet), m_is_exclusive(is_exclusive), m_is_sync(is_sync), m_is_locked(false) {
+      if (std::find(t_state_lock_wallets.begin(), t_state_lock_wallets.end(), &wallet) != t_state_lock_wallets.end()) return;
+      if (is_exclusive) {
+        m_wallet.m_writer_mutex.lock();
+        m_wallet.m_state_mutex.lock();
+      } else {
+        m_wallet.m_num_waiting_readers++;
+        m_wallet.m_state_mutex.lock_shared();
+        m_wallet.m_num_waiting_readers--;
+      }
+      m_is_locked = true;
+      t_state_lock_wallets.push_back(&wallet);
+    }
+
+    ~monero_state_lock() {
+      if (!m_is_locked) return;
+      if (m_is_exclusive && !m_is_sync) {
+        m_wallet.m_state_revision++;
+        try {
+          m_wallet.publish_snapshot();
+        } catch (std::exception& e) {
+          MERROR("Failed to publish wallet snapshot: " << e.what());
+        }
+      }
+      t_state_lock_wallets.pop_back();
+      if (m_is_exclusive) {
+        m_wallet.m_state_mutex.unlock();
+        m_wallet.m_writer_mutex.unlock();
+      }
+      else m_wallet.m_state_mutex.unlock_shared();
+    }
+
+    /**
+     * Temporarily release an exclusive lock to readers waiting for it.
+     *
+     * The writer mutex stays held, so only readers can take the state.
+     */
+    void yield() {
+      if (!m_is_locked || !m_is_exclusive || m_wallet.m_num_waiting_readers == 0) return;
+      m_wallet.m_state_mutex.unlock();
+      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(STATE_LOCK_YIELD_MILLIS);
+      while (m_wallet.m_num_waiting_readers > 0 && std::chrono::steady_clock::now() < deadline) boost::this_thread::yield();
+      m_wallet.m_state_mutex.lock();
+    }
+
+  private:
+    const monero_wallet_full& m_wallet;
+    const bool m_is_exclusive;
+    const bool m_is_sync;                          // sync publishes its own snapshot
+    bool m_is_locked;                              // false if the current thread already held the lock
+  };
+
+  // ----------------------------- WALLET LISTENER ----------------------------
+
+  /**
+   * Listens to wallet2 notifications in order to notify external wallet listeners.
+   */
+  struct wallet2_listener : public tools::i_wallet2_callback {
+
+  public:
+
+    /**
+     * Constructs the listener.
+     *
+     * @param wallet provides context to notify external listeners
+     * @param wallet2 provides source notifications which this listener propagates to external listeners
+     */
+    wallet2_listener(monero_wallet_full& wallet, tools::wallet2& wallet2) : m_wallet(wallet), m_w2(wallet2) {
+      this->m_sync_start_height = boost::none;
+      this->m_sync_end_height = boost::none;
+      m_prev_balance = wallet.get_balance();
+      m_prev_unlocked_balance = wallet.get_unlocked_balance();
+      m_w2.callback(this);
+    }
+
+    ~wallet2_listener() {
+      MTRACE("~wallet2_listener()");
+      m_w2.callback(nullptr);
+      m_notification_strand.wait();
+    }
+
+    void run_notification(const std::function<void()>& notification) {
+      uint64_t queue_depth = m_notification_strand.get_num_queued() + 1;
+      uint64_t max_queue_depth = m_max_queue_depth;
+      while (queue_depth > max_queue_depth && !m_max_queue_depth.compare_exchange_weak(max_queue_depth, queue_depth));
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      try {
+        m_notification_strand.run(notification); // runs on the notifying thread, which keeps its state locks
+      } catch (...) {
+        m_notify_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        throw;
+      }
+      m_notify_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * Get the number of notifications queued for listeners.
+     */
+    uint64_t get_notification_queue_depth() {
+      return m_notification_strand.get_num_queued();
+    }
+
+    /**
+     * Get the maximum number of notifications queued for listeners since the last reset.
+     */
+    uint64_t reset_max_notification_queue_depth() {
+      return m_max_queue_depth.exchange(0);
+    }
+
+    uint64_t get_num_txs_scanned() const { return m_num_txs_scanned; }  // total number of txs in processed blocks
+    uint64_t get_notify_us() const { return m_notify_us; }              // total time notifying listeners
+
+    void update_listening() {
+
+      // if starting to listen or first synced, schedule notifications of locked outputs
+      bool is_listening = !m_wallet.get_listeners().empty();
+      bool is_synced = m_wallet.is_synced();
+      if (is_listening && (!m_is_listening || (is_synced && !m_is_synced))) schedule_locked_outputs();
+      m_is_listening = is_listening;
+      m_is_synced = is_synced;
+
+      // callback stays registered to maintain the tx index
+      if (m_w2.callback() == nullptr) m_w2.callback(this);
+    }
+
+    void on_sync_start(uint64_t start_height) {
+      std::shared_ptr<monero_sync_handle> sync_handle = m_wallet.get_sync_handle();
+      if (sync_handle != nullptr) sync_handle->on_start(start_height, m_wallet.get_daemon_height(), [this]() { m_w2.stop(); });
+      run_notification([this, start_height]() {
+        if (m_sync_start_height != boost::none || m_sync_end_height != boost::none) throw std::runtime_error("Sync start or end height should not already be allocated, is previous sync in progress?");
+        m_sync_start_height = start_height;
+        m_sync_end_height = m_wallet.get_daemon_height();
+        m_last_progress_height = boost::none;
+        m_unreported_progress_height = boost::none;
+      });
+      m_last_flush_time = std::chrono::steady_clock::now();
+    }
+
+    void on_sync_end() {
+      m_wallet.m_balance_tracker->on_refresh_end();
+      flush_notifications();
+      run_notification([this]() {
+        if (m_unreported_progress_height != boost::none) notify_sync_progress(*m_unreported_progress_height); // always report last block
+        check_for_changed_balances();
+        notify_unlocked_outputs();
+        m_sync_start_height = boost::none;
+        m_sync_end_height = boost::none;
+      });
+    }
+
+    void on_sync_timings(const monero_sync_timings& timings) {
+      if (m_wallet.get_listeners().empty()) return;
+      run_notification([this, timings]() {
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) listener->on_sync_timings(timings);
+      });
+    }
+
+    /**
+     * Get the lowest height of blocks processed since the last reset.
+     */
+    uint64_t reset_min_block_height() {
+      uint64_t min_block_height = m_min_block_height;
+      m_min_block_height = std::numeric_limits<uint64_t>::max();
+      return min_block_height;
+    }
+
+    void on_new_block(uint64_t height, const cryptonote::block& cn_block) override {
+      m_num_txs_scanned += cn_block.tx_hashes.size() + 1; // include miner tx
+      m_min_block_height = std::min(m_min_block_height, height);
+      m_wallet.m_tx_index->on_new_block(height, cn_block);
+      m_wallet.m_balance_tracker->on_new_block(height);
+      if (m_wallet.m_sync_state_lock != nullptr) m_wallet.m_sync_state_lock->yield(); // let queries read between blocks
+      std::shared_ptr<monero_sync_handle> sync_handle = m_wallet.get_sync_handle();
+      if (sync_handle != nullptr) {
+        sync_handle->on_progress(height + 1);
+        if (sync_handle->is_cancelled()) m_w2.stop(); // wallet2 resets its stop flag when refresh starts
+      }
+      if (m_wallet.get_listeners().empty()) return;
+
+      // unschedule outputs of blocks replaced by reorg
+      check_for_reorg(height, true);
+
+      // ignore notifications before sync start height, irrelevant to clients
+      if (m_sync_start_height == boost::none || height < *m_sync_start_height) {
+        flush_notifications();
+        return;
+      }
+
+      // add block to batch, which holds consecutive blocks
+      if (m_pending_num_blocks > 0 && height != m_pending_start_height + m_pending_num_blocks) flush_notifications(); // reorg
+      if (m_pending_num_blocks == 0) m_pending_start_height = height;
+      m_pending_num_blocks++;
+
+      // notify batch when full or due
+      if (m_pending_num_blocks >= NOTIFICATION_BATCH_NUM_BLOCKS || std::chrono::steady_clock::now() - m_last_flush_time >= std::chrono::milliseconds(NOTIFICATION_BATCH_MILLIS)) flush_notifications();
+    }
+
+    void on_unconfirmed_money_received(uint64_t height, const crypto::hash &txid, const cryptonote::transaction& cn_tx, uint64_t amount, const cryptonote::subaddress_index& subaddr_index) override {
+      m_wallet.m_state_revision++;
+      if (m_wallet.get_listeners().empty()) return;
+      add_output_event(txid, cn_tx, boost::none, boost::none, amount, subaddr_index, false, false);
+    }
+
+    void on_money_received(uint64_t height, const crypto::hash &txid, const cryptonote::transaction& cn_tx, uint64_t amount, const cryptonote::subaddress_index& subaddr_index, bool is_change, uint64_t unlock_height) override {
+      m_wallet.m_tx_index->on_money_event(height);
+      m_wallet.m_balance_tracker->on_money_received(height);
+      m_wallet.m_state_revision++;
+      if (m_wallet.get_listeners().empty()) return;
+      add_output_event(txid, cn_tx, height, unlock_height, amount, subaddr_index, false, is_change);
+    }
+
+    void on_money_spent(uint64_t height, const crypto::hash &txid, const cryptonote::transaction& cn_tx_in, uint64_t amount, const cryptonote::transaction& cn_tx_out, const cryptonote::subaddress_index& subaddr_index) override {
+      m_wallet.m_tx_index->on_money_event(height);
+      m_wallet.m_balance_tracker->on_money_spent(cn_tx_in);
+      m_wallet.m_state_revision++;
+      if (m_wallet.get_listeners().empty()) return;
+      if (&cn_tx_in != &cn_tx_out) throw std::runtime_error("on_money_spent() in tx is different than out tx");
+      add_output_event(txid, cn_tx_in, height, cn_tx_in.unlock_time, amount, subaddr_index, true, false);
+    }
+
+    void on_spend_tx_hashes(const std::vector<std::string>& tx_hashes) {
+      std::vector<crypto::hash> relayed_hashes;
+      for (const std::string& tx_hash : tx_hashes) {
+        crypto::hash relayed_hash;
+        if (epee::string_tools::hex_to_pod(tx_hash, relayed_hash)) relayed_hashes.push_back(relayed_hash);
+      }
+      m_wallet.m_tx_index->on_relay(relayed_hashes);
+      m_wallet.m_balance_tracker->on_relay();
+      m_wallet.m_state_revision++;
+      if (m_wallet.get_listeners().empty()) return;
+      monero_tx_query tx_query;
+      tx_query.m_hashes = tx_hashes;
+      tx_query.m_include_outputs = true;
+      tx_query.m_is_locked = true;
+      std::vector<std::string> missing_tx_hashes;
+      on_spend_txs(m_wallet.get_txs(tx_query, missing_tx_hashes));
+    }
+
+    void on_spend_txs(const std::vector<std::shared_ptr<monero_tx_wallet>>& txs) {
+      std::vector<crypto::hash> relayed_hashes;
+      for (const std::shared_ptr<monero_tx_wallet>& tx : txs) {
+        crypto::hash relayed_hash;
+        if (tx->m_hash != boost::none && epee::string_tools::hex_to_pod(*tx->m_hash, relayed_hash)) relayed_hashes.push_back(relayed_hash);
+      }
+      m_wallet.m_tx_index->on_relay(relayed_hashes);
+      m_wallet.m_balance_tracker->on_relay();
+      m_wallet.m_state_revision++;
+      if (m_wallet.get_listeners().empty()) return;
+      run_notification([this, txs]() {
+        check_for_changed_balances();
+        notify_outputs(txs);
+      });
+    }
+
+  private:
+    monero_wallet_full& m_wallet; // wallet to provide context for notifications
+    tools::wallet2& m_w2;         // internal wallet implementation to listen to
+    bool m_is_listening = false;  // whether or not external listeners are registered
+    bool m_is_synced = false;     // whether or not the wallet was synced when listening was last updated
+    boost::optional<uint64_t> m_sync_start_height;
+    boost::optional<uint64_t> m_sync_end_height;
+    uint64_t m_prev_balance;
+    uint64_t m_prev_unlocked_balance;
+    monero_strand m_notification_strand;  // runs notifications for external announcement in order, one at a time, on the notifying thread without an executor
+    std::atomic<uint64_t> m_max_queue_depth{0};   // maximum number of notifications queued since last reset
+    std::atomic<uint64_t> m_notify_us{0};         // total time notifying listeners
+    std::atomic<uint64_t> m_num_txs_scanned{0};   // total number of txs in processed blocks
+    uint64_t m_min_block_height = std::numeric_limits<uint64_t>::max(); // lowest height of blocks processed since last reset
+    boost::optional<uint64_t> m_last_progress_height;         // last height of sync progress notified to listeners
+    boost::optional<uint64_t> m_unreported_progress_height;   // last processed height skipped by progress throttling
+    std::chrono::steady_clock::time_point m_last_progress_time; // time of last sync progress notification
+
+    // output event from wallet2 pending notification in a batch
+    struct output_event {
+      crypto::hash m_txid;
+      std::shared_ptr<const cryptonote::transaction> m_cn_tx;  // shared by events of the same tx
+      boost::optional<uint64_t> m_height;                      // none if unconfirmed
+      boost::optional<uint64_t> m_unlock_height;
+      uint64_t m_amount;
+      cryptonote::subaddress_index m_subaddr_index;
+      bool m_is_spent;
+      bool m_is_change;
+    };
+    std::vector<output_event> m_pending_events;               // output events pending notification
+    uint64_t m_pending_start_height = 0;                      // first block pending notification
+    uint64_t m_pending_num_blocks = 0;                        // number of consecutive blocks pending notification
+    std::chrono::steady_clock::time_point m_last_flush_time;  // time of last batch notification
+
+    void add_output_event(const crypto::hash& txid, const cryptonote::transaction& cn_tx, const boost::optional<uint64_t>& height, const boost::optional<uint64_t>& unlock_height, uint64_t amount, const cryptonote::subaddress_index& subaddr_index, bool is_spent, bool is_change) {
+
+      // schedule notification when confirmed tx unlocks, except for historical outputs of the first sync which are scheduled once it ends
+      if (height != boost::none) {
+        check_for_reorg(*height, false);
+        if (m_wallet.is_synced()) {
+          unlock_entry entry;
+          entry.m_txid = txid;
+          entry.m_height = *height;
+          entry.m_unlock_time = *unlock_height;
+          size_t num_transfers = m_w2.get_num_transfer_details();
+          if (!is_spent && num_transfers > 0) {
+            const tools::wallet2::transfer_details& td = m_w2.get_transfer_details(num_transfers - 1); // wallet2 appends a received output before reporting it
+            if (td.m_txid == txid && td.m_subaddr_index == subaddr_index) entry.m_idx = num_transfers - 1;
+          }
+          if (is_spent || entry.m_idx != boost::none) schedule(entry);
+        }
+      }
+
+      output_event event;
+      event.m_txid = txid;
+      event.m_cn_tx = !m_pending_events.empty() && m_pending_events.back().m_txid == txid ? m_pending_events.back().m_cn_tx : std::make_shared<const cryptonote::transaction>(cn_tx); // wallet2 reports a tx's outputs consecutively
+      event.m_height = height;
+      event.m_unlock_height = unlock_height;
+      event.m_amount = amount;
+      event.m_subaddr_index = subaddr_index;
+      event.m_is_spent = is_spent;
+      event.m_is_change = is_change;
+      m_pending_events.push_back(event);
+
+      // notify immediately unless batching blocks of a sync
+      if (m_sync_start_height == boost::none) flush_notifications();
+    }
+
+    void flush_notifications() {
+      m_last_flush_time = std::chrono::steady_clock::now();
+      if (m_pending_events.empty() && m_pending_num_blocks == 0) return;
+      std::vector<output_event> events;
+      events.swap(m_pending_events);
+      uint64_t start_height = m_pending_start_height;
+      uint64_t num_blocks = m_pending_num_blocks;
+      m_pending_num_blocks = 0;
+      if (m_wallet.get_listeners().empty()) return;
+
+      // queue notification processing off main thread
+      run_notification([this, events, start_height, num_blocks]() {
+        notify_batch(events, start_height, num_blocks);
+      });
+    }
+
+    void notify_sync_progress(uint64_t height) {
+      m_last_progress_height = height;
+      m_last_progress_time = std::chrono::steady_clock::now();
+      m_unreported_progress_height = boost::none;
+      double percent_done = (double) (height - *m_sync_start_height + 1) / (double) (*m_sync_end_height - *m_sync_start_height);
+      std::string message = std::string("Synchronizing");
+      for (monero_wallet_listener* listener : m_wallet.get_listeners()) {
+        listener->on_sync_progress(height, *m_sync_start_height, *m_sync_end_height, percent_done, message);
+      }
+    }
+
+    void notify_batch(const std::vector<output_event>& events, uint64_t start_height, uint64_t num_blocks) {
+
+      // create library txs, one per tx and kind of event
+      std::vector<std::shared_ptr<monero_tx_wallet>> txs;
+      std::vector<std::shared_ptr<monero_output_wallet>> received_outputs;
+      std::vector<std::shared_ptr<monero_output_wallet>> spent_outputs;
+      const output_event* prev_event = nullptr;
+      for (const output_event& event : events) {
+        if (prev_event == nullptr || prev_event->m_txid != event.m_txid || prev_event->m_is_spent != event.m_is_spent || prev_event->m_height != event.m_height) {
+          std::shared_ptr<monero_tx_wallet> tx = std::static_pointer_cast<monero_tx_wallet>(monero_utils::cn_tx_to_tx(*event.m_cn_tx, true));
+          tx->m_hash = epee::string_tools::pod_to_hex(event.m_txid);
+          tx->m_is_confirmed = event.m_height != boost::none;
+          tx->m_is_locked = true;
+          if (event.m_unlock_height != boost::none) tx->m_unlock_height = event.m_unlock_height;
+          if (event.m_height != boost::none) {
+            std::shared_ptr<monero_block> block = std::make_shared<monero_block>();
+            block->m_height = event.m_height;
+            block->m_txs.push_back(tx);
+            tx->m_block = block;
+          }
+          txs.push_back(tx);
+        }
+        std::shared_ptr<monero_tx_wallet>& tx = txs.back();
+        std::shared_ptr<monero_output_wallet> output = std::make_shared<monero_output_wallet>();
+        output->m_tx = tx;
+        output->m_amount = event.m_amount;
+        output->m_account_index = event.m_subaddr_index.major;
+        output->m_subaddress_index = event.m_subaddr_index.minor;
+        if (event.m_is_spent) {
+          tx->m_inputs.push_back(output);
+          spent_outputs.push_back(output);
+        } else {
+          tx->m_outputs.push_back(output);
+          received_outputs.push_back(output);
+        }
+        prev_event = &event;
+      }
+
+      // notify listeners of outputs
+      if (!received_outputs.empty()) {
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) listener->on_outputs_received(received_outputs);
+      }
+      if (!spent_outputs.empty()) {
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) listener->on_outputs_spent(spent_outputs);
+      }
+
+      // notify listeners of new blocks and sync progress
+      if (num_blocks > 0) {
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) listener->on_new_blocks(start_height, num_blocks);
+        uint64_t interval_blocks = m_wallet.m_sync_progress_interval_blocks;
+        std::chrono::milliseconds interval_ms(m_wallet.m_sync_progress_interval_ms.load());
+        for (uint64_t height = start_height; height < start_height + num_blocks; height++) {
+          if (height >= *m_sync_end_height) m_sync_end_height = height + 1; // increase end height if necessary
+
+          // throttle progress to every interval of blocks or time
+          bool is_due = m_last_progress_height == boost::none || height <= *m_last_progress_height || height - *m_last_progress_height >= interval_blocks;
+          if (!is_due && interval_ms.count() > 0) is_due = std::chrono::steady_clock::now() - m_last_progress_time >= interval_ms;
+          if (!is_due) {
+            m_unreported_progress_height = height;
+            continue;
+          }
+          notify_sync_progress(height);
+        }
+      }
 
-        // free memory
-        monero_utils::free(block);
-        output.reset();
-        tx.reset();
-      });
-    }
+      // notify if balances change
+      check_for_changed_balances();
 
-    void on_spend_tx_hashes(const std::vector<std::string>& tx_hashes) {
-      if (m_wallet.get_listeners().empty()) return;
-      monero_tx_query tx_query;
-      tx_query.m_hashes = tx_hashes;
-      tx_query.m_include_outputs = true;
-      tx_query.m_is_locked = true;
-      std::vector<std::string> missing_tx_hashes;
-      on_spend_txs(m_wallet.get_txs(tx_query, missing_tx_hashes));
-    }
+      // notify outputs which unlocked
+      if (num_blocks > 0) notify_unlocked_outputs();
 
-    void on_spend_txs(const std::vector<std::shared_ptr<monero_tx_wallet>>& txs) {
-      if (m_wallet.get_listeners().empty()) return;
-      tools::threadpool::waiter waiter(*m_notification_pool);
-      m_notification_pool->submit(&waiter, [this, txs]() {
-        check_for_changed_balances();
-        for (const std::shared_ptr<monero_tx_wallet>& tx : txs) notify_outputs(tx);
-      });
+      // free memory
+      received_outputs.clear();
+      spent_outputs.clear();
+      free_txs(txs);
     }
 
-  private:
-    monero_wallet_full& m_wallet; // wallet to provide context for notifications
-    tools::wallet2& m_w2;         // internal wallet implementation to listen to
-    boost::optional<uint64_t> m_sync_start_height;
-    boost::optional<uint64_t> m_sync_end_height;
-    uint64_t m_prev_balance;
-    uint64_t m_prev_unlocked_balance;
-    std::set<std::string> m_prev_locked_tx_hashes;
-    std::unique_ptr<tools::threadpool> m_notification_pool;  // threadpool of size 1 to queue notifications for external announcement
-
     bool check_for_changed_balances() {
       uint64_t balance = m_wallet.get_balance();
       uint64_t unlocked_balance = m_wallet.get_unlocked_balance();
@@ -936,87 +2751,255 @@ namespace monero {
       return false;
     }
 
-    // TODO: this can probably be optimized using e.g. wallet2.get_num_rct_outputs() or wallet2.get_num_transfer_details(), or by retaining confirmed block height and only checking on or after unlock height, etc
-    void check_for_changed_unlocked_txs() {
-
-      // get confirmed and locked txs
-      monero_tx_query query = monero_tx_query();
-      query.m_is_locked = true;
-      query.m_is_confirmed = true;
-      query.m_min_height = m_wallet.get_height() - 70; // only monitor recent txs
-      std::vector<std::shared_ptr<monero_tx_wallet>> locked_txs = m_wallet.get_txs(query);
+    // locked output received or tx which spent outputs, pending notification when it unlocks
+    struct unlock_entry {
+      uint64_t m_unlock_height;                     // height at which the tx is expected to unlock
+      crypto::hash m_txid;
+      uint64_t m_height;                            // height of the tx's block
+      uint64_t m_unlock_time;                       // unlock time of the tx as a height or timestamp
+      boost::optional<size_t> m_idx;                // wallet2 transfer index of the received output, none if the tx spent outputs
+      bool operator>(const unlock_entry& other) const { return m_unlock_height > other.m_unlock_height; }
+    };
+    boost::mutex m_unlock_mutex;                    // guards the unlock schedule which is seeded from the listener's thread
+    std::vector<unlock_entry> m_unlock_heap;        // min-heap of locked txs by unlock height
+    boost::optional<uint64_t> m_last_block_height;  // height of the last block processed to detect reorgs
+
+    void schedule(unlock_entry& entry) {
+      entry.m_unlock_height = entry.m_height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE;
+      if (entry.m_unlock_time < CRYPTONOTE_MAX_BLOCK_NUMBER) {
+        entry.m_unlock_height = std::max(entry.m_unlock_height, entry.m_unlock_time);
+      } else {
+        const uint64_t now = time(NULL);
+        if (entry.m_unlock_time > now) entry.m_unlock_height = std::max(entry.m_unlock_height, m_w2.get_blockchain_current_height() + (entry.m_unlock_time - now + DIFFICULTY_TARGET_V2 - 1) / DIFFICULTY_TARGET_V2); // estimate
+      }
+      boost::lock_guard<boost::mutex> lock(m_unlock_mutex);
+      m_unlock_heap.push_back(entry);
+      std::push_heap(m_unlock_heap.begin(), m_unlock_heap.end(), std::greater<unlock_entry>());
+    }
 
-      // collect hashes of txs no longer locked
-      std::vector<std::string> tx_hashes_no_longer_locked;
-      for (const std::string prev_locked_tx_hash : m_prev_locked_tx_hashes) {
-        bool found = false;
-        for (const std::shared_ptr<monero_tx_wallet>& locked_tx : locked_txs) {
-          if (locked_tx->m_hash.get() == prev_locked_tx_hash) {
-            found = true;
-            break;
-          }
-        }
-        if (!found) tx_hashes_no_longer_locked.push_back(prev_locked_tx_hash);
+    // unschedule txs at or above a height which is re-processed after a reorg
+    void check_for_reorg(uint64_t height, bool is_block_processed) {
+      boost::lock_guard<boost::mutex> lock(m_unlock_mutex);
+      if (m_last_block_height != boost::none && height <= *m_last_block_height) {
+        m_unlock_heap.erase(std::remove_if(m_unlock_heap.begin(), m_unlock_heap.end(), [height](const unlock_entry& entry) { return entry.m_height >= height; }), m_unlock_heap.end());
+        std::make_heap(m_unlock_heap.begin(), m_unlock_heap.end(), std::greater<unlock_entry>());
       }
+      if (is_block_processed) m_last_block_height = height;
+      else if (height > 0) m_last_block_height = height - 1; // block's outputs are reported before the block
+      else m_last_block_height = boost::none;
+    }
 
-      // fetch txs that are no longer locked
-      std::vector<std::shared_ptr<monero_tx_wallet>> txs_no_longer_locked;
-      if (!tx_hashes_no_longer_locked.empty()) {
-        query.m_hashes = tx_hashes_no_longer_locked;
-        query.m_is_locked = false;
-        query.m_include_outputs = true;
-        std::vector<std::string> missing_tx_hashes;
-        txs_no_longer_locked = m_wallet.get_txs(query, missing_tx_hashes);
+    // schedule txs which are currently locked from wallet2's state
+    void schedule_locked_outputs() {
+      {
+        boost::lock_guard<boost::mutex> lock(m_unlock_mutex);
+        m_unlock_heap.clear();
+        m_last_block_height = boost::none;
       }
 
-      // notify listeners of newly unlocked inputs and outputs
-      for (const std::shared_ptr<monero_tx_wallet>& unlocked_tx : txs_no_longer_locked) {
-        notify_outputs(unlocked_tx);
+      // received outputs
+      size_t num_outputs = m_w2.get_num_transfer_details();
+      for (size_t idx = 0; idx < num_outputs; idx++) {
+        const tools::wallet2::transfer_details& td = m_w2.get_transfer_details(idx);
+        if (m_w2.is_transfer_unlocked(td)) continue;
+        unlock_entry entry;
+        entry.m_txid = td.m_txid;
+        entry.m_height = td.m_block_height;
+        entry.m_unlock_time = td.m_tx.unlock_time;
+        entry.m_idx = idx;
+        schedule(entry);
       }
 
-      // re-assign currently locked tx hashes // TODO: needs mutex for thread safety?
-      m_prev_locked_tx_hashes.clear();
-      for (const std::shared_ptr<monero_tx_wallet>& locked_tx : locked_txs) {
-        m_prev_locked_tx_hashes.insert(locked_tx->m_hash.get());
+      // confirmed outgoing txs
+      std::vector<unlock_entry> spent_entries;
+      {
+        boost::lock_guard<boost::mutex> index_lock(m_wallet.m_tx_index->m_mutex);
+        m_wallet.m_tx_index->update();
+        m_wallet.m_tx_index->for_each_outgoing(monero_tx_index::index_query(), [&](const monero_tx_index::outgoing_row& row) {
+          if (m_w2.is_transfer_unlocked(row.m_unlock_time, row.m_height)) return;
+          unlock_entry entry;
+          entry.m_txid = row.m_tx_hash;
+          entry.m_height = row.m_height;
+          entry.m_unlock_time = row.m_unlock_time;
+          spent_entries.push_back(entry);
+        });
       }
+      for (unlock_entry& entry : spent_entries) schedule(entry);
     }
 
-    void notify_outputs(const std::shared_ptr<monero_tx_wallet>& tx) {
+    // notify listeners of the outputs of scheduled txs which unlocked
+    void notify_unlocked_outputs() {
 
-      // notify spent outputs
-      if (tx->m_outgoing_transfer != boost::none) {
-        
-        // build dummy input for notification // TODO: this provides one input with outgoing amount like monero-wallet-rpc client, use real inputs instead
-        std::shared_ptr<monero_output_wallet> input = std::make_shared<monero_output_wallet>();
-        input->m_amount = tx->m_outgoing_transfer.get()->m_amount.get() + tx->m_fee.get();
-        input->m_account_index = tx->m_outgoing_transfer.get()->m_account_index;
-        if (tx->m_outgoing_transfer.get()->m_subaddress_indices.size() == 1) input->m_subaddress_index = tx->m_outgoing_transfer.get()->m_subaddress_indices[0]; // initialize if transfer sourced from single subaddress
-        std::shared_ptr<monero_tx_wallet> tx_notify = std::make_shared<monero_tx_wallet>();
-        input->m_tx = tx_notify;
-        tx_notify->m_inputs.push_back(input);
-        tx_notify->m_hash = tx->m_hash;
-        tx_notify->m_is_locked = tx->m_is_locked;
-        tx_notify->m_unlock_height = tx->m_unlock_height;
-        if (tx->m_block != boost::none) {
-          std::shared_ptr<monero_block> block_notify = std::make_shared<monero_block>();
-          tx_notify->m_block = block_notify;
-          block_notify->m_height = tx->get_height();
-          block_notify->m_txs.push_back(tx_notify);
+      // pop unlocked entries
+      std::vector<unlock_entry> unlocked_entries;
+      {
+        boost::lock_guard<boost::mutex> lock(m_unlock_mutex);
+        uint64_t height = m_w2.get_blockchain_current_height();
+        std::vector<unlock_entry> relocked_entries;
+        while (!m_unlock_heap.empty() && m_unlock_heap.front().m_unlock_height <= height) {
+          std::pop_heap(m_unlock_heap.begin(), m_unlock_heap.end(), std::greater<unlock_entry>());
+          unlock_entry& entry = m_unlock_heap.back();
+          if (m_w2.is_transfer_unlocked(entry.m_unlock_time, entry.m_height)) unlocked_entries.push_back(entry);
+          else {
+            entry.m_unlock_height = height + 1; // unlock time estimate was early
+            relocked_entries.push_back(entry);
+          }
+          m_unlock_heap.pop_back();
+        }
+        for (const unlock_entry& entry : relocked_entries) {
+          m_unlock_heap.push_back(entry);
+          std::push_heap(m_unlock_heap.begin(), m_unlock_heap.end(), std::greater<unlock_entry>());
+        }
+      }
+      if (unlocked_entries.empty()) return;
+
+      // build unlocked txs from the scheduled outputs and the tx index's rows of spending txs
+      std::map<std::string, std::shared_ptr<monero_tx_wallet>> tx_map;
+      std::map<uint64_t, std::shared_ptr<monero_block>> block_map;
+      monero_tx_index::index_query spent_query;
+      spent_query.m_filter_hashes = true;
+      std::unordered_set<crypto::hash> spent_txids;
+      size_t num_transfers = m_w2.get_num_transfer_details();
+      for (const unlock_entry& entry : unlocked_entries) {
+        if (entry.m_idx == boost::none) {
+          if (spent_txids.insert(entry.m_txid).second) spent_query.m_hashes.push_back(entry.m_txid);
+        } else if (*entry.m_idx < num_transfers && m_w2.get_transfer_details(*entry.m_idx).m_txid == entry.m_txid) { // skip if transfers changed since scheduled
+          merge_tx(build_tx_with_vout(m_w2, m_w2.get_transfer_details(*entry.m_idx)), tx_map, block_map);
         }
-        
-        // notify listeners
-        for (monero_wallet_listener* listener : m_wallet.get_listeners()) listener->on_output_spent(*input);
       }
+      if (!spent_query.m_hashes.empty()) {
+        uint64_t height = m_w2.get_blockchain_current_height();
+        boost::lock_guard<boost::mutex> index_lock(m_wallet.m_tx_index->m_mutex);
+        m_wallet.m_tx_index->update();
+        m_wallet.m_tx_index->for_each_outgoing(spent_query, [&](const monero_tx_index::outgoing_row& row) {
+          merge_tx(build_tx_with_outgoing_transfer(m_w2, height, row), tx_map, block_map);
+        });
+      }
+
+      // notify unlocked txs like relayed txs
+      std::vector<std::shared_ptr<monero_tx_wallet>> txs;
+      for (const auto& tx_entry : tx_map) txs.push_back(tx_entry.second);
+      notify_outputs(txs);
+
+      // free memory
+      free_txs(txs);
+    }
+
+    void notify_outputs(const std::vector<std::shared_ptr<monero_tx_wallet>>& txs) {
+      std::vector<std::shared_ptr<monero_output_wallet>> received_outputs;
+      std::vector<std::shared_ptr<monero_output_wallet>> spent_outputs;
+      for (const std::shared_ptr<monero_tx_wallet>& tx : txs) {
+
+        // collect spent outputs
+        if (tx->m_outgoing_transfer != boost::none) {
+
+          // build dummy input for notification // TODO: this provides one input with outgoing amount like monero-wallet-rpc client, use real inputs instead
+          std::shared_ptr<monero_output_wallet> input = std::make_shared<monero_output_wallet>();
+          input->m_amount = tx->m_outgoing_transfer.get()->m_amount.get() + tx->m_fee.get();
+          input->m_account_index = tx->m_outgoing_transfer.get()->m_account_index;
+          if (tx->m_outgoing_transfer.get()->m_subaddress_indices.size() == 1) input->m_subaddress_index = tx->m_outgoing_transfer.get()->m_subaddress_indices[0]; // initialize if transfer sourced from single subaddress
+          std::shared_ptr<monero_tx_wallet> tx_notify = std::make_shared<monero_tx_wallet>();
+          input->m_tx = tx_notify;
+          tx_notify->m_inputs.push_back(input);
+          tx_notify->m_hash = tx->m_hash;
+          tx_notify->m_is_locked = tx->m_is_locked;
+          tx_notify->m_unlock_height = tx->m_unlock_height;
+          if (tx->m_block != boost::none) {
+            std::shared_ptr<monero_block> block_notify = std::make_shared<monero_block>();
+            tx_notify->m_block = block_notify;
+            block_notify->m_height = tx->get_height();
+            block_notify->m_txs.push_back(tx_notify);
+          }
+          spent_outputs.push_back(input);
+        }
 
-      // notify received outputs
-      if (!tx->m_incoming_transfers.empty()) {
-        for (const std::shared_ptr<monero_output_wallet>& output : tx->get_outputs_wallet()) {
-          for (monero_wallet_listener* listener : m_wallet.get_listeners()) listener->on_output_received(*output);
+        // collect received outputs
+        if (!tx->m_incoming_transfers.empty()) {
+          for (const std::shared_ptr<monero_output_wallet>& output : tx->get_outputs_wallet()) received_outputs.push_back(output);
         }
       }
+
+      // notify listeners
+      if (!spent_outputs.empty()) {
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) listener->on_outputs_spent(spent_outputs);
+      }
+      if (!received_outputs.empty()) {
+        for (monero_wallet_listener* listener : m_wallet.get_listeners()) listener->on_outputs_received(received_outputs);
+      }
     }
   };
 
+  // -------------------------------- SYNC HANDLE -----------------------------
+
+  bool monero_sync_handle::is_done() const {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_is_done;
+  }
+
+  monero_sync_result monero_sync_handle::wait() {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (!m_is_done) m_cv.wait(lock);
+    if (m_error) std::rethrow_exception(m_error);
+    return m_result;
+  }
+
+  bool monero_sync_handle::wait_for(uint64_t timeout_ms) {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    return m_cv.wait_for(lock, boost::chrono::milliseconds(timeout_ms), [this]() { return m_is_done; });
+  }
+
+  void monero_sync_handle::cancel() {
+    m_is_cancelled = true;
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    if (m_stop) m_stop();
+  }
+
+  boost::optional<uint64_t> monero_sync_handle::get_start_height() const {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_start_height;
+  }
+
+  boost::optional<uint64_t> monero_sync_handle::get_height() const {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_height;
+  }
+
+  boost::optional<uint64_t> monero_sync_handle::get_end_height() const {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_end_height;
+  }
+
+  double monero_sync_handle::get_percent_done() const {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    if (m_is_done && !m_is_cancelled && !m_error) return 1.0;
+    if (m_start_height == boost::none || m_height == boost::none || m_end_height == boost::none || *m_end_height <= *m_start_height) return 0;
+    return std::min(1.0, (double) (*m_height - std::min(*m_height, *m_start_height)) / (double) (*m_end_height - *m_start_height));
+  }
+
+  void monero_sync_handle::on_start(uint64_t start_height, uint64_t end_height, const std::function<void()>& stop) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_start_height = start_height;
+    m_height = start_height;
+    m_end_height = end_height;
+    m_stop = stop;
+    if (m_is_cancelled) m_stop(); // cancelled while starting
+  }
+
+  void monero_sync_handle::on_progress(uint64_t height) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_height = height;
+    if (m_end_height == boost::none || height > *m_end_height) m_end_height = height;
+  }
+
+  void monero_sync_handle::on_done(const monero_sync_result& result, std::exception_ptr error) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_result = result;
+    m_error = error;
+    m_stop = nullptr;
+    m_is_done = true;
+    m_cv.notify_all();
+  }
+
   // --------------------------- STATIC WALLET UTILS --------------------------
 
   bool monero_wallet_full::wallet_exists(const std::string& path) {
@@ -1030,7 +3013,7 @@ namespace monero {
   monero_wallet_full* monero_wallet_full::open_wallet(const std::string& path, const std::string& password, const monero_network_type network_type) {
     MTRACE("open_wallet(" << path << ", ***, " << network_type << ")");
     monero_wallet_full* wallet = new monero_wallet_full();
-    wallet->m_w2 = std::unique_ptr<tools::wallet2>(new tools::wallet2(static_cast<cryptonote::network_type>(network_type), 1, true));
+    wallet->m_w2 = create_wallet2(network_type, nullptr, wallet->m_rpc_timer, wallet->m_http_client_factory);
     wallet->m_w2->load(path, password);
     wallet->m_w2->init("");
     wallet->init_common();
@@ -1040,8 +3023,7 @@ namespace monero {
   monero_wallet_full* monero_wallet_full::open_wallet_data(const std::string& password, const monero_network_type network_type, const std::string& keys_data, const std::string& cache_data, const monero_rpc_connection& daemon_connection, std::unique_ptr<epee::net_utils::http::http_client_factory> http_client_factory) {
     MTRACE("open_wallet_data(...)");
     monero_wallet_full* wallet = new monero_wallet_full();
-    if (http_client_factory == nullptr) wallet->m_w2 = std::unique_ptr<tools::wallet2>(new tools::wallet2(static_cast<cryptonote::network_type>(network_type), 1, true));
-    else wallet->m_w2 = std::unique_ptr<tools::wallet2>(new tools::wallet2(static_cast<cryptonote::network_type>(network_type), 1, true, std::move(http_client_factory)));
+    wallet->m_w2 = create_wallet2(network_type, std::move(http_client_factory), wallet->m_rpc_timer, wallet->m_http_client_factory);
     wallet->m_w2->load("", password, keys_data, cache_data);
     wallet->m_w2->init("");
     wallet->set_daemon_connection(daemon_connection);
@@ -1053,8 +3035,7 @@ namespace monero {
     MTRACE("create_wallet_random(...)");
     if (!monero_utils::is_valid_language(language)) throw std::runtime_error("Unknown language: " + language);
     monero_wallet_full* wallet = new monero_wallet_full();
-    if (http_client_factory == nullptr) wallet->m_w2 = std::unique_ptr<tools::wallet2>(new tools::wallet2(static_cast<cryptonote::network_type>(network_type), 1, true));
-    else wallet->m_w2 = std::unique_ptr<tools::wallet2>(new tools::wallet2(static_cast<cryptonote::network_type>(network_type), 1, true, std::move(http_client_factory)));
+    wallet->m_w2 = create_wallet2(network_type, std::move(http_client_factory), wallet->m_rpc_timer, wallet->m_http_client_factory);
     wallet->set_daemon_connection(daemon_connection);
     wallet->m_w2->set_seed_language(language);
     crypto::secret_key secret_key;
@@ -1079,8 +3060,7 @@ namespace monero {
     if (!seed_offset.empty()) recovery_key = cryptonote::decrypt_key(recovery_key, seed_offset);
 
     // initialize wallet
-    if (http_client_factory == nullptr) wallet->m_w2 = std::unique_ptr<tools::wallet2>(new tools::wallet2(static_cast<cryptonote::network_type>(network_type), 1, true));
-    else wallet->m_w2 = std::unique_ptr<tools::wallet2>(new tools::wallet2(static_cast<cryptonote::network_type>(network_type), 1, true, std::move(http_client_factory)));
+    wallet->m_w2 = create_wallet2(network_type, std::move(http_client_factory), wallet->m_rpc_timer, wallet->m_http_client_factory);
     wallet->set_daemon_connection(daemon_connection);
     wallet->m_w2->set_seed_language(language);
     wallet->m_w2->generate(path, password, recovery_key, true, false);
@@ -1143,8 +3123,7 @@ namespace monero {
     if (!monero_utils::is_valid_language(language)) throw std::runtime_error("Unknown language: " + language);
 
     // initialize wallet
-    if (http_client_factory == nullptr) wallet->m_w2 = std::unique_ptr<tools::wallet2>(new tools::wallet2(static_cast<cryptonote::network_type>(network_type), 1, true));
-    else wallet->m_w2 = std::unique_ptr<tools::wallet2>(new tools::wallet2(static_cast<cryptonote::network_type>(network_type), 1, true, std::move(http_client_factory)));
+    wallet->m_w2 = create_wallet2(network_type, std::move(http_client_factory), wallet->m_rpc_timer, wallet->m_http_client_factory);
     if (has_spend_key && has_view_key) wallet->m_w2->generate(path, password, address_info.address, spend_key_sk, view_key_sk);
     else if (has_spend_key) wallet->m_w2->generate(path, password, spend_key_sk, true, false);
     else wallet->m_w2->generate(path, password, address_info.address, view_key_sk);
@@ -1185,8 +3164,10 @@ namespace monero {
     epee::net_utils::ssl_support_t ssl = uri.rfind("https", 0) == 0 ? epee::net_utils::ssl_support_t::e_ssl_support_enabled : epee::net_utils::ssl_support_t::e_ssl_support_disabled;
 
     // init wallet2 and std::set daemon connection
-    if (!m_w2->init(uri, login, {}, 0, is_trusted, ssl)) throw std::runtime_error("Failed to initialize wallet with daemon connection");
-    is_connected_to_daemon(); // update m_is_connected cache // TODO: better naming?
+    if (!m_w2->init(uri, login, m_daemon_proxy, 0, is_trusted, ssl)) throw std::runtime_error("Failed to initialize wallet with daemon connection");
+    m_daemon_ssl_support = ssl;
+    update_daemon_poller();
+    is_connected_to_daemon(true); // update m_is_connected cache // TODO: better naming?
   }
 
   void monero_wallet_full::set_daemon_connection(const boost::optional<monero_rpc_connection>& connection) {
@@ -1210,6 +3191,15 @@ namespace monero {
 
   // TODO: could return Wallet::ConnectionStatus_Disconnected, Wallet::ConnectionStatus_WrongVersion, Wallet::ConnectionStatus_Connected like wallet.cpp::connected()
   bool monero_wallet_full::is_connected_to_daemon() const {
+    return is_connected_to_daemon(false);
+  }
+
+  bool monero_wallet_full::is_connected_to_daemon(bool bypass_cache) const {
+    std::shared_ptr<monero_daemon_poller> daemon_poller = get_daemon_poller();
+    if (!bypass_cache && daemon_poller != nullptr) {
+      m_is_connected = daemon_poller->get_info(DAEMON_INFO_TTL_MS).m_is_connected;
+      return m_is_connected;
+    }
     uint32_t version = 0;
     m_is_connected = m_w2->check_connection(&version, NULL, DEFAULT_CONNECTION_TIMEOUT_MILLIS); // TODO: should this be updated elsewhere?
     if (!m_is_connected) return false;
@@ -1218,9 +3208,13 @@ namespace monero {
   }
 
   bool monero_wallet_full::is_daemon_synced() const {
+    return is_daemon_synced(false);
+  }
+
+  bool monero_wallet_full::is_daemon_synced(bool bypass_cache) const {
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
-    uint64_t daemonHeight = get_daemon_height();
-    return daemonHeight >= get_daemon_max_peer_height() && daemonHeight > 1;
+    uint64_t daemonHeight = get_daemon_height(bypass_cache);
+    return daemonHeight >= get_daemon_max_peer_height(bypass_cache) && daemonHeight > 1;
   }
 
   bool monero_wallet_full::is_daemon_trusted() const {
@@ -1353,6 +3347,7 @@ namespace monero {
   }
 
   uint64_t monero_wallet_full::get_height() const {
+    monero_state_lock state_lock(*this, false);
     return m_w2->get_blockchain_current_height();
   }
 
@@ -1365,7 +3360,13 @@ namespace monero {
   }
 
   uint64_t monero_wallet_full::get_daemon_height() const {
+    return get_daemon_height(false);
+  }
+
+  uint64_t monero_wallet_full::get_daemon_height(bool bypass_cache) const {
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
+    boost::optional<monero_daemon_poller::daemon_info> info = get_cached_daemon_info(get_daemon_poller(), bypass_cache);
+    if (info != boost::none) return info->m_height;
     std::string err;
     uint64_t result = m_w2->get_daemon_blockchain_height(err);
     if (!err.empty()) throw std::runtime_error(err);
@@ -1373,14 +3374,20 @@ namespace monero {
   }
 
   uint64_t monero_wallet_full::get_daemon_max_peer_height() const {
+    return get_daemon_max_peer_height(false);
+  }
+
+  uint64_t monero_wallet_full::get_daemon_max_peer_height(bool bypass_cache) const {
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
+    boost::optional<monero_daemon_poller::daemon_info> info = get_cached_daemon_info(get_daemon_poller(), bypass_cache);
+    if (info != boost::none) return info->m_target_height;
     std::string err;
     uint64_t result = m_w2->get_daemon_blockchain_target_height(err);
     if (!err.empty()) throw std::runtime_error(err);
-    if (result == 0) result = get_daemon_height(); // TODO monero-project: target height can be 0 when daemon is synced.  Use blockchain height instead
+    if (result == 0) result = get_daemon_height(true); // TODO monero-project: target height can be 0 when daemon is synced.  Use blockchain height instead
     return result;
   }
-  
+
   uint64_t monero_wallet_full::get_height_by_date(uint16_t year, uint8_t month, uint8_t day) const {
     return m_w2->get_blockchain_height_by_date(year, month, day);
   }
@@ -1449,24 +3456,63 @@ namespace monero {
   }
 
   void monero_wallet_full::start_syncing(uint64_t sync_period_in_ms) {
+    start_syncing(sync_period_in_ms, false);
+  }
+
+  std::shared_ptr<monero_sync_handle> monero_wallet_full::sync_async(boost::optional<uint64_t> start_height) {
+    MTRACE("sync_async()");
+    if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
+    std::shared_ptr<monero_sync_handle> sync_handle = std::make_shared<monero_sync_handle>();
+    boost::lock_guard<boost::mutex> lock(m_syncing_mutex);
+    monero_scheduler::get_instance().schedule(0, [this, sync_handle, start_height]() {
+      monero_sync_result result(0, false);
+      std::exception_ptr error;
+      try { result = lock_and_sync(start_height, sync_handle); }
+      catch (...) { error = std::current_exception(); }
+      sync_handle->on_done(result, error);
+      boost::lock_guard<boost::mutex> lock(m_syncing_mutex);
+      m_pending_sync_handles.erase(sync_handle);
+      m_sync_cv.notify_all();
+    });
+    m_pending_sync_handles.insert(sync_handle);
+    return sync_handle;
+  }
+
+  void monero_wallet_full::start_syncing(uint64_t sync_period_in_ms, bool adaptive) {
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
     m_syncing_interval = sync_period_in_ms;
-    if (!m_syncing_enabled) {
-      m_syncing_enabled = true;
-      run_sync_loop(); // sync wallet on loop in background
-    }
+    m_syncing_adaptive = adaptive;
+    m_syncing_enabled = true;
+    update_daemon_poller();
+    run_sync_loop(); // sync wallet on loop in background unless running
   }
 
   void monero_wallet_full::stop_syncing() {
     m_syncing_enabled = false;
     m_w2->stop();
+    update_daemon_poller();
+
+    // cancel scheduled sync
+    boost::lock_guard<boost::mutex> lock(m_syncing_mutex);
+    if (m_sync_loop_running && monero_scheduler::get_instance().cancel(m_sync_timer_id)) {
+      m_sync_loop_running = false;
+      m_sync_cv.notify_all();
+    }
+  }
+
+  uint64_t monero_wallet_full::get_effective_sync_interval() const {
+    boost::lock_guard<boost::mutex> lock(m_daemon_poller_mutex);
+    if (m_daemon_poller_subscription_id == boost::none) return m_syncing_interval;
+    return std::max(m_daemon_poller->get_interval_ms(), m_sync_retry_ms.load());
   }
 
   void monero_wallet_full::rescan_spent() {
     MTRACE("rescan_spent()");
+    monero_state_lock state_lock(*this, true);
     if (!m_is_connected) throw std::runtime_error("Wallet is not connected to daemon");
     if (!is_daemon_trusted()) throw std::runtime_error("Rescan spent can only be used with a trusted daemon");
     m_w2->rescan_spent();
+    m_balance_tracker->invalidate();
   }
 
   // TODO: support arguments bool hard, bool refresh = true, bool keep_key_images = false
@@ -1480,39 +3526,70 @@ namespace monero {
   // isMultisigImportNeeded
 
   uint64_t monero_wallet_full::get_balance() const {
-    return m_w2->balance_all(STRICT);
+    monero_state_lock state_lock(*this, false);
+    return m_balance_tracker->get_balances().m_balance;
   }
 
   uint64_t monero_wallet_full::get_balance(uint32_t account_idx) const {
-    return m_w2->balance(account_idx, STRICT);
+    monero_state_lock state_lock(*this, false);
+    return m_balance_tracker->get_balances(account_idx).m_balance;
   }
 
   uint64_t monero_wallet_full::get_balance(uint32_t account_idx, uint32_t subaddress_idx) const {
-    std::map<uint32_t, uint64_t> balance_per_subaddress = m_w2->balance_per_subaddress(account_idx, STRICT);
-    auto iter = balance_per_subaddress.find(subaddress_idx);
-    return iter == balance_per_subaddress.end() ? 0 : iter->second;
+    monero_state_lock state_lock(*this, false);
+    return m_balance_tracker->get_balances(account_idx, subaddress_idx).m_balance;
   }
 
   uint64_t monero_wallet_full::get_unlocked_balance() const {
-    return m_w2->unlocked_balance_all(STRICT);
+    monero_state_lock state_lock(*this, false);
+    return m_balance_tracker->get_balances().m_unlocked_balance;
   }
 
   uint64_t monero_wallet_full::get_unlocked_balance(uint32_t account_idx) const {
-    return m_w2->unlocked_balance(account_idx, STRICT);
+    monero_state_lock state_lock(*this, false);
+    return m_balance_tracker->get_balances(account_idx).m_unlocked_balance;
   }
 
   uint64_t monero_wallet_full::get_unlocked_balance(uint32_t account_idx, uint32_t subaddress_idx) const {
-    std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> unlocked_balance_per_subaddress = m_w2->unlocked_balance_per_subaddress(account_idx, STRICT);
-    auto iter = unlocked_balance_per_subaddress.find(subaddress_idx);
-    return iter == unlocked_balance_per_subaddress.end() ? 0 : iter->second.first;
+    monero_state_lock state_lock(*this, false);
+    return m_balance_tracker->get_balances(account_idx, subaddress_idx).m_unlocked_balance;
+  }
+
+  void monero_wallet_full::set_balance_check_enabled(bool check_enabled) {
+    m_balance_tracker->set_check_enabled(check_enabled);
+  }
+
+  monero_sync_stats monero_wallet_full::get_sync_stats() const {
+    monero_sync_stats stats;
+    {
+      boost::lock_guard<boost::mutex> lock(m_sync_stats_mutex);
+      stats = m_sync_stats;
+    }
+    stats.m_notification_queue_depth = m_w2_listener->get_notification_queue_depth();
+    return stats;
+  }
+
+  uint64_t monero_wallet_full::get_num_inconsistent_queries() const {
+    return m_num_inconsistent_queries;
+  }
+
+  std::shared_ptr<const monero_wallet_snapshot> monero_wallet_full::get_snapshot() const {
+    std::shared_ptr<const monero_wallet_snapshot> snapshot = std::atomic_load(&m_snapshot);
+    if (snapshot != nullptr) return snapshot;
+
+    // build first snapshot if the wallet has not synced or changed since opened
+    monero_state_lock state_lock(*this, false);
+    boost::lock_guard<boost::mutex> lock(m_snapshot_mutex);
+    snapshot = std::atomic_load(&m_snapshot);
+    if (snapshot != nullptr) return snapshot;
+    snapshot = build_snapshot();
+    std::atomic_store(&m_snapshot, snapshot);
+    return snapshot;
   }
 
   std::vector<monero_account> monero_wallet_full::get_accounts(bool include_subaddresses, const std::string& tag) const {
     MTRACE("get_accounts(" << include_subaddresses << ", " << tag << ")");
-
-    // need transfers to inform if subaddresses used
-    std::vector<tools::wallet2::transfer_details> transfers;
-    if (include_subaddresses) m_w2->get_transfers(transfers);
+    monero_state_lock state_lock(*this, false);
 
     // build accounts
     std::vector<monero_account> accounts;
@@ -1520,9 +3597,10 @@ namespace monero {
       monero_account account;
       account.m_index = account_idx;
       account.m_primary_address = get_address(account_idx, 0);
-      account.m_balance = m_w2->balance(account_idx, STRICT);
-      account.m_unlocked_balance = m_w2->unlocked_balance(account_idx, STRICT);
-      if (include_subaddresses) account.m_subaddresses = get_subaddresses_aux(account_idx, std::vector<uint32_t>(), transfers);
+      monero_balance_tracker::balances account_balances = m_balance_tracker->get_balances(account_idx);
+      account.m_balance = account_balances.m_balance;
+      account.m_unlocked_balance = account_balances.m_unlocked_balance;
+      if (include_subaddresses) account.m_subaddresses = get_subaddresses_aux(account_idx, std::vector<uint32_t>());
       accounts.push_back(account);
     }
 
@@ -1531,23 +3609,22 @@ namespace monero {
 
   monero_account monero_wallet_full::get_account(uint32_t account_idx, bool include_subaddresses) const {
     MTRACE("get_account(" << account_idx << ", " << include_subaddresses << ")");
-
-    // need transfers to inform if subaddresses used
-    std::vector<tools::wallet2::transfer_details> transfers;
-    if (include_subaddresses) m_w2->get_transfers(transfers);
+    monero_state_lock state_lock(*this, false);
 
     // build and return account
     monero_account account;
     account.m_index = account_idx;
     account.m_primary_address = get_address(account_idx, 0);
-    account.m_balance = m_w2->balance(account_idx, STRICT);
-    account.m_unlocked_balance = m_w2->unlocked_balance(account_idx, STRICT);
-    if (include_subaddresses) account.m_subaddresses = get_subaddresses_aux(account_idx, std::vector<uint32_t>(), transfers);
+    monero_balance_tracker::balances account_balances = m_balance_tracker->get_balances(account_idx);
+    account.m_balance = account_balances.m_balance;
+    account.m_unlocked_balance = account_balances.m_unlocked_balance;
+    if (include_subaddresses) account.m_subaddresses = get_subaddresses_aux(account_idx, std::vector<uint32_t>());
     return account;
   }
 
   monero_account monero_wallet_full::create_account(const std::string& label) {
     MTRACE("create_account(" << label << ")");
+    monero_state_lock state_lock(*this, true);
 
     // create account
     m_w2->add_subaddress_account(label);
@@ -1563,15 +3640,14 @@ namespace monero {
 
   std::vector<monero_subaddress> monero_wallet_full::get_subaddresses(const uint32_t account_idx, const std::vector<uint32_t>& subaddress_indices) const {
     MTRACE("get_subaddresses(" << account_idx << ", ...)");
+    monero_state_lock state_lock(*this, false);
     MTRACE("Subaddress indices size: " << subaddress_indices.size());
-
-    std::vector<tools::wallet2::transfer_details> transfers;
-    m_w2->get_transfers(transfers);
-    return get_subaddresses_aux(account_idx, subaddress_indices, transfers);
+    return get_subaddresses_aux(account_idx, subaddress_indices);
   }
 
   monero_subaddress monero_wallet_full::create_subaddress(const uint32_t account_idx, const std::string& label) {
     MTRACE("create_subaddress(" << account_idx << ", " << label << ")");
+    monero_state_lock state_lock(*this, true);
 
     // create subaddress
     m_w2->add_subaddress(account_idx, label);
@@ -1595,36 +3671,46 @@ namespace monero {
   }
   
   std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_full::get_txs(const monero_tx_query& query) const {
+    return get_txs(copy_query(query));
+  }
+
+  std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_full::get_txs(monero_tx_query&& query) const {
+    return get_txs(normalize_query(std::move(query)));
+  }
+
+  std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_full::get_txs(const std::shared_ptr<monero_tx_query>& query) const {
     std::vector<std::string> missing_tx_hashes;
-    std::vector<std::shared_ptr<monero_tx_wallet>> txs = get_txs(query, missing_tx_hashes);
+    std::vector<std::shared_ptr<monero_tx_wallet>> txs = get_txs_aux(normalize_query(query), missing_tx_hashes);
     if (!missing_tx_hashes.empty()) throw std::runtime_error("Tx not found in wallet: " + missing_tx_hashes[0]);
     return txs;
   }
 
   std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_full::get_txs(const monero_tx_query& query, std::vector<std::string>& missing_tx_hashes) const {
-    MTRACE("get_txs(query)");
+    return get_txs_aux(copy_query(query), missing_tx_hashes);
+  }
 
-    // copy query
-    std::shared_ptr<monero_tx_query> query_sp = std::make_shared<monero_tx_query>(query); // convert to shared pointer
-    std::shared_ptr<monero_tx_query> _query = query_sp->copy(query_sp, std::make_shared<monero_tx_query>()); // deep copy
+  std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_full::get_txs_aux(const std::shared_ptr<monero_tx_query>& _query, std::vector<std::string>& missing_tx_hashes) const {
+    MTRACE("get_txs(query)");
+    monero_state_lock state_lock(*this, false);
 
 //    // log query
 //    if (_query->m_block != boost::none) std::cout << "Tx query's rooted at [block]: " << _query->m_block.get()->serialize() << std::endl;
 //    else std::cout << "Tx _query: " << _query->serialize() << std::endl;
 
-    // temporarily disable transfer and output queries in order to collect all tx context
+    // temporarily decontextualize query in order to collect all tx context
+    boost::optional<bool> is_incoming = _query->m_is_incoming;
+    boost::optional<bool> is_outgoing = _query->m_is_outgoing;
     boost::optional<std::shared_ptr<monero_transfer_query>> transfer_query = _query->m_transfer_query;
     boost::optional<std::shared_ptr<monero_output_query>> input_query = _query->m_input_query;
     boost::optional<std::shared_ptr<monero_output_query>> output_query = _query->m_output_query;
-    _query->m_transfer_query = boost::none;
-    _query->m_input_query = boost::none;
-    _query->m_output_query = boost::none;
+    decontextualize(_query);
 
     // fetch all transfers that meet tx query
     std::shared_ptr<monero_transfer_query> temp_transfer_query = std::make_shared<monero_transfer_query>();
-    temp_transfer_query->m_tx_query = decontextualize(_query->copy(_query, std::make_shared<monero_tx_query>()));
-    temp_transfer_query->m_tx_query.get()->m_transfer_query = temp_transfer_query;
-    std::vector<std::shared_ptr<monero_transfer>> transfers = get_transfers_aux(*temp_transfer_query);
+    temp_transfer_query->m_tx_query = _query;
+    _query->m_transfer_query = temp_transfer_query;
+    std::vector<std::shared_ptr<monero_transfer>> transfers = get_transfers_aux(temp_transfer_query);
+    _query->m_transfer_query = boost::none;
 
     // collect unique txs from transfers while retaining order
     std::vector<std::shared_ptr<monero_tx_wallet>> txs = std::vector<std::shared_ptr<monero_tx_wallet>>();
@@ -1646,9 +3732,10 @@ namespace monero {
     // fetch and merge outputs if requested
     if ((_query->m_include_outputs != boost::none && *_query->m_include_outputs) || output_query != boost::none) {
       std::shared_ptr<monero_output_query> temp_output_query = std::make_shared<monero_output_query>();
-      temp_output_query->m_tx_query = decontextualize(_query->copy(_query, std::make_shared<monero_tx_query>()));
-      temp_output_query->m_tx_query.get()->m_output_query = temp_output_query;
-      std::vector<std::shared_ptr<monero_output_wallet>> outputs = get_outputs_aux(*temp_output_query);
+      temp_output_query->m_tx_query = _query;
+      _query->m_output_query = temp_output_query;
+      std::vector<std::shared_ptr<monero_output_wallet>> outputs = get_outputs_aux(temp_output_query);
+      _query->m_output_query = boost::none;
 
       // merge output txs one time while retaining order
       std::unordered_set<std::shared_ptr<monero_tx_wallet>> output_txs;
@@ -1661,17 +3748,20 @@ namespace monero {
       }
     }
 
-    // restore transfer and output queries
+    // restore query
+    _query->m_is_incoming = is_incoming;
+    _query->m_is_outgoing = is_outgoing;
     _query->m_transfer_query = transfer_query;
     _query->m_input_query = input_query;
     _query->m_output_query = output_query;
 
-    // filter txs that don't meet transfer query
+    // filter txs that don't meet query, skipping tx hashes which are applied when fetching transfers
+    monero_tx_query_plan plan(*_query, monero_tx_query_plan::PUSHDOWN_HASHES, true);
     std::vector<std::shared_ptr<monero_tx_wallet>> queried_txs;
     std::vector<std::shared_ptr<monero_tx_wallet>>::iterator tx_iter = txs.begin();
     while (tx_iter != txs.end()) {
       std::shared_ptr<monero_tx_wallet> tx = *tx_iter;
-      if (_query->meets_criteria(tx.get())) {
+      if (plan.matches(*tx)) {
         queried_txs.push_back(tx);
         tx_iter++;
       } else {
@@ -1682,11 +3772,12 @@ namespace monero {
     }
     txs = queried_txs;
 
-    // special case: re-fetch txs if inconsistency caused by needing to make multiple wallet calls  // TODO monero-project: offer wallet.get_txs(...)
+    // wallet2 calls above share one view of wallet state under the state lock, so a confirmed tx without a block cannot be fixed by re-fetching
     for (const std::shared_ptr<monero_tx_wallet>& tx : txs) {
       if (*tx->m_is_confirmed && tx->m_block == boost::none) {
-        std::cout << "WARNING: Inconsistency detected building txs from multiple wallet2 calls, re-fetching" << std::endl;
-        return get_txs(*_query, missing_tx_hashes);
+        m_num_inconsistent_queries++;
+        MWARNING("Confirmed tx " << tx->m_hash.get() << " has no block after building txs from multiple wallet2 calls");
+        break;
       }
     }
 
@@ -1704,6 +3795,16 @@ namespace monero {
   }
 
   std::vector<std::shared_ptr<monero_transfer>> monero_wallet_full::get_transfers(const monero_transfer_query& query) const {
+    return get_transfers(copy_query(query));
+  }
+
+  std::vector<std::shared_ptr<monero_transfer>> monero_wallet_full::get_transfers(monero_transfer_query&& query) const {
+    return get_transfers(normalize_query(std::move(query)));
+  }
+
+  std::vector<std::shared_ptr<monero_transfer>> monero_wallet_full::get_transfers(const std::shared_ptr<monero_transfer_query>& query) const {
+    monero_state_lock state_lock(*this, false);
+    normalize_query(query);
 
 //    // log query
 //    if (query.m_tx_query != boost::none) {
@@ -1712,12 +3813,12 @@ namespace monero {
 //    } else std::cout << "Transfer query: " << query.serialize() << std::endl;
 
     // get transfers directly if query does not require tx context (e.g. other transfers, outputs)
-    if (!is_contextual(query)) return get_transfers_aux(query);
+    if (!is_contextual(*query)) return get_transfers_aux(query);
 
     // otherwise get txs with full models to fulfill query
     std::vector<std::shared_ptr<monero_transfer>> transfers;
-    for (const std::shared_ptr<monero_tx_wallet>& tx : get_txs(*(query.m_tx_query.get()))) {
-      for (const std::shared_ptr<monero_transfer>& transfer : tx->filter_transfers(query)) { // collect queried transfers, erase if excluded
+    for (const std::shared_ptr<monero_tx_wallet>& tx : get_txs(query->m_tx_query.get())) {
+      for (const std::shared_ptr<monero_transfer>& transfer : tx->filter_transfers(*query)) { // collect queried transfers, erase if excluded
         transfers.push_back(transfer);
       }
     }
@@ -1725,6 +3826,16 @@ namespace monero {
   }
 
   std::vector<std::shared_ptr<monero_output_wallet>> monero_wallet_full::get_outputs(const monero_output_query& query) const {
+    return get_outputs(copy_query(query));
+  }
+
+  std::vector<std::shared_ptr<monero_output_wallet>> monero_wallet_full::get_outputs(monero_output_query&& query) const {
+    return get_outputs(normalize_query(std::move(query)));
+  }
+
+  std::vector<std::shared_ptr<monero_output_wallet>> monero_wallet_full::get_outputs(const std::shared_ptr<monero_output_query>& query) const {
+    monero_state_lock state_lock(*this, false);
+    normalize_query(query);
 
 //    // log query
 //    if (query.m_tx_query != boost::none) {
@@ -1733,23 +3844,61 @@ namespace monero {
 //    } else std::cout << "Output query: " << query.serialize() << std::endl;
 
     // get outputs directly if query does not require tx context (e.g. other outputs, transfers)
-    if (!is_contextual(query)) return get_outputs_aux(query);
+    if (!is_contextual(*query)) return get_outputs_aux(query);
 
     // otherwise get txs with full models to fulfill query
     std::vector<std::shared_ptr<monero_output_wallet>> outputs;
-    for (const std::shared_ptr<monero_tx_wallet>& tx : get_txs(*(query.m_tx_query.get()))) {
-      for (const std::shared_ptr<monero_output_wallet>& output : tx->filter_outputs_wallet(query)) { // collect queried outputs, erase if excluded
+    for (const std::shared_ptr<monero_tx_wallet>& tx : get_txs(query->m_tx_query.get())) {
+      for (const std::shared_ptr<monero_output_wallet>& output : tx->filter_outputs_wallet(*query)) { // collect queried outputs, erase if excluded
         outputs.push_back(output);
       }
     }
     return outputs;
   }
 
+  void monero_wallet_full::for_each_tx(const monero_tx_query& query, const std::function<bool(const std::shared_ptr<monero_tx_wallet>&)>& visitor, monero_sort_order sort_order) const {
+    monero_state_lock state_lock(*this, false);
+    for_each_tx_aux(query, visitor, sort_order, boost::none, true);
+  }
+
+  void monero_wallet_full::for_each_transfer(const monero_transfer_query& query, const std::function<bool(const std::shared_ptr<monero_transfer>&)>& visitor, monero_sort_order sort_order) const {
+    monero_state_lock state_lock(*this, false);
+    for_each_transfer_aux(query, visitor, sort_order, boost::none, true);
+  }
+
+  void monero_wallet_full::for_each_output(const monero_output_query& query, const std::function<bool(const std::shared_ptr<monero_output_wallet>&)>& visitor, monero_sort_order sort_order) const {
+    monero_state_lock state_lock(*this, false);
+    for_each_output_aux(query, visitor, sort_order, boost::none, true);
+  }
+
+  monero_page<monero_tx_wallet> monero_wallet_full::get_txs_page(const monero_tx_query& query, const monero_page_request& request) const {
+    monero_state_lock state_lock(*this, false);
+    monero_pager<monero_tx_wallet> pager(request);
+    for_each_tx_aux(query, [&pager](const std::shared_ptr<monero_tx_wallet>& tx) { return pager.add(tx); }, request.m_sort_order, pager.get_resume_cursor(), false);
+    return pager.get_page();
+  }
+
+  monero_page<monero_transfer> monero_wallet_full::get_transfers_page(const monero_transfer_query& query, const monero_page_request& request) const {
+    monero_state_lock state_lock(*this, false);
+    monero_pager<monero_transfer> pager(request);
+    for_each_transfer_aux(query, [&pager](const std::shared_ptr<monero_transfer>& transfer) { return pager.add(transfer); }, request.m_sort_order, pager.get_resume_cursor(), false);
+    return pager.get_page();
+  }
+
+  monero_page<monero_output_wallet> monero_wallet_full::get_outputs_page(const monero_output_query& query, const monero_page_request& request) const {
+    monero_state_lock state_lock(*this, false);
+    monero_pager<monero_output_wallet> pager(request);
+    for_each_output_aux(query, [&pager](const std::shared_ptr<monero_output_wallet>& output) { return pager.add(output); }, request.m_sort_order, pager.get_resume_cursor(), false);
+    return pager.get_page();
+  }
+
   std::string monero_wallet_full::export_outputs(bool all) const {
+    monero_state_lock state_lock(*this, false);
     return epee::string_tools::buff_to_hex_nodelimer(m_w2->export_outputs_to_str(all));
   }
 
   int monero_wallet_full::import_outputs(const std::string& outputs_hex) {
+    monero_state_lock state_lock(*this, true);
 
     // validate and parse hex data
     cryptonote::blobdata blob;
@@ -1758,11 +3907,14 @@ namespace monero {
     }
 
     // import hex and return result
-    return m_w2->import_outputs_from_str(blob);
+    int num_imported = m_w2->import_outputs_from_str(blob);
+    m_balance_tracker->invalidate();
+    return num_imported;
   }
 
   std::vector<std::shared_ptr<monero_key_image>> monero_wallet_full::export_key_images(bool all) const {
     MTRACE("monero_wallet_full::export_key_images()");
+    monero_state_lock state_lock(*this, false);
 
     // build key images from wallet2 types
     std::vector<std::shared_ptr<monero_key_image>> key_images;
@@ -1778,6 +3930,7 @@ namespace monero {
 
   std::shared_ptr<monero_key_image_import_result> monero_wallet_full::import_key_images(const std::vector<std::shared_ptr<monero_key_image>>& key_images) {
     MTRACE("monero_wallet_full::import_key_images()");
+    monero_state_lock state_lock(*this, true);
 
     // validate and prepare key images for wallet2
     std::vector<std::pair<crypto::key_image, crypto::signature>> ski;
@@ -1794,6 +3947,8 @@ namespace monero {
     // import key images
     uint64_t spent = 0, unspent = 0;
     uint64_t height = m_w2->import_key_images(ski, 0, spent, unspent, is_connected_to_daemon()); // TODO: use offset? refer to wallet_rpc_server::on_import_key_images() req.offset
+    m_tx_index->invalidate(); // spent key images can add outgoing txs
+    m_balance_tracker->invalidate();
 
     // translate results
     std::shared_ptr<monero_key_image_import_result> result = std::make_shared<monero_key_image_import_result>();
@@ -1804,20 +3959,25 @@ namespace monero {
   }
 
   void monero_wallet_full::freeze_output(const std::string& key_image) {
+    monero_state_lock state_lock(*this, true);
     if (key_image.empty()) throw std::runtime_error("Must specify key image to freeze");
     crypto::key_image ki;
     if (!epee::string_tools::hex_to_pod(key_image, ki)) throw new std::runtime_error("failed to parse key imge");
     m_w2->freeze(ki);
+    m_balance_tracker->on_frozen_changed(ki);
   }
 
   void monero_wallet_full::thaw_output(const std::string& key_image) {
+    monero_state_lock state_lock(*this, true);
     if (key_image.empty()) throw std::runtime_error("Must specify key image to thaw");
     crypto::key_image ki;
     if (!epee::string_tools::hex_to_pod(key_image, ki)) throw new std::runtime_error("failed to parse key imge");
     m_w2->thaw(ki);
+    m_balance_tracker->on_frozen_changed(ki);
   }
 
   bool monero_wallet_full::is_output_frozen(const std::string& key_image) {
+    monero_state_lock state_lock(*this, false);
     if (key_image.empty()) throw std::runtime_error("Must specify key image to check if frozen");
     crypto::key_image ki;
     if (!epee::string_tools::hex_to_pod(key_image, ki)) throw new std::runtime_error("failed to parse key imge");
@@ -1826,6 +3986,7 @@ namespace monero {
 
   std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_full::create_txs(const monero_tx_config& config) {
     MTRACE("monero_wallet_full::create_txs");
+    monero_state_lock state_lock(*this, true);
     //std::cout << "monero_tx_config: " << config.serialize()  << std::endl;
 
     // validate config
@@ -1967,6 +4128,7 @@ namespace monero {
   }
 
   std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_full::sweep_unlocked(const monero_tx_config& config) {
+    monero_state_lock state_lock(*this, true);
 
     // validate config
     std::vector<std::shared_ptr<monero_destination>> destinations = config.get_normalized_destinations();
@@ -2168,6 +4330,7 @@ namespace monero {
 
   std::shared_ptr<monero_tx_wallet> monero_wallet_full::sweep_output(const monero_tx_config& config)  {
     MTRACE("sweep_output()");
+    monero_state_lock state_lock(*this, true);
     //MTRACE("monero_tx_config: " << config.serialize());
 
     // validate input config
@@ -2310,6 +4473,7 @@ namespace monero {
 
   std::vector<std::shared_ptr<monero_tx_wallet>> monero_wallet_full::sweep_dust(bool relay) {
     MTRACE("monero_wallet_full::sweep_dust()");
+    monero_state_lock state_lock(*this, true);
 
     // create transaction to fill
     std::vector<wallet2::pending_tx> ptx_vector = m_w2->create_unmixable_sweep_transactions();
@@ -2409,6 +4573,7 @@ namespace monero {
 
   std::vector<std::string> monero_wallet_full::relay_txs(const std::vector<std::string>& tx_metadatas) {
     MTRACE("relay_txs()");
+    monero_state_lock state_lock(*this, true);
 
     // relay each metadata as a tx
     std::vector<std::string> tx_hashes;
@@ -2638,6 +4803,7 @@ namespace monero {
 
   // implementation based on monero-project wallet_rpc_server.cpp::on_submit_transfer()
   std::vector<std::string> monero_wallet_full::submit_txs(const std::string& signed_tx_hex) {
+    monero_state_lock state_lock(*this, true);
     if (m_w2->key_on_device()) throw std::runtime_error("command not supported by HW wallet");
 
     cryptonote::blobdata blob;
@@ -2893,6 +5059,7 @@ namespace monero {
 
   std::string monero_wallet_full::get_tx_note(const std::string& tx_hash) const {
     MTRACE("monero_wallet_full::get_tx_note()");
+    monero_state_lock state_lock(*this, false);
     cryptonote::blobdata tx_blob;
     if (!epee::string_tools::parse_hexstr_to_binbuff(tx_hash, tx_blob) || tx_blob.size() != sizeof(crypto::hash)) {
       throw std::runtime_error("TX hash has invalid format");
@@ -2903,6 +5070,7 @@ namespace monero {
 
   std::vector<std::string> monero_wallet_full::get_tx_notes(const std::vector<std::string>& tx_hashes) const {
     MTRACE("monero_wallet_full::get_tx_notes()");
+    monero_state_lock state_lock(*this, false);
     std::vector<std::string> notes;
     for (const auto& tx_hash : tx_hashes) notes.push_back(get_tx_note(tx_hash));
     return notes;
@@ -2910,6 +5078,7 @@ namespace monero {
 
   void monero_wallet_full::set_tx_note(const std::string& tx_hash, const std::string& note) {
     MTRACE("monero_wallet_full::set_tx_note()");
+    monero_state_lock state_lock(*this, true);
     cryptonote::blobdata tx_blob;
     if (!epee::string_tools::parse_hexstr_to_binbuff(tx_hash, tx_blob) || tx_blob.size() != sizeof(crypto::hash)) {
       throw std::runtime_error("TX hash has invalid format");
@@ -2920,6 +5089,7 @@ namespace monero {
 
   void monero_wallet_full::set_tx_notes(const std::vector<std::string>& tx_hashes, const std::vector<std::string>& notes) {
     MTRACE("monero_wallet_full::set_tx_notes()");
+    monero_state_lock state_lock(*this, true);
     if (tx_hashes.size() != notes.size()) throw std::runtime_error("Different amount of txids and notes");
     for (int i = 0; i < tx_hashes.size(); i++) {
       set_tx_note(tx_hashes[i], notes[i]);
@@ -2928,6 +5098,7 @@ namespace monero {
 
   std::vector<monero_address_book_entry> monero_wallet_full::get_address_book_entries(const std::vector<uint64_t>& indices) const {
     MTRACE("monero_wallet_full::get_address_book_entries()");
+    monero_state_lock state_lock(*this, false);
 
     // get wallet2 address book entries
     const auto w2_entries = m_w2->get_address_book();
@@ -2960,6 +5131,7 @@ namespace monero {
 
   uint64_t monero_wallet_full::add_address_book_entry(const std::string& address, const std::string& description) {
     MTRACE("add_address_book_entry()");
+    monero_state_lock state_lock(*this, true);
     cryptonote::address_parse_info info;
     epee::json_rpc::error er;
     if(!get_account_address_from_str_or_url(info, m_w2->nettype(), address,
@@ -2977,6 +5149,7 @@ namespace monero {
 
   void monero_wallet_full::edit_address_book_entry(uint64_t index, bool set_address, const std::string& address, bool set_description, const std::string& description) {
     MTRACE("edit_address_book_entry()");
+    monero_state_lock state_lock(*this, true);
 
     const auto ab = m_w2->get_address_book();
     if (index >= ab.size()) throw std::runtime_error("Index out of range: " + std::to_string(index));
@@ -3009,6 +5182,7 @@ namespace monero {
   }
 
   void monero_wallet_full::delete_address_book_entry(uint64_t index) {
+    monero_state_lock state_lock(*this, true);
     const auto w2_entries = m_w2->get_address_book();
     if (index >= w2_entries.size()) throw std::runtime_error("Index out of range: " + std::to_string(index));
     if (!m_w2->delete_address_book_row(index)) throw std::runtime_error("Failed to delete address book entry");
@@ -3165,6 +5339,7 @@ namespace monero {
     if (m_w2->multisig()) throw std::runtime_error("This wallet is already multisig");
     if (m_w2->watch_only()) throw std::runtime_error("This wallet is view-only and cannot be made multisig");
     boost::lock_guard<boost::mutex> guarg(m_sync_mutex);  // do not refresh while making multisig
+    monero_state_lock state_lock(*this, true);
     monero_multisig_init_result result;
     result.m_multisig_hex = m_w2->make_multisig(epee::wipeable_string(password), multisig_hexes, threshold);
     result.m_address = m_w2->get_account().get_public_address_str(m_w2->nettype());
@@ -3182,6 +5357,7 @@ namespace monero {
 
     // do not refresh while exchanging multisig keys
     boost::lock_guard<boost::mutex> guarg(m_sync_mutex);
+    monero_state_lock state_lock(*this, true);
 
     // import peer multisig keys and get multisig hex to be shared next round
     std::string multisig_hex = m_w2->exchange_multisig_keys(epee::wipeable_string(password), multisig_hexes);
@@ -3220,6 +5396,8 @@ namespace monero {
 
     // import peer multisig hex
     int num_outputs = m_w2->import_multisig(multisig_blobs);
+    m_tx_index->invalidate(); // imported key images can add outgoing txs
+    m_balance_tracker->invalidate();
 
     // if daemon is trusted, rescan spent
     if (is_daemon_trusted()) rescan_spent();
@@ -3314,6 +5492,7 @@ namespace monero {
 
   void monero_wallet_full::change_password(const std::string& old_password, const std::string& new_password) {
     MTRACE("change_password(" << "***" << ", ***)");
+    monero_state_lock state_lock(*this, true);
     #if !defined(__EMSCRIPTEN__) // TODO: wallet2 verify_password loads from disk so password is verified in js for wasm
       if (!m_w2->verify_password(old_password)) throw std::runtime_error("Invalid original password.");
     #endif
@@ -3322,15 +5501,18 @@ namespace monero {
 
   void monero_wallet_full::move_to(const std::string& path, const std::string& password) {
     MTRACE("move_to(" << path << ", ***)");
+    monero_state_lock state_lock(*this, true);
     m_w2->store_to(path, password);
   }
 
   void monero_wallet_full::save() {
     MTRACE("save()");
+    monero_state_lock state_lock(*this, true);
     m_w2->store();
   }
 
   std::string monero_wallet_full::get_keys_file_buffer(const epee::wipeable_string& password, bool view_only) const {
+    monero_state_lock state_lock(*this, false);
     boost::optional<wallet2::keys_file_data> keys_file_data = m_w2->get_keys_file_data(password, view_only);
     std::string buf;
     ::serialization::dump_binary(keys_file_data.get(), buf);
@@ -3338,20 +5520,72 @@ namespace monero {
   }
 
   std::string monero_wallet_full::get_cache_file_buffer(const epee::wipeable_string& password) const {
+    monero_state_lock state_lock(*this, false);
     boost::optional<wallet2::cache_file_data> cache_file_data = m_w2->get_cache_file_data(password);
     std::string buf;
     ::serialization::dump_binary(cache_file_data.get(), buf);
     return buf;
   }
 
+  monero_compact_transfers monero_wallet_full::get_transfers_compact(const monero_transfer_query& query) const {
+    MTRACE("monero_wallet_full::get_transfers_compact(query)");
+    monero_state_lock state_lock(*this, false);
+    monero_compact_transfers result;
+    for_each_transfer(query, [&result](const std::shared_ptr<monero_transfer>& transfer) {
+      monero_compact_transfer compact_transfer;
+      compact_transfer.m_tx_idx = add_compact_tx(*transfer->m_tx, result.m_txs);
+      compact_transfer.m_account_index = transfer->m_account_index == boost::none ? 0 : *transfer->m_account_index;
+      compact_transfer.m_amount = transfer->m_amount == boost::none ? 0 : *transfer->m_amount;
+      compact_transfer.m_is_incoming = bool_equals(true, transfer->is_incoming());
+      compact_transfer.m_subaddress_indices_idx = result.m_subaddress_indices.size();
+      if (compact_transfer.m_is_incoming) {
+        std::shared_ptr<monero_incoming_transfer> incoming_transfer = std::static_pointer_cast<monero_incoming_transfer>(transfer);
+        if (incoming_transfer->m_subaddress_index != boost::none) result.m_subaddress_indices.push_back(*incoming_transfer->m_subaddress_index);
+      } else {
+        std::shared_ptr<monero_outgoing_transfer> outgoing_transfer = std::static_pointer_cast<monero_outgoing_transfer>(transfer);
+        result.m_subaddress_indices.insert(result.m_subaddress_indices.end(), outgoing_transfer->m_subaddress_indices.begin(), outgoing_transfer->m_subaddress_indices.end());
+      }
+      compact_transfer.m_num_subaddress_indices = result.m_subaddress_indices.size() - compact_transfer.m_subaddress_indices_idx;
+      result.m_transfers.push_back(compact_transfer);
+      return true;
+    });
+    result.m_txs.shrink_to_fit();
+    result.m_transfers.shrink_to_fit();
+    result.m_subaddress_indices.shrink_to_fit();
+    return result;
+  }
+
+  monero_compact_outputs monero_wallet_full::get_outputs_compact(const monero_output_query& query) const {
+    MTRACE("monero_wallet_full::get_outputs_compact(query)");
+    monero_state_lock state_lock(*this, false);
+    monero_compact_outputs result;
+    for_each_output(query, [&result](const std::shared_ptr<monero_output_wallet>& output) {
+      monero_compact_output compact_output;
+      compact_output.m_tx_idx = add_compact_tx(*std::static_pointer_cast<monero_tx_wallet>(output->m_tx), result.m_txs);
+      compact_output.m_account_index = output->m_account_index == boost::none ? 0 : *output->m_account_index;
+      compact_output.m_subaddress_index = output->m_subaddress_index == boost::none ? 0 : *output->m_subaddress_index;
+      compact_output.m_amount = output->m_amount == boost::none ? 0 : *output->m_amount;
+      compact_output.m_index = output->m_index == boost::none ? 0 : *output->m_index;
+      if (output->m_key_image != boost::none) to_hash32(output->m_key_image.get()->m_hex, compact_output.m_key_image);
+      to_hash32(output->m_stealth_public_key, compact_output.m_stealth_public_key);
+      compact_output.m_is_spent = bool_equals(true, output->m_is_spent);
+      compact_output.m_is_frozen = bool_equals(true, output->m_is_frozen);
+      result.m_outputs.push_back(compact_output);
+      return true;
+    });
+    result.m_txs.shrink_to_fit();
+    result.m_outputs.shrink_to_fit();
+    return result;
+  }
+
   void monero_wallet_full::close(bool save) {
     MTRACE("close()");
     stop_syncing(); // prevent sync thread from starting again
     if (save) this->save();
-    if (m_sync_loop_running) {
-      m_sync_cv.notify_one();
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));  // TODO: in emscripten, m_sync_cv.notify_one() returns without waiting, so sleep; bug in emscripten upstream llvm?
-      m_syncing_thread.join();
+    {
+      boost::mutex::scoped_lock lock(m_syncing_mutex);
+      for (const std::shared_ptr<monero_sync_handle>& sync_handle : m_pending_sync_handles) sync_handle->cancel();
+      while (m_sync_loop_running || !m_pending_sync_handles.empty()) m_sync_cv.wait(lock); // wait for running syncs
     }
     m_w2->stop();
     m_w2->deinit();
@@ -3375,15 +5609,193 @@ namespace monero {
     #endif
 
     // initialize internal state
+    m_tx_index = std::unique_ptr<monero_tx_index>(new monero_tx_index(*m_w2));
+    m_balance_tracker = std::unique_ptr<monero_balance_tracker>(new monero_balance_tracker(*m_w2));
     m_w2_listener = std::unique_ptr<wallet2_listener>(new wallet2_listener(*this, *m_w2));
     if (get_daemon_connection() == boost::none) m_is_connected = false;
     m_is_synced = false;
     m_rescan_on_sync = false;
     m_syncing_enabled = false;
     m_sync_loop_running = false;
+    m_sync_timer_id = 0;
+    m_sync_requested = false;
+    m_sync_retry_ms = 0;
+    m_query_arena_enabled = false;
+    m_save_rings_on_sync = true;
+    m_sync_progress_interval_blocks = 1;
+    m_sync_progress_interval_ms = 0;
+    m_ring_history_checked = false;
+    m_rings_saved_height = m_w2->get_blockchain_current_height();
+  }
+
+  void monero_wallet_full::for_each_window(uint64_t min_height, uint64_t max_height, bool include_unconfirmed, monero_sort_order sort_order, const boost::optional<monero_page_cursor>& start_cursor, const std::function<bool(const boost::optional<std::pair<uint64_t, uint64_t>>&)>& visit_window) const {
+
+    // skip windows before the resume cursor
+    bool include_confirmed = true;
+    if (start_cursor != boost::none) {
+      bool is_cursor_confirmed = start_cursor->m_height != std::numeric_limits<uint64_t>::max();
+      if (sort_order == ASCENDING) {
+        if (is_cursor_confirmed) min_height = std::max(min_height, start_cursor->m_height);
+        else include_confirmed = false;
+      } else if (is_cursor_confirmed) {
+        max_height = std::min(max_height, start_cursor->m_height);
+        include_unconfirmed = false;
+      }
+    }
+
+    // unconfirmed results sort first in descending order
+    if (sort_order == DESCENDING && include_unconfirmed && !visit_window(boost::none)) return;
+
+    // visit confirmed windows sized by the tx index
+    uint64_t height = get_height();
+    if (height == 0) include_confirmed = false;
+    else max_height = std::min(max_height, height - 1);
+    if (include_confirmed && min_height <= max_height) {
+      uint64_t from_height = sort_order == ASCENDING ? min_height : max_height;
+      while (true) {
+        uint64_t bound;
+        {
+          boost::lock_guard<boost::mutex> index_lock(m_tx_index->m_mutex);
+          m_tx_index->update();
+          bound = m_tx_index->get_window_bound(from_height, WINDOW_NUM_ROWS, sort_order);
+        }
+        if (sort_order == ASCENDING) {
+          uint64_t to_height = std::min(bound, max_height);
+          if (!visit_window(std::make_pair(from_height, to_height))) return;
+          if (to_height >= max_height) break;
+          from_height = to_height + 1;
+        } else {
+          uint64_t to_height = std::max(bound, min_height);
+          if (!visit_window(std::make_pair(to_height, from_height))) return;
+          if (to_height <= min_height) break;
+          from_height = to_height - 1;
+        }
+      }
+    }
+
+    // unconfirmed results sort last in ascending order
+    if (sort_order == ASCENDING && include_unconfirmed) visit_window(boost::none);
+  }
+
+  void monero_wallet_full::for_each_tx_aux(const monero_tx_query& query, const std::function<bool(const std::shared_ptr<monero_tx_wallet>&)>& visitor, monero_sort_order sort_order, const boost::optional<monero_page_cursor>& start_cursor, bool free_visited) const {
+    MTRACE("monero_wallet_full::for_each_tx_aux(query)");
+
+    // copy query once to narrow its height range per window
+    std::shared_ptr<monero_tx_query> window_query = copy_query(query);
+    uint64_t min_height = query.m_min_height == boost::none ? 0 : *query.m_min_height;
+    uint64_t max_height = query.m_max_height == boost::none ? CRYPTONOTE_MAX_BLOCK_NUMBER : *query.m_max_height;
+    if (query.m_height != boost::none) {
+      min_height = std::max(min_height, *query.m_height);
+      max_height = std::min(max_height, *query.m_height);
+    }
+    bool include_unconfirmed = query.m_min_height == boost::none && query.m_max_height == boost::none && query.m_height == boost::none && !bool_equals(true, query.m_is_confirmed);
+
+    // fetch, sort, and visit txs window by window, restoring the query's confirmation after the unconfirmed window
+    boost::optional<bool> is_confirmed = window_query->m_is_confirmed;
+    for_each_window(min_height, max_height, include_unconfirmed, sort_order, start_cursor, [&](const boost::optional<std::pair<uint64_t, uint64_t>>& window) {
+      if (window == boost::none) {
+        window_query->m_min_height = boost::none;
+        window_query->m_max_height = boost::none;
+        window_query->m_is_confirmed = false;
+      } else {
+        window_query->m_min_height = window->first;
+        window_query->m_max_height = window->second;
+        window_query->m_is_confirmed = is_confirmed;
+      }
+      std::vector<std::string> missing_tx_hashes;
+      std::vector<std::shared_ptr<monero_tx_wallet>> txs = get_txs_aux(window_query, missing_tx_hashes);
+      bool visited_all = visit_sorted(txs, visitor, sort_order);
+      if (free_visited) free_txs(txs);
+      return visited_all;
+    });
+  }
+
+  void monero_wallet_full::for_each_transfer_aux(const monero_transfer_query& query, const std::function<bool(const std::shared_ptr<monero_transfer>&)>& visitor, monero_sort_order sort_order, const boost::optional<monero_page_cursor>& start_cursor, bool free_visited) const {
+    MTRACE("monero_wallet_full::for_each_transfer_aux(query)");
+
+    // copy and normalize query once to narrow its height range per window
+    std::shared_ptr<monero_transfer_query> window_query = copy_query(query);
+    std::shared_ptr<monero_tx_query> tx_query = window_query->m_tx_query.get();
+
+    // fetch, sort, and visit transfers which meet the window query
+    auto visit_window_query = [&]() {
+      std::vector<std::shared_ptr<monero_transfer>> transfers = get_transfers(window_query);
+      bool visited_all = visit_sorted(transfers, visitor, sort_order);
+      if (free_visited) {
+        std::vector<std::shared_ptr<monero_tx_wallet>> txs;
+        for (const std::shared_ptr<monero_transfer>& transfer : transfers) if (transfer->m_tx != nullptr) txs.push_back(transfer->m_tx);
+        free_txs(txs);
+      }
+      return visited_all;
+    };
+
+    // queries by tx hash are small and fail on hashes outside a window, so fetch them at once
+    if (!tx_query->m_hashes.empty()) {
+      visit_window_query();
+    } else {
+      uint64_t min_height = tx_query->m_min_height == boost::none ? 0 : *tx_query->m_min_height;
+      uint64_t max_height = tx_query->m_max_height == boost::none ? CRYPTONOTE_MAX_BLOCK_NUMBER : *tx_query->m_max_height;
+      if (tx_query->m_height != boost::none) {
+        min_height = std::max(min_height, *tx_query->m_height);
+        max_height = std::min(max_height, *tx_query->m_height);
+      }
+      bool include_unconfirmed = tx_query->m_min_height == boost::none && tx_query->m_max_height == boost::none && tx_query->m_height == boost::none && !bool_equals(true, tx_query->m_is_confirmed);
+      boost::optional<bool> is_confirmed = tx_query->m_is_confirmed; // restored after the unconfirmed window
+      for_each_window(min_height, max_height, include_unconfirmed, sort_order, start_cursor, [&](const boost::optional<std::pair<uint64_t, uint64_t>>& window) {
+        if (window == boost::none) {
+          tx_query->m_min_height = boost::none;
+          tx_query->m_max_height = boost::none;
+          tx_query->m_is_confirmed = false;
+        } else {
+          tx_query->m_min_height = window->first;
+          tx_query->m_max_height = window->second;
+          tx_query->m_is_confirmed = is_confirmed;
+        }
+        return visit_window_query();
+      });
+    }
+    tx_query->m_transfer_query = boost::none; // break circular reference
+  }
+
+  void monero_wallet_full::for_each_output_aux(const monero_output_query& query, const std::function<bool(const std::shared_ptr<monero_output_wallet>&)>& visitor, monero_sort_order sort_order, const boost::optional<monero_page_cursor>& start_cursor, bool free_visited) const {
+    MTRACE("monero_wallet_full::for_each_output_aux(query)");
+
+    // copy and normalize query once to narrow its height range per window
+    std::shared_ptr<monero_output_query> window_query = copy_query(query);
+    std::shared_ptr<monero_tx_query> tx_query = window_query->m_tx_query.get();
+
+    // fetch, sort, and visit outputs which meet the window query
+    auto visit_window_query = [&]() {
+      std::vector<std::shared_ptr<monero_output_wallet>> outputs = get_outputs(window_query);
+      bool visited_all = visit_sorted(outputs, visitor, sort_order);
+      if (free_visited) {
+        std::vector<std::shared_ptr<monero_tx_wallet>> txs;
+        for (const std::shared_ptr<monero_output_wallet>& output : outputs) if (output->m_tx != nullptr) txs.push_back(std::static_pointer_cast<monero_tx_wallet>(output->m_tx));
+        free_txs(txs);
+      }
+      return visited_all;
+    };
+
+    // queries by tx hash are small and fail on hashes outside a window, so fetch them at once
+    if (!tx_query->m_hashes.empty()) {
+      visit_window_query();
+    } else {
+      uint64_t min_height = tx_query->m_min_height == boost::none ? 0 : *tx_query->m_min_height;
+      uint64_t max_height = tx_query->m_max_height == boost::none ? CRYPTONOTE_MAX_BLOCK_NUMBER : *tx_query->m_max_height;
+      if (tx_query->m_height != boost::none) {
+        min_height = std::max(min_height, *tx_query->m_height);
+        max_height = std::min(max_height, *tx_query->m_height);
+      }
+      for_each_window(min_height, max_height, false, sort_order, start_cursor, [&](const boost::optional<std::pair<uint64_t, uint64_t>>& window) { // outputs are always confirmed
+        tx_query->m_min_height = window->first;
+        tx_query->m_max_height = window->second;
+        return visit_window_query();
+      });
+    }
+    tx_query->m_output_query = boost::none; // break circular reference
   }
 
-  std::vector<std::shared_ptr<monero_transfer>> monero_wallet_full::get_transfers_aux(const monero_transfer_query& query) const {
+  std::vector<std::shared_ptr<monero_transfer>> monero_wallet_full::get_transfers_aux(const std::shared_ptr<monero_transfer_query>& _query, bool update_pool) const {
     MTRACE("monero_wallet_full::get_transfers(query)");
 
 //    // log query
@@ -3392,29 +5804,37 @@ namespace monero {
 //      else std::cout << "Transfer query's tx query rooted at [block]: " << (*(*query.m_tx_query)->m_block)->serialize() << std::endl;
 //    } else std::cout << "Transfer query: " << query.serialize() << std::endl;
 
-    // copy and normalize query
-    std::shared_ptr<monero_transfer_query> _query;
-    if (query.m_tx_query == boost::none) {
-      std::shared_ptr<monero_transfer_query> query_ptr = std::make_shared<monero_transfer_query>(query); // convert to shared pointer for copy  // TODO: does this copy unecessarily? copy constructor is not defined
-      _query = query_ptr->copy(query_ptr, std::make_shared<monero_transfer_query>());
-      _query->m_tx_query = std::make_shared<monero_tx_query>();
-      _query->m_tx_query.get()->m_transfer_query = _query;
-    } else {
-      std::shared_ptr<monero_tx_query> tx_query = query.m_tx_query.get()->copy(query.m_tx_query.get(), std::make_shared<monero_tx_query>());
-      _query = tx_query->m_transfer_query.get();
-    }
     std::shared_ptr<monero_tx_query> tx_query = _query->m_tx_query.get();
 
-    // build parameters for m_w2->get_payments()
-    uint64_t min_height = tx_query->m_min_height == boost::none ? 0 : *tx_query->m_min_height;
-    uint64_t max_height = tx_query->m_max_height == boost::none ? CRYPTONOTE_MAX_BLOCK_NUMBER : std::min((uint64_t) CRYPTONOTE_MAX_BLOCK_NUMBER, *tx_query->m_max_height);
-    if (min_height > 0) min_height--; // TODO monero-project: wallet2::get_payments() m_min_height is exclusive, so manually offset to match intended range (issues #5751, #5598)
+    // allocate the query's models from one arena if enabled
+    model_factory factory;
+    if (m_query_arena_enabled) factory.m_arena = std::make_shared<monero_query_arena>();
+
+    // build parameters for m_w2->get_unconfirmed_payments() and the tx index
     boost::optional<uint32_t> account_index = boost::none;
     if (_query->m_account_index != boost::none) account_index = *_query->m_account_index;
     std::set<uint32_t> subaddress_indices;
     for (int i = 0; i < _query->m_subaddress_indices.size(); i++) {
       subaddress_indices.insert(_query->m_subaddress_indices[i]);
     }
+    monero_tx_index::index_query index_query;
+    if (tx_query->m_min_height != boost::none) index_query.m_min_height = *tx_query->m_min_height;
+    if (tx_query->m_max_height != boost::none) index_query.m_max_height = std::min((uint64_t) CRYPTONOTE_MAX_BLOCK_NUMBER, *tx_query->m_max_height);
+    if (tx_query->m_height != boost::none) {
+      index_query.m_min_height = std::max(index_query.m_min_height, *tx_query->m_height);
+      index_query.m_max_height = std::min(index_query.m_max_height, *tx_query->m_height);
+    }
+    index_query.m_account_index = account_index;
+    index_query.m_subaddress_indices = subaddress_indices;
+
+    // parse tx hashes to filter once
+    bool filter_hashes = !tx_query->m_hashes.empty();
+    std::unordered_set<crypto::hash> tx_hashes;
+    if (filter_hashes) {
+      parse_tx_hashes(tx_query->m_hashes, tx_hashes);
+      index_query.m_filter_hashes = true;
+      index_query.m_hashes.assign(tx_hashes.begin(), tx_hashes.end());
+    }
 
     // check if pool txs explicitly requested without daemon connection
     if (tx_query->m_in_tx_pool != boost::none && tx_query->m_in_tx_pool.get() && !is_connected_to_daemon()) {
@@ -3442,8 +5862,8 @@ namespace monero {
       std::list<std::pair<crypto::hash, tools::wallet2::unconfirmed_transfer_details>> upayments;
       m_w2->get_unconfirmed_payments_out(upayments, account_index, subaddress_indices);
       for (std::list<std::pair<crypto::hash, tools::wallet2::unconfirmed_transfer_details>>::const_iterator i = upayments.begin(); i != upayments.end(); ++i) {
-        if (!tx_query->m_hashes.empty() && std::find(tx_query->m_hashes.begin(), tx_query->m_hashes.end(), epee::string_tools::pod_to_hex(i->first)) == tx_query->m_hashes.end()) continue; // skip if hash filtered
-        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_outgoing_transfer_unconfirmed(*m_w2, i->first, i->second);
+        if (filter_hashes && tx_hashes.count(i->first) == 0) continue; // skip if hash filtered
+        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_outgoing_transfer_unconfirmed(*m_w2, i->first, i->second, factory);
         if (tx_query->m_is_failed != boost::none && tx_query->m_is_failed.get() != tx->m_is_failed.get()) continue; // skip if failure filtered
         merge_tx(tx, tx_map, block_map);
       }
@@ -3453,38 +5873,36 @@ namespace monero {
     if (is_pool) {
 
       // update pool state TODO monero-project: this should be encapsulated in wallet when unconfirmed transfers queried
-      std::vector<std::tuple<cryptonote::transaction, crypto::hash, bool>> process_txs;
-      m_w2->update_pool_state(process_txs);
-      if (!process_txs.empty()) m_w2->process_pool_state(process_txs);
+      if (update_pool) {
+        std::vector<std::tuple<cryptonote::transaction, crypto::hash, bool>> process_txs;
+        m_w2->update_pool_state(process_txs);
+        if (!process_txs.empty()) m_w2->process_pool_state(process_txs);
+      }
 
       std::list<std::pair<crypto::hash, tools::wallet2::pool_payment_details>> payments;
       m_w2->get_unconfirmed_payments(payments, account_index, subaddress_indices);
       for (std::list<std::pair<crypto::hash, tools::wallet2::pool_payment_details>>::const_iterator i = payments.begin(); i != payments.end(); ++i) {
-        if (!tx_query->m_hashes.empty() && std::find(tx_query->m_hashes.begin(), tx_query->m_hashes.end(), epee::string_tools::pod_to_hex(i->second.m_pd.m_tx_hash)) == tx_query->m_hashes.end()) continue; // skip if hash filtered
-        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_incoming_transfer_unconfirmed(*m_w2, height, i->first, i->second);
+        if (filter_hashes && tx_hashes.count(i->second.m_pd.m_tx_hash) == 0) continue; // skip if hash filtered
+        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_incoming_transfer_unconfirmed(*m_w2, height, i->first, i->second, factory);
         merge_tx(tx, tx_map, block_map);
       }
     }
 
-    // get confirmed incoming transfers
-    if (is_in) {
-      std::list<std::pair<crypto::hash, tools::wallet2::payment_details>> payments;
-      m_w2->get_payments(payments, min_height, max_height, account_index, subaddress_indices);
-      for (std::list<std::pair<crypto::hash, tools::wallet2::payment_details>>::const_iterator i = payments.begin(); i != payments.end(); ++i) {
-        if (!tx_query->m_hashes.empty() && std::find(tx_query->m_hashes.begin(), tx_query->m_hashes.end(), epee::string_tools::pod_to_hex(i->second.m_tx_hash)) == tx_query->m_hashes.end()) continue; // skip if hash filtered
-        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_incoming_transfer(*m_w2, height, i->first, i->second);
-        merge_tx(tx, tx_map, block_map);
+    // get confirmed incoming and outgoing transfers from the tx index
+    if (is_in || is_out) {
+      boost::lock_guard<boost::mutex> index_lock(m_tx_index->m_mutex);
+      m_tx_index->update();
+      if (is_in) {
+        m_tx_index->for_each_incoming(index_query, [&](const monero_tx_index::incoming_row& row) {
+          std::shared_ptr<monero_tx_wallet> tx = build_tx_with_incoming_transfer(*m_w2, height, row, factory);
+          merge_tx(tx, tx_map, block_map);
+        });
       }
-    }
-
-    // get confirmed outgoing transfers
-    if (is_out) {
-      std::list<std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>> payments;
-      m_w2->get_payments_out(payments, min_height, max_height, account_index, subaddress_indices);
-      for (std::list<std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>>::const_iterator i = payments.begin(); i != payments.end(); ++i) {
-        if (!tx_query->m_hashes.empty() && std::find(tx_query->m_hashes.begin(), tx_query->m_hashes.end(), epee::string_tools::pod_to_hex(i->first)) == tx_query->m_hashes.end()) continue; // skip if hash filtered
-        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_outgoing_transfer(*m_w2, height, i->first, i->second);
-        merge_tx(tx, tx_map, block_map);
+      if (is_out) {
+        m_tx_index->for_each_outgoing(index_query, [&](const monero_tx_index::outgoing_row& row) {
+          std::shared_ptr<monero_tx_wallet> tx = build_tx_with_outgoing_transfer(*m_w2, height, row, factory);
+          merge_tx(tx, tx_map, block_map);
+        });
       }
     }
 
@@ -3495,7 +5913,8 @@ namespace monero {
     }
     sort(txs.begin(), txs.end(), tx_height_less_than);
 
-    // filter and return transfers
+    // filter and return transfers, evaluating the tx query once per tx and skipping tx hashes which are applied above
+    monero_tx_query_plan tx_plan(*tx_query, monero_tx_query_plan::PUSHDOWN_HASHES, false);
     std::vector<std::shared_ptr<monero_transfer>> transfers;
     for (const std::shared_ptr<monero_tx_wallet>& tx : txs) {
 
@@ -3507,7 +5926,22 @@ namespace monero {
       sort(tx->m_incoming_transfers.begin(), tx->m_incoming_transfers.end(), incoming_transfer_before);
 
       // collect queried transfers, erase if excluded
-      for (const std::shared_ptr<monero_transfer>& transfer : tx->filter_transfers(*_query)) transfers.push_back(transfer);
+      if (!tx_plan.matches(*tx)) {
+        tx->m_outgoing_transfer = boost::none;
+        tx->m_incoming_transfers.clear();
+      } else {
+        if (tx->m_outgoing_transfer != boost::none && _query->meets_criteria(tx->m_outgoing_transfer.get().get(), false)) transfers.push_back(tx->m_outgoing_transfer.get());
+        else tx->m_outgoing_transfer = boost::none;
+        std::vector<std::shared_ptr<monero_incoming_transfer>>::iterator iter = tx->m_incoming_transfers.begin();
+        while (iter != tx->m_incoming_transfers.end()) {
+          if (_query->meets_criteria(iter->get(), false)) {
+            transfers.push_back(*iter);
+            iter++;
+          } else {
+            iter = tx->m_incoming_transfers.erase(iter);
+          }
+        }
+      }
 
       // remove excluded txs from block
       if (tx->m_block != boost::none && tx->m_outgoing_transfer == boost::none && tx->m_incoming_transfers.empty()) {
@@ -3515,11 +5949,12 @@ namespace monero {
       }
     }
     MTRACE("monero_wallet_full.cpp get_transfers() returning " << transfers.size() << " transfers");
+    if (factory.m_arena != nullptr) MTRACE("monero_wallet_full.cpp get_transfers() allocated " << factory.m_arena->get_num_allocations() << " models in " << factory.m_arena->get_num_chunks() << " arena chunks");
 
     return transfers;
   }
 
-  std::vector<std::shared_ptr<monero_output_wallet>> monero_wallet_full::get_outputs_aux(const monero_output_query& query) const {
+  std::vector<std::shared_ptr<monero_output_wallet>> monero_wallet_full::get_outputs_aux(const std::shared_ptr<monero_output_query>& _query) const {
     MTRACE("monero_wallet_full::get_outputs_aux(query)");
 
 //    // log query
@@ -3528,35 +5963,24 @@ namespace monero {
 //      else std::cout << "Output query's tx query rooted at [block]: " << (*(*query.m_tx_query)->m_block)->serialize() << std::endl;
 //    } else std::cout << "Output query: " << query.serialize() << std::endl;
 
-    // copy and normalize query
-    std::shared_ptr<monero_output_query> _query;
-    if (query.m_tx_query == boost::none) {
-      std::shared_ptr<monero_output_query> query_ptr = std::make_shared<monero_output_query>(query); // convert to shared pointer for copy
-      _query = query_ptr->copy(query_ptr, std::make_shared<monero_output_query>());
-    } else {
-      std::shared_ptr<monero_tx_query> tx_query = query.m_tx_query.get()->copy(query.m_tx_query.get(), std::make_shared<monero_tx_query>());
-      if (query.m_tx_query.get()->m_output_query != boost::none && query.m_tx_query.get()->m_output_query.get().get() == &query) {
-        _query = tx_query->m_output_query.get();
-      } else {
-        if (query.m_tx_query.get()->m_output_query != boost::none) throw std::runtime_error("Output query's tx query must be a circular reference or null");
-        std::shared_ptr<monero_output_query> query_ptr = std::make_shared<monero_output_query>(query);  // convert query to shared pointer for copy
-        _query = query_ptr->copy(query_ptr, std::make_shared<monero_output_query>());
-        _query->m_tx_query = tx_query;
-      }
-    }
-    if (_query->m_tx_query == boost::none) _query->m_tx_query = std::make_shared<monero_tx_query>();
-
-    // get output data from wallet2
-    tools::wallet2::transfer_container outputs_w2;
-    m_w2->get_transfers(outputs_w2);
+    // allocate the query's models from one arena if enabled
+    model_factory factory;
+    if (m_query_arena_enabled) factory.m_arena = std::make_shared<monero_query_arena>();
 
-    // cache unique txs and blocks
+    // cache unique txs and blocks of outputs which pass cheap criteria, reading wallet2's transfers in place
+    output_prefilter prefilter(*_query);
+    std::vector<std::string> tx_hashes;
+    tx_hashes.swap(_query->m_tx_query.get()->m_hashes); // tx hashes are applied by the prefilter
     std::map<std::string, std::shared_ptr<monero_tx_wallet>> tx_map;
     std::map<uint64_t, std::shared_ptr<monero_block>> block_map;
-    for (const auto& output_w2 : outputs_w2) {
-      // TODO: skip tx building if m_w2 output excluded by indices, etc
-      std::shared_ptr<monero_tx_wallet> tx = build_tx_with_vout(*m_w2, output_w2);
-      merge_tx(tx, tx_map, block_map);
+    if (!prefilter.excludes_all()) {
+      size_t num_outputs = m_w2->get_num_transfer_details();
+      for (size_t idx = 0; idx < num_outputs; idx++) {
+        const tools::wallet2::transfer_details& output_w2 = m_w2->get_transfer_details(idx);
+        if (prefilter.excludes(output_w2)) continue;
+        std::shared_ptr<monero_tx_wallet> tx = build_tx_with_vout(*m_w2, output_w2, factory);
+        merge_tx(tx, tx_map, block_map);
+      }
     }
 
     // sort txs by block height
@@ -3579,16 +6003,16 @@ namespace monero {
       // remove txs without outputs
       if (tx->m_outputs.empty() && tx->m_block != boost::none) tx->m_block.get()->m_txs.erase(std::remove(tx->m_block.get()->m_txs.begin(), tx->m_block.get()->m_txs.end(), tx), tx->m_block.get()->m_txs.end()); // TODO, no way to use const_iterator?
     }
+    _query->m_tx_query.get()->m_hashes.swap(tx_hashes);
     return outputs;
   }
 
-  // private helper to initialize subaddresses using transfer details
-  std::vector<monero_subaddress> monero_wallet_full::get_subaddresses_aux(const uint32_t account_idx, const std::vector<uint32_t>& subaddress_indices, const std::vector<tools::wallet2::transfer_details>& transfers) const {
+  // private helper to initialize subaddresses using tracked output statistics
+  std::vector<monero_subaddress> monero_wallet_full::get_subaddresses_aux(const uint32_t account_idx, const std::vector<uint32_t>& subaddress_indices) const {
     std::vector<monero_subaddress> subaddresses;
 
-    // get balances per subaddress as maps
-    std::map<uint32_t, uint64_t> balance_per_subaddress = m_w2->balance_per_subaddress(account_idx, STRICT);
-    std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> unlocked_balance_per_subaddress = m_w2->unlocked_balance_per_subaddress(account_idx, STRICT);
+    // get blocks to unlock per subaddress from the tracked locked outputs
+    std::map<uint32_t, uint64_t> blocks_to_unlock = m_balance_tracker->get_blocks_to_unlock(account_idx);
 
     // get all indices if no indices given
     std::vector<uint32_t> subaddress_indices_req;
@@ -3608,14 +6032,16 @@ namespace monero {
       subaddress.m_index = subaddress_idx;
       subaddress.m_address = get_address(account_idx, subaddress_idx);
       subaddress.m_label = m_w2->get_subaddress_label({account_idx, subaddress_idx});
-      auto iter1 = balance_per_subaddress.find(subaddress_idx);
-      subaddress.m_balance = iter1 == balance_per_subaddress.end() ? 0 : iter1->second;
-      auto iter2 = unlocked_balance_per_subaddress.find(subaddress_idx);
-      subaddress.m_unlocked_balance = iter2 == unlocked_balance_per_subaddress.end() ? 0 : iter2->second.first;
-      cryptonote::subaddress_index index = {account_idx, subaddress_idx};
-      subaddress.m_num_unspent_outputs = count_if(transfers.begin(), transfers.end(), [&](const tools::wallet2::transfer_details& td) { return !td.m_spent && td.m_subaddr_index == index; });
-      subaddress.m_is_used = find_if(transfers.begin(), transfers.end(), [&](const tools::wallet2::transfer_details& td) { return td.m_subaddr_index == index; }) != transfers.end();
-      subaddress.m_num_blocks_to_unlock = iter1 == balance_per_subaddress.end() ? 0 : iter2->second.second.first;
+      monero_balance_tracker::balances subaddress_balances = m_balance_tracker->get_balances(account_idx, subaddress_idx);
+      subaddress.m_balance = subaddress_balances.m_balance;
+      subaddress.m_unlocked_balance = subaddress_balances.m_unlocked_balance;
+      monero_balance_tracker::subaddress_stats stats = m_balance_tracker->get_subaddress_stats(account_idx, subaddress_idx);
+      subaddress.m_num_unspent_outputs = stats.m_num_unspent_outputs;
+      subaddress.m_is_used = stats.m_num_outputs > 0;
+      subaddress.m_first_seen_height = stats.m_first_height;
+      subaddress.m_last_seen_height = stats.m_last_height;
+      std::map<uint32_t, uint64_t>::const_iterator iter = blocks_to_unlock.find(subaddress_idx);
+      subaddress.m_num_blocks_to_unlock = iter == blocks_to_unlock.end() ? 0 : iter->second;
       subaddresses.push_back(subaddress);
     }
 
@@ -3623,53 +6049,133 @@ namespace monero {
   }
 
   void monero_wallet_full::run_sync_loop() {
+    boost::lock_guard<boost::mutex> lock(m_syncing_mutex);
     if (m_sync_loop_running) return;  // only run one loop at a time
     m_sync_loop_running = true;
+    schedule_sync(0);
+  }
 
-    // start sync loop thread
-    // TODO: use global threadpool, background sync wasm wallet in c++ thread
-    m_syncing_thread = boost::thread([this]() {
+  void monero_wallet_full::schedule_sync(uint64_t delay_ms) {
+    m_sync_requested = false;
+    m_sync_timer_id = monero_scheduler::get_instance().schedule(delay_ms, [this]() {
 
-      // sync while enabled
-      while (m_syncing_enabled) {
+      // sync if enabled
+      uint64_t wait_for_ms = 0;
+      bool is_failed = false;
+      if (m_syncing_enabled) {
         auto start = std::chrono::system_clock::now();
         try { lock_and_sync(); }
-        catch (std::exception const& e) { std::cout << "monero_wallet_full failed to background synchronize: " << e.what() << std::endl; }
-        catch (...) { std::cout << "monero_wallet_full failed to background synchronize" << std::endl; }
-
-        // only wait if syncing still enabled
-        if (m_syncing_enabled) {
-          boost::mutex::scoped_lock lock(m_syncing_mutex);
-          boost::posix_time::milliseconds wait_for_ms(m_syncing_interval.load());
-          boost::posix_time::milliseconds elapsed_time = boost::posix_time::milliseconds(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start).count());
-          m_sync_cv.timed_wait(lock, elapsed_time > wait_for_ms ? boost::posix_time::milliseconds(0) : wait_for_ms - elapsed_time); // target regular sync period by accounting for sync time
-        }
+        catch (std::exception const& e) { is_failed = true; std::cout << "monero_wallet_full failed to background synchronize: " << e.what() << std::endl; }
+        catch (...) { is_failed = true; std::cout << "monero_wallet_full failed to background synchronize" << std::endl; }
+        uint64_t elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start).count();
+        wait_for_ms = elapsed_ms > (uint64_t) m_syncing_interval.load() ? 0 : m_syncing_interval.load() - elapsed_ms; // target regular sync period by accounting for sync time
       }
 
-      m_sync_loop_running = false;
+      // back off retries after errors when syncing adaptively
+      uint64_t sync_interval = m_syncing_interval.load();
+      m_sync_retry_ms = is_failed ? std::min(std::max(m_sync_retry_ms.load() * 2, sync_interval), std::max(DAEMON_POLL_MAX_BACKOFF_MS, sync_interval)) : 0;
+
+      // schedule next sync while enabled, or wait for daemon changes if adaptive
+      boost::lock_guard<boost::mutex> lock(m_syncing_mutex);
+      if (m_syncing_enabled && !m_syncing_adaptive) schedule_sync(wait_for_ms);
+      else if (m_syncing_enabled && is_failed) schedule_sync(m_sync_retry_ms);
+      else if (m_syncing_enabled && m_sync_requested) schedule_sync(0);
+      else {
+        m_sync_loop_running = false;
+        m_sync_cv.notify_all();
+      }
     });
   }
 
-  monero_sync_result monero_wallet_full::lock_and_sync(boost::optional<uint64_t> start_height) {
+  void monero_wallet_full::request_sync() {
+    boost::lock_guard<boost::mutex> lock(m_syncing_mutex);
+    if (!m_syncing_enabled) return;
+    if (m_sync_loop_running) m_sync_requested = true; // sync again after current sync
+    else {
+      m_sync_loop_running = true;
+      schedule_sync(0);
+    }
+  }
+
+  void monero_wallet_full::update_daemon_poller() {
+    boost::lock_guard<boost::mutex> lock(m_daemon_poller_mutex);
+
+    // unsubscribe from previous poller
+    if (m_daemon_poller_subscription_id != boost::none) {
+      m_daemon_poller->unsubscribe(*m_daemon_poller_subscription_id);
+      m_daemon_poller_subscription_id = boost::none;
+    }
+
+    // share poller of daemon connection
+    if (m_w2->get_daemon_address().empty()) m_daemon_poller.reset();
+    else m_daemon_poller = monero_daemon_poller::get(*m_http_client_factory, m_w2->get_daemon_address(), m_w2->get_daemon_login(), m_daemon_ssl_support, m_daemon_proxy);
+
+    // subscribe to daemon changes if syncing adaptively
+    if (m_daemon_poller != nullptr && m_syncing_adaptive && m_syncing_enabled) m_daemon_poller_subscription_id = m_daemon_poller->subscribe(m_syncing_interval, [this]() { request_sync(); });
+  }
+
+  std::shared_ptr<monero_daemon_poller> monero_wallet_full::get_daemon_poller() const {
+    boost::lock_guard<boost::mutex> lock(m_daemon_poller_mutex);
+    return m_daemon_poller;
+  }
+
+  monero_sync_result monero_wallet_full::lock_and_sync(boost::optional<uint64_t> start_height, const std::shared_ptr<monero_sync_handle>& sync_handle) {
     bool rescan = m_rescan_on_sync.exchange(false);
     boost::lock_guard<boost::mutex> guarg(m_sync_mutex); // synchronize sync() and syncAsync()
     monero_sync_result result;
     result.m_num_blocks_fetched = 0;
     result.m_received_money = false;
-    do {
-      // skip if daemon is not connected or synced
-      if (m_is_connected && is_daemon_synced()) {
 
-        // rescan blockchain if requested
-        if (rescan) m_w2->rescan_blockchain(false);
+    // skip background sync if cancelled while waiting
+    if (sync_handle != nullptr && sync_handle->is_cancelled()) {
+      if (rescan) m_rescan_on_sync = true;
+      return result;
+    }
+
+    // lock wallet state, yielding to queries between blocks
+    monero_state_lock state_lock(*this, true, true);
+    monero_state_lock* prev_sync_state_lock = m_sync_state_lock;
+    m_sync_state_lock = &state_lock;
 
-        // sync wallet
-        result = sync_aux(start_height);
-      }
-    } while (!rescan && (rescan = m_rescan_on_sync.exchange(false))); // repeat if not rescanned and rescan was requested
+    // report progress to background sync's handle
+    if (sync_handle != nullptr) {
+      boost::lock_guard<boost::mutex> lock(m_sync_handle_mutex);
+      m_sync_handle = sync_handle;
+    }
+    try {
+      do {
+        // skip if daemon is not connected or synced
+        if (m_is_connected && is_daemon_synced()) {
+
+          // rescan blockchain if requested
+          if (rescan) {
+            m_w2->rescan_blockchain(false);
+            m_tx_index->invalidate();
+            m_balance_tracker->invalidate();
+            m_state_revision++;
+          }
+
+          // sync wallet
+          result = sync_aux(start_height);
+        }
+      } while (!rescan && (rescan = m_rescan_on_sync.exchange(false))); // repeat if not rescanned and rescan was requested
+    } catch (...) {
+      m_sync_state_lock = prev_sync_state_lock;
+      boost::lock_guard<boost::mutex> lock(m_sync_handle_mutex);
+      m_sync_handle.reset();
+      throw;
+    }
+    m_sync_state_lock = prev_sync_state_lock;
+    boost::lock_guard<boost::mutex> lock(m_sync_handle_mutex);
+    m_sync_handle.reset();
     return result;
   }
 
+  std::shared_ptr<monero_sync_handle> monero_wallet_full::get_sync_handle() const {
+    boost::lock_guard<boost::mutex> lock(m_sync_handle_mutex);
+    return m_sync_handle;
+  }
+
   monero_sync_result monero_wallet_full::sync_aux(boost::optional<uint64_t> start_height) {
     MTRACE("sync_aux()");
 
@@ -3678,24 +6184,161 @@ namespace monero {
     if (sync_start_height < get_sync_height()) set_sync_height(sync_start_height); // TODO monero-project: start height processed > requested start height unless sync height manually std::set
 
     // notify listeners of sync start
+    sync_counters start_counters = get_sync_counters();
     m_w2_listener->on_sync_start(sync_start_height);
+    m_w2_listener->reset_max_notification_queue_depth();
+    m_w2_listener->reset_min_block_height();
     monero_sync_result result;
 
     // attempt to refresh wallet2 which may throw exception
+    sync_counters refresh_start_counters = get_sync_counters();
     try {
       m_w2->refresh(m_w2->is_trusted_daemon(), sync_start_height, result.m_num_blocks_fetched, result.m_received_money, true);
       if (!m_is_synced) m_is_synced = true;
       m_w2_listener->update_listening();  // cannot unregister during sync which would segfault
     } catch (std::exception& e) {
       m_w2_listener->on_sync_end(); // signal end of sync to reset listener's start and end heights
+      boost::lock_guard<boost::mutex> lock(m_sync_stats_mutex);
+      m_sync_stats.m_num_failed_syncs++;
       throw;
     }
+    sync_counters refresh_end_counters = get_sync_counters();
 
-    // find and save rings
-    m_w2->find_and_save_rings(false);
+    // save rings of new outgoing txs, including txs in blocks re-processed after a reorg
+    uint64_t min_block_height = m_w2_listener->reset_min_block_height();
+    if (m_save_rings_on_sync) result.m_num_rings_saved = save_rings(std::min(m_rings_saved_height, min_block_height));
+    sync_counters rings_end_counters = get_sync_counters();
 
     // notify listeners of sync end and check for updated funds
     m_w2_listener->on_sync_end();
+    sync_counters end_counters = get_sync_counters();
+
+    // measure time spent in each stage
+    monero_sync_timings& timings = result.m_timings;
+    timings.m_fetch_ms = (end_counters.m_fetch_us - start_counters.m_fetch_us) / 1000;
+    timings.m_num_fetches = end_counters.m_num_fetches - start_counters.m_num_fetches;
+    timings.m_rpc_ms = (end_counters.m_rpc_us - start_counters.m_rpc_us) / 1000;
+    timings.m_num_rpcs = end_counters.m_num_rpcs - start_counters.m_num_rpcs;
+    timings.m_refresh_ms = (refresh_end_counters.m_time_us - refresh_start_counters.m_time_us) / 1000;
+    int64_t refresh_other_us = (int64_t) (refresh_end_counters.m_notify_us - refresh_start_counters.m_notify_us) + (int64_t) (refresh_end_counters.m_rpc_us - refresh_start_counters.m_rpc_us) - (int64_t) (refresh_end_counters.m_fetch_us - refresh_start_counters.m_fetch_us); // notifications and requests on the refresh thread
+    timings.m_scan_ms = timings.m_refresh_ms - std::min(timings.m_refresh_ms, (uint64_t) std::max((int64_t) 0, refresh_other_us) / 1000);
+    timings.m_rings_ms = (rings_end_counters.m_time_us - refresh_end_counters.m_time_us) / 1000;
+    timings.m_notify_ms = (end_counters.m_notify_us - start_counters.m_notify_us) / 1000;
+    timings.m_total_ms = (end_counters.m_time_us - start_counters.m_time_us) / 1000;
+
+    // measure throughput
+    result.m_num_txs_scanned = end_counters.m_num_txs_scanned - start_counters.m_num_txs_scanned;
+    result.m_bytes_received = end_counters.m_bytes_received - start_counters.m_bytes_received;
+    result.m_bytes_sent = end_counters.m_bytes_sent - start_counters.m_bytes_sent;
+    if (timings.m_refresh_ms > 0) {
+      result.m_blocks_per_second = result.m_num_blocks_fetched * 1000.0 / timings.m_refresh_ms;
+      result.m_txs_per_second = result.m_num_txs_scanned * 1000.0 / timings.m_refresh_ms;
+    }
+    result.m_max_notification_queue_depth = m_w2_listener->reset_max_notification_queue_depth();
+
+    // record sync in cumulative stats
+    {
+      boost::lock_guard<boost::mutex> lock(m_sync_stats_mutex);
+      m_sync_stats.m_num_syncs++;
+      m_sync_stats.m_num_blocks_fetched += result.m_num_blocks_fetched;
+      m_sync_stats.m_num_txs_scanned += result.m_num_txs_scanned;
+      m_sync_stats.m_bytes_received += result.m_bytes_received;
+      m_sync_stats.m_bytes_sent += result.m_bytes_sent;
+      m_sync_stats.m_num_rings_saved += result.m_num_rings_saved;
+      m_sync_stats.m_max_notification_queue_depth = std::max(m_sync_stats.m_max_notification_queue_depth, result.m_max_notification_queue_depth);
+      m_sync_stats.m_timings.add(timings);
+      m_sync_stats.m_last_result = result;
+    }
+
+    // notify listeners of time spent in each stage
+    m_w2_listener->on_sync_timings(timings);
+
+    // publish snapshot of synced state
+    track_pool_changes();
+    publish_snapshot();
     return result;
   }
+
+  uint64_t monero_wallet_full::save_rings(uint64_t from_height) {
+    MTRACE("save_rings(" << from_height << ")");
+
+    // save rings of txs before the wallet was opened once, which wallet2 skips if already saved
+    if (!m_ring_history_checked) {
+      m_w2->find_and_save_rings(false);
+      m_ring_history_checked = true;
+    }
+
+    // save rings of outgoing txs confirmed since, as recorded by wallet2 when scanned
+    uint64_t height = m_w2->get_blockchain_current_height();
+    std::list<std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>> payments;
+    if (from_height < height && !m_w2->get_ring_database().empty()) m_w2->get_payments_out(payments, from_height == 0 ? 0 : from_height - 1); // exclusive min height
+    for (const std::pair<crypto::hash, tools::wallet2::confirmed_transfer_details>& payment : payments) {
+      for (const std::pair<crypto::key_image, std::vector<uint64_t>>& ring : payment.second.m_rings) {
+        if (!m_w2->set_ring(ring.first, ring.second, true)) MWARNING("Failed to save ring of tx " << epee::string_tools::pod_to_hex(payment.first));
+      }
+    }
+    m_rings_saved_height = height;
+    return payments.size();
+  }
+
+  monero_wallet_full::sync_counters monero_wallet_full::get_sync_counters() const {
+    sync_counters counters;
+    counters.m_time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    counters.m_rpc_us = m_rpc_timer->m_rpc_us;
+    counters.m_num_rpcs = m_rpc_timer->m_num_rpcs;
+    counters.m_fetch_us = m_rpc_timer->m_fetch_us;
+    counters.m_num_fetches = m_rpc_timer->m_num_fetches;
+    counters.m_bytes_received = m_rpc_timer->m_bytes_received;
+    counters.m_bytes_sent = m_rpc_timer->m_bytes_sent;
+    counters.m_notify_us = m_w2_listener->get_notify_us();
+    counters.m_num_txs_scanned = m_w2_listener->get_num_txs_scanned();
+    return counters;
+  }
+
+  void monero_wallet_full::publish_snapshot() const {
+    MTRACE("publish_snapshot()");
+    boost::lock_guard<boost::mutex> lock(m_snapshot_mutex);
+
+    // keep published snapshot if the wallet is unchanged
+    std::shared_ptr<const monero_wallet_snapshot> snapshot = std::atomic_load(&m_snapshot);
+    if (snapshot != nullptr && snapshot->m_height == m_w2->get_blockchain_current_height() && snapshot->m_revision == m_state_revision) return;
+    std::atomic_store(&m_snapshot, build_snapshot());
+  }
+
+  std::shared_ptr<const monero_wallet_snapshot> monero_wallet_full::build_snapshot() const {
+    std::shared_ptr<monero_wallet_snapshot> snapshot = std::make_shared<monero_wallet_snapshot>();
+    snapshot->m_height = m_w2->get_blockchain_current_height();
+    snapshot->m_revision = m_state_revision;
+    monero_balance_tracker::balances balances = m_balance_tracker->get_balances();
+    snapshot->m_balance = balances.m_balance;
+    snapshot->m_unlocked_balance = balances.m_unlocked_balance;
+    snapshot->m_accounts = get_accounts(true, "");
+
+    // build transfers from the tx index and the pool state of the last sync
+    std::vector<std::shared_ptr<monero_transfer>> transfers = get_transfers_aux(normalize_query(monero_transfer_query()), false);
+    snapshot->m_transfers.assign(transfers.begin(), transfers.end());
+    std::vector<std::shared_ptr<monero_output_wallet>> outputs = get_outputs_aux(normalize_query(monero_output_query()));
+    snapshot->m_outputs.assign(outputs.begin(), outputs.end());
+    return snapshot;
+  }
+
+  void monero_wallet_full::track_pool_changes() {
+    std::vector<std::pair<crypto::hash, int>> pool_state;
+    std::list<std::pair<crypto::hash, tools::wallet2::unconfirmed_transfer_details>> upayments;
+    m_w2->get_unconfirmed_payments_out(upayments);
+    for (const auto& upayment : upayments) pool_state.push_back(std::make_pair(upayment.first, (int) upayment.second.m_state));
+    std::list<std::pair<crypto::hash, tools::wallet2::pool_payment_details>> payments;
+    m_w2->get_unconfirmed_payments(payments);
+    for (const auto& payment : payments) pool_state.push_back(std::make_pair(payment.second.m_pd.m_tx_hash, payment.second.m_double_spend_seen ? -2 : -1)); // incoming states are negative
+    std::sort(pool_state.begin(), pool_state.end(), [](const std::pair<crypto::hash, int>& state1, const std::pair<crypto::hash, int>& state2) {
+      int cmp = memcmp(&state1.first, &state2.first, sizeof(crypto::hash));
+      return cmp < 0 || (cmp == 0 && state1.second < state2.second);
+    });
+
+    // unconfirmed txs which were dropped from the pool or failed have no callbacks
+    if (pool_state != m_pool_state) {
+      m_pool_state.swap(pool_state);
+      m_state_revision++;
+    }
+  }
 }
@@ -56,9 +56,12 @@
 #include "wallet/wallet2.h"
 
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/condition_variable.hpp>
 
+#include <exception>
+
 /**
  * Implements a monero_wallet.h by wrapping monero-project's wallet2.
  */
@@ -69,6 +72,112 @@ namespace monero {
   // forward declaration of internal wallet2 listener
   struct wallet2_listener;
 
+  // forward declaration of internal index of confirmed txs
+  struct monero_tx_index;
+
+  // forward declaration of internal running balances
+  struct monero_balance_tracker;
+
+  // forward declaration of internal poller of a daemon connection
+  class monero_daemon_poller;
+
+  // forward declaration of internal lock of wallet state
+  class monero_state_lock;
+
+  // forward declaration of internal timer of daemon requests
+  struct monero_rpc_timer;
+
+  // ------------------------------ WALLET SNAPSHOT ---------------------------
+
+  /**
+   * Immutable view of a wallet's state.
+   *
+   * Readers share the latest snapshot without locking the wallet, so they
+   * do not wait for background syncs. Sync publishes a new snapshot at the end
+   * of each batch and other writers when they release the wallet, built from
+   * the wallet's tx index and running balances; snapshots held by readers stay
+   * valid and their models must not be modified.
+   */
+  struct monero_wallet_snapshot {
+    uint64_t m_height;                                          // wallet height when the snapshot was taken
+    uint64_t m_balance;
+    uint64_t m_unlocked_balance;
+    std::vector<monero_account> m_accounts;                     // accounts with their subaddresses and balances
+    std::vector<std::shared_ptr<const monero_transfer>> m_transfers;  // all transfers with their txs
+    std::vector<std::shared_ptr<const monero_output_wallet>> m_outputs; // all outputs with their txs
+    uint64_t m_revision;                                        // revision of wallet state when the snapshot was taken
+  };
+
+  // -------------------------------- SYNC HANDLE -----------------------------
+
+  /**
+   * Handle to a wallet sync running in the background.
+   */
+  class monero_sync_handle {
+  public:
+
+    /**
+     * Indicates if the sync is done, either completed, cancelled, or failed.
+     */
+    bool is_done() const;
+
+    /**
+     * Wait for the sync to finish.
+     *
+     * @return the sync result, which is partial if the sync was cancelled
+     * @throws the exception which failed the sync
+     */
+    monero_sync_result wait();
+
+    /**
+     * Wait for the sync to finish up to a timeout.
+     *
+     * @param timeout_ms is the maximum time to wait in milliseconds
+     * @return true if the sync is done, false if the timeout elapsed
+     */
+    bool wait_for(uint64_t timeout_ms);
+
+    /**
+     * Cancel the sync without stopping other syncs of the wallet.
+     *
+     * The wallet stops syncing after the block being processed, or skips the
+     * sync if it has not started.
+     */
+    void cancel();
+
+    /**
+     * Indicates if the sync was cancelled.
+     */
+    bool is_cancelled() const { return m_is_cancelled; }
+
+    /**
+     * Get the sync's progress.
+     */
+    boost::optional<uint64_t> get_start_height() const;
+    boost::optional<uint64_t> get_height() const;      // height of the next block to process
+    boost::optional<uint64_t> get_end_height() const;
+    double get_percent_done() const;
+
+  private:
+    friend class monero_wallet_full;
+    friend struct wallet2_listener;
+    friend class monero_state_lock;
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_cv;                  // wakes waiters when done
+    bool m_is_done = false;
+    std::atomic<bool> m_is_cancelled{false};
+    boost::optional<uint64_t> m_start_height;
+    boost::optional<uint64_t> m_height;
+    boost::optional<uint64_t> m_end_height;
+    monero_sync_result m_result;
+    std::exception_ptr m_error;
+    std::function<void()> m_stop;                    // interrupts the sync while running
+
+    void on_start(uint64_t start_height, uint64_t end_height, const std::function<void()>& stop);
+    void on_progress(uint64_t height);
+    void on_done(const monero_sync_result& result, std::exception_ptr error);
+  };
+
   // --------------------------- STATIC WALLET UTILS --------------------------
 
   /**
@@ -205,6 +314,18 @@ namespace monero {
     monero_sync_result sync(uint64_t start_height) override;
     monero_sync_result sync(uint64_t start_height, monero_wallet_listener& listener) override;
     void start_syncing(uint64_t sync_period_in_ms) override;
+
+    /**
+     * Sync the wallet in the background.
+     *
+     * Syncs run one at a time per wallet in request order. Balance and query
+     * calls do not wait for them.
+     *
+     * @param start_height is the start height to sync from (defaults to the last synced height)
+     * @return a handle to track progress, cancel, or wait for the sync
+     */
+    std::shared_ptr<monero_sync_handle> sync_async(boost::optional<uint64_t> start_height = boost::none);
+
     void stop_syncing() override;
     void rescan_spent() override;
     void rescan_blockchain() override;
@@ -221,9 +342,21 @@ namespace monero {
     monero_subaddress create_subaddress(uint32_t account_idx, const std::string& label = "") override;
     std::vector<std::shared_ptr<monero_tx_wallet>> get_txs() const override;
     std::vector<std::shared_ptr<monero_tx_wallet>> get_txs(const monero_tx_query& query) const override;
+    std::vector<std::shared_ptr<monero_tx_wallet>> get_txs(monero_tx_query&& query) const override;
+    std::vector<std::shared_ptr<monero_tx_wallet>> get_txs(const std::shared_ptr<monero_tx_query>& query) const override;
     std::vector<std::shared_ptr<monero_tx_wallet>> get_txs(const monero_tx_query& query, std::vector<std::string>& missing_tx_hashes) const override;
     std::vector<std::shared_ptr<monero_transfer>> get_transfers(const monero_transfer_query& query) const override;
+    std::vector<std::shared_ptr<monero_transfer>> get_transfers(monero_transfer_query&& query) const override;
+    std::vector<std::shared_ptr<monero_transfer>> get_transfers(const std::shared_ptr<monero_transfer_query>& query) const override;
     std::vector<std::shared_ptr<monero_output_wallet>> get_outputs(const monero_output_query& query) const override;
+    std::vector<std::shared_ptr<monero_output_wallet>> get_outputs(monero_output_query&& query) const override;
+    std::vector<std::shared_ptr<monero_output_wallet>> get_outputs(const std::shared_ptr<monero_output_query>& query) const override;
+    void for_each_tx(const monero_tx_query& query, const std::function<bool(const std::shared_ptr<monero_tx_wallet>&)>& visitor, monero_sort_order sort_order = ASCENDING) const override;
+    void for_each_transfer(const monero_transfer_query& query, const std::function<bool(const std::shared_ptr<monero_transfer>&)>& visitor, monero_sort_order sort_order = ASCENDING) const override;
+    void for_each_output(const monero_output_query& query, const std::function<bool(const std::shared_ptr<monero_output_wallet>&)>& visitor, monero_sort_order sort_order = ASCENDING) const override;
+    monero_page<monero_tx_wallet> get_txs_page(const monero_tx_query& query, const monero_page_request& request) const override;
+    monero_page<monero_transfer> get_transfers_page(const monero_transfer_query& query, const monero_page_request& request) const override;
+    monero_page<monero_output_wallet> get_outputs_page(const monero_output_query& query, const monero_page_request& request) const override;
     std::string export_outputs(bool all = false) const override;
     int import_outputs(const std::string& outputs_hex) override;
     std::vector<std::shared_ptr<monero_key_image>> export_key_images(bool all = false) const override;
@@ -285,33 +418,206 @@ namespace monero {
     std::string get_keys_file_buffer(const epee::wipeable_string& password, bool view_only) const;
     std::string get_cache_file_buffer(const epee::wipeable_string& password) const;
 
+    /**
+     * Query transfers and outputs as compact, flat structs with binary hashes
+     * and tx indices instead of shared model graphs.
+     */
+    monero_compact_transfers get_transfers_compact(const monero_transfer_query& query) const;
+    monero_compact_outputs get_outputs_compact(const monero_output_query& query) const;
+
+    /**
+     * Allocate each query's models from one arena which is released at once
+     * when the last of the query's results is destroyed (default false).
+     *
+     * Reduces allocations for large queries; results retained from the query
+     * keep its whole arena alive.
+     */
+    void set_query_arena_enabled(bool enabled) { m_query_arena_enabled = enabled; }
+    bool is_query_arena_enabled() const { return m_query_arena_enabled; }
+
+    /**
+     * Save the rings of new outgoing txs to the shared ring database after
+     * each sync (default true).
+     *
+     * Only txs confirmed since the rings were last saved are processed, from
+     * the rings the wallet recorded when scanning them. Txs skipped while
+     * disabled are saved on the next sync after re-enabling.
+     */
+    void set_save_rings_on_sync(bool enabled) { m_save_rings_on_sync = enabled; }
+    bool is_save_rings_on_sync() const { return m_save_rings_on_sync; }
+
+    /**
+     * Throttle sync progress notifications to listeners (default every block).
+     *
+     * Progress is notified when either interval elapses since the last
+     * notification. The last block of each sync is always notified.
+     *
+     * @param interval_blocks is the number of blocks between progress notifications
+     * @param interval_ms is the time between progress notifications in milliseconds, or 0 to notify by blocks only
+     */
+    void set_sync_progress_interval(uint64_t interval_blocks, uint64_t interval_ms) {
+      m_sync_progress_interval_blocks = std::max(interval_blocks, (uint64_t) 1);
+      m_sync_progress_interval_ms = interval_ms;
+    }
+
+    /**
+     * Start background synchronizing, optionally only when the daemon changes.
+     *
+     * When adaptive, one poller per daemon connection checks the daemon's
+     * height, top block, and pool size every sync period and wakes its
+     * wallets only when they change. Polls and syncs back off after errors.
+     *
+     * @param sync_period_in_ms is the maximum period between syncs, or between daemon polls if adaptive
+     * @param adaptive specifies if the wallet syncs only when the daemon changes
+     */
+    void start_syncing(uint64_t sync_period_in_ms, bool adaptive);
+
+    /**
+     * Get the current period between syncs or daemon polls including back off after errors.
+     *
+     * @return the effective background sync interval in milliseconds
+     */
+    uint64_t get_effective_sync_interval() const;
+
+    /**
+     * Daemon status is cached briefly and shared by wallets with the same
+     * daemon connection. These overloads bypass the cache when fresh status
+     * is required.
+     *
+     * @param bypass_cache specifies if the daemon is requested directly
+     */
+    bool is_connected_to_daemon(bool bypass_cache) const;
+    bool is_daemon_synced(bool bypass_cache) const;
+    uint64_t get_daemon_height(bool bypass_cache) const;
+    uint64_t get_daemon_max_peer_height(bool bypass_cache) const;
+
+    /**
+     * Verify each balance served from the wallet's running balances against
+     * a full recomputation by wallet2 and throw if they differ (for tests).
+     */
+    void set_balance_check_enabled(bool check_enabled);
+
+    /**
+     * Get statistics of the wallet's syncs since it was opened, including
+     * throughput, daemon traffic, and time spent in each stage.
+     *
+     * @return the wallet's cumulative sync statistics
+     */
+    monero_sync_stats get_sync_stats() const;
+
+    /**
+     * Get the latest snapshot of the wallet's state.
+     *
+     * Reading the snapshot costs an atomic load instead of locking the wallet.
+     * Snapshots are published by the writer at the end of each sync batch or
+     * other change to the wallet (e.g. creating txs or accounts), so readers
+     * never rebuild them; only the first call before any change builds one.
+     *
+     * @return the latest snapshot of the wallet's state
+     */
+    std::shared_ptr<const monero_wallet_snapshot> get_snapshot() const;
+
+    /**
+     * Get the number of tx queries which built a confirmed tx without a block.
+     *
+     * Queries used to re-fetch until their wallet2 calls agreed; they now
+     * read one view of the wallet's state, so this should remain 0.
+     *
+     * @return the number of inconsistent tx queries since the wallet was opened
+     */
+    uint64_t get_num_inconsistent_queries() const;
+
     // --------------------------------- PRIVATE --------------------------------
 
   private:
     friend struct wallet2_listener;
     std::unique_ptr<tools::wallet2> m_w2;            // internal wallet implementation
+    std::unique_ptr<monero_tx_index> m_tx_index;     // internal index of confirmed txs maintained during sync
+    std::unique_ptr<monero_balance_tracker> m_balance_tracker; // internal running balances maintained during sync
     std::unique_ptr<wallet2_listener> m_w2_listener; // internal wallet implementation listener
+    std::shared_ptr<monero_rpc_timer> m_rpc_timer;   // time and traffic of wallet2's daemon requests
+    epee::net_utils::http::http_client_factory* m_http_client_factory = nullptr; // creates clients like wallet2's; owned by wallet2
     std::set<monero_wallet_listener*> m_listeners;   // external wallet listeners
+    std::atomic<bool> m_query_arena_enabled;         // allocate each query's models from one arena
+    mutable boost::shared_mutex m_state_mutex;       // readers share wallet state while sync and other writers hold it exclusively
+    mutable boost::mutex m_writer_mutex;             // held by writers for their whole change, so sync yields its state only to readers
+    mutable std::atomic<int> m_num_waiting_readers{0}; // readers waiting for the running sync to yield wallet state
+    monero_state_lock* m_sync_state_lock = nullptr;  // exclusive lock of the running sync, which yields to readers between blocks
+    mutable std::shared_ptr<const monero_wallet_snapshot> m_snapshot; // latest published snapshot; accessed with std::atomic_load() and std::atomic_store()
+    mutable std::atomic<uint64_t> m_state_revision{0}; // incremented when wallet state changes other than by height
+    mutable boost::mutex m_snapshot_mutex;           // synchronize building snapshots
+    std::vector<std::pair<crypto::hash, int>> m_pool_state; // sorted unconfirmed txs and their states after the last sync
+    mutable std::atomic<uint64_t> m_num_inconsistent_queries{0}; // tx queries which built a confirmed tx without a block
+    void publish_snapshot() const;                   // publish a new snapshot if the wallet changed; caller must hold the state lock exclusively
+    std::shared_ptr<const monero_wallet_snapshot> build_snapshot() const; // caller must hold the state lock
+    void track_pool_changes();                       // bump the state revision if unconfirmed txs changed without callbacks; caller must hold the state lock exclusively
 
     void init_common();
-    std::vector<monero_subaddress> get_subaddresses_aux(uint32_t account_idx, const std::vector<uint32_t>& subaddress_indices, const std::vector<tools::wallet2::transfer_details>& transfers) const;
-    std::vector<std::shared_ptr<monero_transfer>> get_transfers_aux(const monero_transfer_query& query) const;
-    std::vector<std::shared_ptr<monero_output_wallet>> get_outputs_aux(const monero_output_query& query) const;
+    std::vector<monero_subaddress> get_subaddresses_aux(uint32_t account_idx, const std::vector<uint32_t>& subaddress_indices) const;
+    std::vector<std::shared_ptr<monero_tx_wallet>> get_txs_aux(const std::shared_ptr<monero_tx_query>& query, std::vector<std::string>& missing_tx_hashes) const;  // queries are normalized and owned by the call
+    std::vector<std::shared_ptr<monero_transfer>> get_transfers_aux(const std::shared_ptr<monero_transfer_query>& query, bool update_pool = true) const;  // pool state is fetched from the daemon unless update_pool is false
+    std::vector<std::shared_ptr<monero_output_wallet>> get_outputs_aux(const std::shared_ptr<monero_output_query>& query) const;
+    void for_each_window(uint64_t min_height, uint64_t max_height, bool include_unconfirmed, monero_sort_order sort_order, const boost::optional<monero_page_cursor>& start_cursor, const std::function<bool(const boost::optional<std::pair<uint64_t, uint64_t>>&)>& visit_window) const;  // visit height windows of about equal size in sort order, none for unconfirmed
+    void for_each_tx_aux(const monero_tx_query& query, const std::function<bool(const std::shared_ptr<monero_tx_wallet>&)>& visitor, monero_sort_order sort_order, const boost::optional<monero_page_cursor>& start_cursor, bool free_visited) const;
+    void for_each_transfer_aux(const monero_transfer_query& query, const std::function<bool(const std::shared_ptr<monero_transfer>&)>& visitor, monero_sort_order sort_order, const boost::optional<monero_page_cursor>& start_cursor, bool free_visited) const;
+    void for_each_output_aux(const monero_output_query& query, const std::function<bool(const std::shared_ptr<monero_output_wallet>&)>& visitor, monero_sort_order sort_order, const boost::optional<monero_page_cursor>& start_cursor, bool free_visited) const;
     std::vector<std::shared_ptr<monero_tx_wallet>> sweep_account(const monero_tx_config& config);  // sweeps unlocked funds within an account; private helper to sweep_unlocked()
 
     // blockchain sync management
     mutable std::atomic<bool> m_is_synced;       // whether or not wallet is synced
     mutable std::atomic<bool> m_is_connected;    // cache connection status to avoid unecessary RPC calls
-    boost::condition_variable m_sync_cv;         // to make sync threads woke
+    boost::condition_variable m_sync_cv;         // to wake threads waiting for the sync loop to stop
     boost::mutex m_sync_mutex;                   // synchronize sync() and syncAsync() requests
     std::atomic<bool> m_rescan_on_sync;          // whether or not to rescan on sync
     std::atomic<bool> m_syncing_enabled;         // whether or not auto sync is enabled
-    std::atomic<bool> m_sync_loop_running;       // whether or not the syncing thread is shut down
+    std::atomic<bool> m_sync_loop_running;       // whether or not a sync is scheduled or running on the shared scheduler
     std::atomic<int> m_syncing_interval;         // auto sync loop interval in milliseconds
-    boost::thread m_syncing_thread;              // thread for auto sync loop
+    uint64_t m_sync_timer_id;                    // scheduler timer of the next auto sync
     boost::mutex m_syncing_mutex;                // synchronize auto sync loop
-    void run_sync_loop();                        // run the sync loop in a thread
-    monero_sync_result lock_and_sync(boost::optional<uint64_t> start_height = boost::none);  // internal function to synchronize request to sync and rescan
+    void run_sync_loop();                        // run the sync loop on the shared scheduler
+    void schedule_sync(uint64_t delay_ms);       // schedule the next auto sync; caller must hold m_syncing_mutex
+    std::atomic<bool> m_syncing_adaptive{false}; // whether or not auto sync waits for daemon changes
+    bool m_sync_requested;                       // sync again after the running auto sync; guarded by m_syncing_mutex
+    std::atomic<uint64_t> m_sync_retry_ms;       // back off before retrying a failed adaptive sync
+    std::shared_ptr<monero_daemon_poller> m_daemon_poller; // shared poller and status cache of the daemon connection
+    epee::net_utils::ssl_support_t m_daemon_ssl_support = epee::net_utils::ssl_support_t::e_ssl_support_disabled; // ssl support of wallet2's daemon connection, shared with the poller
+    std::string m_daemon_proxy;                  // proxy of wallet2's daemon connection, shared with the poller (none by default)
+    boost::optional<uint64_t> m_daemon_poller_subscription_id; // subscription to the daemon poller if syncing adaptively
+    mutable boost::mutex m_daemon_poller_mutex;  // synchronize daemon poller subscription
+    void request_sync();                         // run an auto sync now or after the running one
+    void update_daemon_poller();                 // share the daemon connection's poller and subscribe iff syncing adaptively
+    std::shared_ptr<monero_daemon_poller> get_daemon_poller() const;
+    monero_sync_result lock_and_sync(boost::optional<uint64_t> start_height = boost::none, const std::shared_ptr<monero_sync_handle>& sync_handle = nullptr);  // internal function to synchronize request to sync and rescan
+    std::shared_ptr<monero_sync_handle> m_sync_handle;  // handle of the running background sync if any
+    std::set<std::shared_ptr<monero_sync_handle>> m_pending_sync_handles; // background syncs requested and not done; guarded by m_syncing_mutex
+    mutable boost::mutex m_sync_handle_mutex;    // synchronize handle of the running sync
+    std::shared_ptr<monero_sync_handle> get_sync_handle() const;
     monero_sync_result sync_aux(boost::optional<uint64_t> start_height = boost::none);       // internal function to immediately block, sync, and report progress
+
+    // sync statistics
+    struct sync_counters {
+      uint64_t m_time_us;
+      uint64_t m_rpc_us;
+      uint64_t m_num_rpcs;
+      uint64_t m_fetch_us;
+      uint64_t m_num_fetches;
+      uint64_t m_bytes_received;
+      uint64_t m_bytes_sent;
+      uint64_t m_notify_us;
+      uint64_t m_num_txs_scanned;
+    };
+    monero_sync_stats m_sync_stats;              // cumulative statistics of syncs
+    mutable boost::mutex m_sync_stats_mutex;     // synchronize sync statistics
+    sync_counters get_sync_counters() const;     // read counters to measure a sync by difference
+
+    // ring saving
+    std::atomic<bool> m_save_rings_on_sync;      // whether or not to save rings of new outgoing txs after each sync
+    bool m_ring_history_checked;                 // whether or not wallet2 saved rings of txs before the wallet was opened
+    uint64_t m_rings_saved_height;               // height before which rings of confirmed outgoing txs are saved
+    uint64_t save_rings(uint64_t from_height);   // save rings of outgoing txs confirmed from a height and return the number of txs
+
+    // sync progress throttling
+    std::atomic<uint64_t> m_sync_progress_interval_blocks; // number of blocks between sync progress notifications
+    std::atomic<uint64_t> m_sync_progress_interval_ms;     // time between sync progress notifications
   };
 }
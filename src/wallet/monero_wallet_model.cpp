@@ -90,6 +90,41 @@ namespace monero {
     return block;
   }
 
+  // -------------------------- MONERO SYNC TIMINGS ---------------------------
+
+  void monero_sync_timings::add(const monero_sync_timings& timings) {
+    m_fetch_ms += timings.m_fetch_ms;
+    m_num_fetches += timings.m_num_fetches;
+    m_rpc_ms += timings.m_rpc_ms;
+    m_num_rpcs += timings.m_num_rpcs;
+    m_refresh_ms += timings.m_refresh_ms;
+    m_scan_ms += timings.m_scan_ms;
+    m_rings_ms += timings.m_rings_ms;
+    m_notify_ms += timings.m_notify_ms;
+    m_total_ms += timings.m_total_ms;
+  }
+
+  rapidjson::Value monero_sync_timings::to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const {
+
+    // create root
+    rapidjson::Value root(rapidjson::kObjectType);
+
+    // set num values
+    rapidjson::Value value_num(rapidjson::kNumberType);
+    monero_utils::add_json_member("fetchMs", m_fetch_ms, allocator, root, value_num);
+    monero_utils::add_json_member("numFetches", m_num_fetches, allocator, root, value_num);
+    monero_utils::add_json_member("rpcMs", m_rpc_ms, allocator, root, value_num);
+    monero_utils::add_json_member("numRpcs", m_num_rpcs, allocator, root, value_num);
+    monero_utils::add_json_member("refreshMs", m_refresh_ms, allocator, root, value_num);
+    monero_utils::add_json_member("scanMs", m_scan_ms, allocator, root, value_num);
+    monero_utils::add_json_member("ringsMs", m_rings_ms, allocator, root, value_num);
+    monero_utils::add_json_member("notifyMs", m_notify_ms, allocator, root, value_num);
+    monero_utils::add_json_member("totalMs", m_total_ms, allocator, root, value_num);
+
+    // return root
+    return root;
+  }
+
   // -------------------------- MONERO SYNC RESULT ----------------------------
 
   rapidjson::Value monero_sync_result::to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const {
@@ -100,10 +135,47 @@ namespace monero {
     // set num values
     rapidjson::Value value_num(rapidjson::kNumberType);
     monero_utils::add_json_member("numBlocksFetched", m_num_blocks_fetched, allocator, root, value_num);
+    monero_utils::add_json_member("numTxsScanned", m_num_txs_scanned, allocator, root, value_num);
+    monero_utils::add_json_member("bytesReceived", m_bytes_received, allocator, root, value_num);
+    monero_utils::add_json_member("bytesSent", m_bytes_sent, allocator, root, value_num);
+    monero_utils::add_json_member("blocksPerSecond", m_blocks_per_second, allocator, root, value_num);
+    monero_utils::add_json_member("txsPerSecond", m_txs_per_second, allocator, root, value_num);
+    monero_utils::add_json_member("maxNotificationQueueDepth", m_max_notification_queue_depth, allocator, root, value_num);
+    monero_utils::add_json_member("numRingsSaved", m_num_rings_saved, allocator, root, value_num);
 
     // set bool values
     monero_utils::add_json_member("receivedMoney", m_received_money, allocator, root);
 
+    // set sub-objects
+    root.AddMember("timings", m_timings.to_rapidjson_val(allocator), allocator);
+
+    // return root
+    return root;
+  }
+
+  // -------------------------- MONERO SYNC STATS -----------------------------
+
+  rapidjson::Value monero_sync_stats::to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const {
+
+    // create root
+    rapidjson::Value root(rapidjson::kObjectType);
+
+    // set num values
+    rapidjson::Value value_num(rapidjson::kNumberType);
+    monero_utils::add_json_member("numSyncs", m_num_syncs, allocator, root, value_num);
+    monero_utils::add_json_member("numFailedSyncs", m_num_failed_syncs, allocator, root, value_num);
+    monero_utils::add_json_member("numBlocksFetched", m_num_blocks_fetched, allocator, root, value_num);
+    monero_utils::add_json_member("numTxsScanned", m_num_txs_scanned, allocator, root, value_num);
+    monero_utils::add_json_member("bytesReceived", m_bytes_received, allocator, root, value_num);
+    monero_utils::add_json_member("bytesSent", m_bytes_sent, allocator, root, value_num);
+    monero_utils::add_json_member("notificationQueueDepth", m_notification_queue_depth, allocator, root, value_num);
+    monero_utils::add_json_member("maxNotificationQueueDepth", m_max_notification_queue_depth, allocator, root, value_num);
+    monero_utils::add_json_member("numRingsSaved", m_num_rings_saved, allocator, root, value_num);
+
+    // set sub-objects
+    root.AddMember("timings", m_timings.to_rapidjson_val(allocator), allocator);
+    if (m_last_result != boost::none) root.AddMember("lastResult", m_last_result.get().to_rapidjson_val(allocator), allocator);
+
     // return root
     return root;
   }
@@ -148,6 +220,8 @@ namespace monero {
     if (m_unlocked_balance != boost::none) monero_utils::add_json_member("unlockedBalance", m_unlocked_balance.get(), allocator, root, value_num);
     if (m_num_unspent_outputs != boost::none) monero_utils::add_json_member("numUnspentOutputs", m_num_unspent_outputs.get(), allocator, root, value_num);
     if (m_num_blocks_to_unlock) monero_utils::add_json_member("numBlocksToUnlock", m_num_blocks_to_unlock.get(), allocator, root, value_num);
+    if (m_first_seen_height != boost::none) monero_utils::add_json_member("firstSeenHeight", m_first_seen_height.get(), allocator, root, value_num);
+    if (m_last_seen_height != boost::none) monero_utils::add_json_member("lastSeenHeight", m_last_seen_height.get(), allocator, root, value_num);
 
     // set string values
     rapidjson::Value value_str(rapidjson::kStringType);
@@ -1445,4 +1519,58 @@ namespace monero {
     // return root
     return root;
   }
+
+  // --------------------------- MONERO PAGE CURSOR ---------------------------
+
+  monero_page_cursor monero_page_cursor::of(const monero_tx_wallet& tx) {
+    monero_page_cursor cursor;
+    boost::optional<uint64_t> height = tx.get_height();
+    cursor.m_height = height == boost::none ? std::numeric_limits<uint64_t>::max() : *height;
+    cursor.m_tx_hash = tx.m_hash == boost::none ? "" : *tx.m_hash;
+    cursor.m_ordinal = 0;
+    return cursor;
+  }
+
+  monero_page_cursor monero_page_cursor::of(const monero_transfer& transfer) {
+    if (transfer.m_tx == nullptr) throw std::runtime_error("Transfer must have tx to page");
+    monero_page_cursor cursor = of(*transfer.m_tx);
+    const monero_incoming_transfer* incoming_transfer = dynamic_cast<const monero_incoming_transfer*>(&transfer);
+    if (incoming_transfer != nullptr) cursor.m_ordinal = 1 + (((uint64_t) incoming_transfer->m_account_index.get()) << 32 | incoming_transfer->m_subaddress_index.get()); // outgoing transfer is first
+    return cursor;
+  }
+
+  monero_page_cursor monero_page_cursor::of(const monero_output_wallet& output) {
+    if (output.m_tx == nullptr) throw std::runtime_error("Output must have tx to page");
+    monero_page_cursor cursor = of(*std::static_pointer_cast<monero_tx_wallet>(output.m_tx));
+    cursor.m_ordinal = output.m_index == boost::none ? 0 : *output.m_index;
+    return cursor;
+  }
+
+  monero_page_cursor monero_page_cursor::from_token(const std::string& token) {
+    size_t separator1 = token.find(':');
+    size_t separator2 = separator1 == std::string::npos ? std::string::npos : token.find(':', separator1 + 1);
+    if (separator2 == std::string::npos) throw std::runtime_error("Invalid resume token: " + token);
+    monero_page_cursor cursor;
+    try {
+      cursor.m_height = std::stoull(token.substr(0, separator1));
+      cursor.m_tx_hash = token.substr(separator1 + 1, separator2 - separator1 - 1);
+      cursor.m_ordinal = std::stoull(token.substr(separator2 + 1));
+    } catch (const std::exception& e) {
+      throw std::runtime_error("Invalid resume token: " + token);
+    }
+    return cursor;
+  }
+
+  std::string monero_page_cursor::to_token() const {
+    return std::to_string(m_height) + ":" + m_tx_hash + ":" + std::to_string(m_ordinal);
+  }
+
+  bool monero_page_cursor::is_before(const monero_page_cursor& other, monero_sort_order sort_order) const {
+    const monero_page_cursor& first = sort_order == DESCENDING ? other : *this;
+    const monero_page_cursor& second = sort_order == DESCENDING ? *this : other;
+    if (first.m_height != second.m_height) return first.m_height < second.m_height;
+    int hash_compare = first.m_tx_hash.compare(second.m_tx_hash);
+    if (hash_compare != 0) return hash_compare < 0;
+    return first.m_ordinal < second.m_ordinal;
+  }
 }
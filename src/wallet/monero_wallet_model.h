@@ -53,6 +53,7 @@
 #pragma once
 
 #include "daemon/monero_daemon_model.h"
+#include <array>
 
 using namespace monero;
 
@@ -61,14 +62,67 @@ using namespace monero;
  */
 namespace monero {
 
+  /**
+   * Models the time spent in each stage of syncing a wallet.
+   *
+   * Blocks are fetched on a separate thread while previously fetched blocks
+   * are parsed and scanned, so fetch time overlaps refresh time.
+   */
+  struct monero_sync_timings : public serializable_struct {
+    uint64_t m_fetch_ms;      // time fetching blocks and block hashes from the daemon
+    uint64_t m_num_fetches;   // number of block and block hash requests to the daemon
+    uint64_t m_rpc_ms;        // time in all daemon requests including fetching blocks
+    uint64_t m_num_rpcs;      // number of daemon requests including block requests
+    uint64_t m_refresh_ms;    // time fetching, parsing, and scanning blocks and updating wallet state
+    uint64_t m_scan_ms;       // refresh time not spent notifying listeners or in daemon requests other than fetching blocks
+    uint64_t m_rings_ms;      // time finding and saving rings of outgoing txs
+    uint64_t m_notify_ms;     // time notifying listeners during and at the end of the sync
+    uint64_t m_total_ms;
+    monero_sync_timings() : m_fetch_ms(0), m_num_fetches(0), m_rpc_ms(0), m_num_rpcs(0), m_refresh_ms(0), m_scan_ms(0), m_rings_ms(0), m_notify_ms(0), m_total_ms(0) {}
+
+    void add(const monero_sync_timings& timings);
+    rapidjson::Value to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const;
+  };
+
   /**
    * Models a result of syncing a wallet.
    */
   struct monero_sync_result : public serializable_struct {
     uint64_t m_num_blocks_fetched;
     bool m_received_money;
-    monero_sync_result() {}
-    monero_sync_result(const uint64_t num_blocks_fetched, const bool received_money) : m_num_blocks_fetched(num_blocks_fetched), m_received_money(received_money) {}
+    uint64_t m_num_txs_scanned;               // number of txs in scanned blocks including miner txs
+    uint64_t m_bytes_received;                // bytes received from the daemon
+    uint64_t m_bytes_sent;                    // bytes sent to the daemon
+    double m_blocks_per_second;
+    double m_txs_per_second;
+    uint64_t m_max_notification_queue_depth;  // maximum number of notifications queued for listeners
+    uint64_t m_num_rings_saved;               // number of new outgoing txs whose rings were saved
+    monero_sync_timings m_timings;
+    monero_sync_result() : m_num_blocks_fetched(0), m_received_money(false), m_num_txs_scanned(0), m_bytes_received(0), m_bytes_sent(0), m_blocks_per_second(0), m_txs_per_second(0), m_max_notification_queue_depth(0), m_num_rings_saved(0) {}
+    monero_sync_result(const uint64_t num_blocks_fetched, const bool received_money) : monero_sync_result() {
+      m_num_blocks_fetched = num_blocks_fetched;
+      m_received_money = received_money;
+    }
+
+    rapidjson::Value to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const;
+  };
+
+  /**
+   * Models the cumulative statistics of a wallet's syncs.
+   */
+  struct monero_sync_stats : public serializable_struct {
+    uint64_t m_num_syncs;
+    uint64_t m_num_failed_syncs;
+    uint64_t m_num_blocks_fetched;
+    uint64_t m_num_txs_scanned;
+    uint64_t m_bytes_received;
+    uint64_t m_bytes_sent;
+    uint64_t m_notification_queue_depth;      // number of notifications currently queued for listeners
+    uint64_t m_max_notification_queue_depth;  // maximum number of notifications queued for listeners
+    uint64_t m_num_rings_saved;
+    monero_sync_timings m_timings;            // total time in each stage of all syncs
+    boost::optional<monero_sync_result> m_last_result;
+    monero_sync_stats() : m_num_syncs(0), m_num_failed_syncs(0), m_num_blocks_fetched(0), m_num_txs_scanned(0), m_bytes_received(0), m_bytes_sent(0), m_notification_queue_depth(0), m_max_notification_queue_depth(0), m_num_rings_saved(0) {}
 
     rapidjson::Value to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const;
   };
@@ -86,6 +140,8 @@ namespace monero {
     boost::optional<uint64_t> m_num_unspent_outputs;
     boost::optional<bool> m_is_used;
     boost::optional<uint64_t> m_num_blocks_to_unlock;
+    boost::optional<uint64_t> m_first_seen_height;
+    boost::optional<uint64_t> m_last_seen_height;
 
     rapidjson::Value to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const;
   };
@@ -477,4 +533,173 @@ namespace monero {
     monero_address_book_entry(uint64_t index, const std::string& address, const std::string& description, const std::string& payment_id) : m_index(index), m_address(address), m_description(description), m_payment_id(payment_id) {}
     rapidjson::Value to_rapidjson_val(rapidjson::Document::AllocatorType& allocator) const;
   };
+
+  /**
+   * Enumerates the orders to sort paged query results by height.
+   */
+  enum monero_sort_order : uint8_t {
+    ASCENDING = 0,
+    DESCENDING
+  };
+
+  /**
+   * Requests a page of wallet query results ordered by height.
+   *
+   * Confirmed results are ordered by height, then tx hash, then position within
+   * the tx, and unconfirmed results sort after confirmed results.
+   */
+  struct monero_page_request {
+    boost::optional<uint64_t> m_limit;            // maximum number of results to return (default all)
+    boost::optional<uint64_t> m_offset;           // number of results to skip after the resume token if given
+    boost::optional<std::string> m_resume_token;  // token from a previous page to resume after its last result
+    monero_sort_order m_sort_order = ASCENDING;
+  };
+
+  /**
+   * Models a page of wallet query results.
+   */
+  template <class T>
+  struct monero_page {
+    std::vector<std::shared_ptr<T>> m_results;
+    boost::optional<std::string> m_resume_token;  // token to request the next page, none if no results remain
+  };
+
+  /**
+   * Position of a wallet query result used to order and resume paged queries.
+   */
+  struct monero_page_cursor {
+    uint64_t m_height;        // height of the result's tx, max value if unconfirmed
+    std::string m_tx_hash;    // hash of the result's tx
+    uint64_t m_ordinal;       // position of the result within its tx
+
+    static monero_page_cursor of(const monero_tx_wallet& tx);
+    static monero_page_cursor of(const monero_transfer& transfer);
+    static monero_page_cursor of(const monero_output_wallet& output);
+    static monero_page_cursor from_token(const std::string& token);
+    std::string to_token() const;
+    bool is_before(const monero_page_cursor& other, monero_sort_order sort_order) const;
+  };
+
+  /**
+   * Collects a page of query results which are added in sorted order.
+   */
+  template <class T>
+  class monero_pager {
+  public:
+    monero_pager(const monero_page_request& request) : m_request(request), m_num_skipped(0), m_has_more(false) {
+      if (request.m_resume_token != boost::none) m_resume_cursor = monero_page_cursor::from_token(*request.m_resume_token);
+    }
+
+    /**
+     * Get the cursor to resume after, if any.
+     */
+    const boost::optional<monero_page_cursor>& get_resume_cursor() const { return m_resume_cursor; }
+
+    /**
+     * Add the next result in sorted order.
+     *
+     * @param result is the next result
+     * @return true to continue adding results, false if the page is full
+     */
+    bool add(const std::shared_ptr<T>& result) {
+      monero_page_cursor cursor = monero_page_cursor::of(*result);
+      if (m_resume_cursor != boost::none && !m_resume_cursor->is_before(cursor, m_request.m_sort_order)) return true;
+      if (m_request.m_offset != boost::none && m_num_skipped < *m_request.m_offset) {
+        m_num_skipped++;
+        return true;
+      }
+      if (m_request.m_limit != boost::none && m_page.m_results.size() >= *m_request.m_limit) {
+        m_has_more = true;
+        return false;
+      }
+      m_page.m_results.push_back(result);
+      m_last_cursor = cursor;
+      return true;
+    }
+
+    /**
+     * Get the collected page.
+     */
+    monero_page<T> get_page() const {
+      monero_page<T> page = m_page;
+      if (m_has_more && m_last_cursor != boost::none) page.m_resume_token = m_last_cursor->to_token();
+      return page;
+    }
+
+  private:
+    monero_page_request m_request;
+    boost::optional<monero_page_cursor> m_resume_cursor;
+    boost::optional<monero_page_cursor> m_last_cursor;
+    uint64_t m_num_skipped;
+    bool m_has_more;
+    monero_page<T> m_page;
+  };
+
+  /**
+   * 32-byte binary hash or key (tx hash, key image, public key).
+   */
+  typedef std::array<uint8_t, 32> monero_hash32;
+
+  /**
+   * Compact wallet transaction referenced by index from compact transfers and outputs.
+   */
+  struct monero_compact_tx {
+    monero_hash32 m_hash = monero_hash32();
+    uint64_t m_height = 0;         // 0 if unconfirmed
+    uint64_t m_timestamp = 0;      // block timestamp, 0 if unconfirmed
+    uint64_t m_fee = 0;
+    uint64_t m_unlock_height = 0;
+    bool m_is_confirmed = false;
+    bool m_in_tx_pool = false;
+    bool m_is_failed = false;
+    bool m_is_locked = false;
+  };
+
+  /**
+   * Compact wallet transfer with plain fields and no back-references.
+   */
+  struct monero_compact_transfer {
+    uint32_t m_tx_idx = 0;                  // index of the transfer's tx in the result's txs
+    uint32_t m_account_index = 0;
+    uint32_t m_subaddress_indices_idx = 0;  // index of the transfer's first subaddress index in the result's subaddress indices
+    uint32_t m_num_subaddress_indices = 0;  // number of subaddress indices (1 if incoming)
+    uint64_t m_amount = 0;
+    bool m_is_incoming = false;
+  };
+
+  /**
+   * Compact wallet output with plain fields and no back-references.
+   */
+  struct monero_compact_output {
+    uint32_t m_tx_idx = 0;                  // index of the output's tx in the result's txs
+    uint32_t m_account_index = 0;
+    uint32_t m_subaddress_index = 0;
+    uint64_t m_amount = 0;
+    uint64_t m_index = 0;                   // global output index
+    monero_hash32 m_key_image = monero_hash32();  // all zeros if unknown
+    monero_hash32 m_stealth_public_key = monero_hash32();
+    bool m_is_spent = false;
+    bool m_is_frozen = false;
+  };
+
+  /**
+   * Compact transfers and their txs in height order.
+   *
+   * Plain value types which need no cycle breaking (see monero_utils::free()).
+   */
+  struct monero_compact_transfers {
+    std::vector<monero_compact_tx> m_txs;
+    std::vector<monero_compact_transfer> m_transfers;
+    std::vector<uint32_t> m_subaddress_indices;  // subaddress indices of transfers, sliced by each transfer
+  };
+
+  /**
+   * Compact outputs and their txs in height order.
+   *
+   * Plain value types which need no cycle breaking (see monero_utils::free()).
+   */
+  struct monero_compact_outputs {
+    std::vector<monero_compact_tx> m_txs;
+    std::vector<monero_compact_output> m_outputs;
+  };
 }
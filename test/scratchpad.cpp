@@ -1,10 +1,28 @@
 #include <stdio.h>
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
 #include "wallet2.h"
 #include "wallet/monero_wallet_full.h"
 
 using namespace std;
 
+// count heap allocations to compare query arenas on and off
+static atomic<uint64_t> NUM_ALLOCATIONS(0);
+
+void* operator new(size_t size) {
+  NUM_ALLOCATIONS++;
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) throw bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
 /**
  * Scratchpad main entry point.
  */
@@ -29,7 +47,7 @@ int main(int argc, const char* argv[]) {
   int network_type = 2;
 
   // load wallet
-  monero_wallet* wallet = monero_wallet_full::open_wallet("../../test_wallets/test_wallet_1", "supersecretpassword123", monero_network_type::STAGENET);
+  monero_wallet_full* wallet = monero_wallet_full::open_wallet("../../test_wallets/test_wallet_1", "supersecretpassword123", monero_network_type::STAGENET);
   wallet->set_daemon_connection("http://localhost:38081", "", "");
 
   // fetch txs
@@ -38,4 +56,39 @@ int main(int argc, const char* argv[]) {
   for (int i = 0; i < txs.size() && i < 10; i++) {
     MINFO(txs[i]->serialize());
   }
+
+  // page through txs in both orders and check pages round-trip to all txs
+  vector<vector<string>> paged_hashes;
+  for (monero_sort_order sort_order : {ASCENDING, DESCENDING}) {
+    vector<string> hashes;
+    monero_page_request request;
+    request.m_limit = 5;
+    request.m_sort_order = sort_order;
+    do {
+      monero_page<monero_tx_wallet> page = wallet->get_txs_page(monero_tx_query(), request);
+      for (const shared_ptr<monero_tx_wallet>& tx : page.m_results) hashes.push_back(tx->m_hash.get());
+      request.m_resume_token = page.m_resume_token;
+    } while (request.m_resume_token != boost::none);
+    if (hashes.size() != txs.size()) throw runtime_error("Paged " + to_string(hashes.size()) + " txs in " + (sort_order == ASCENDING ? "ascending" : "descending") + " order but wallet has " + to_string(txs.size()));
+    paged_hashes.push_back(hashes);
+  }
+  if (!equal(paged_hashes[0].begin(), paged_hashes[0].end(), paged_hashes[1].rbegin())) throw runtime_error("Descending pages are not the reverse of ascending pages");
+  MINFO("Paged " << txs.size() << " txs in both orders");
+
+  // compare allocations and latency of transfer and output queries with query arenas off and on
+  const int num_iterations = 10;
+  for (bool arena_enabled : {false, true}) {
+    wallet->set_query_arena_enabled(arena_enabled);
+    wallet->get_transfers(monero_transfer_query()); // warm up
+    uint64_t num_allocations = NUM_ALLOCATIONS;
+    auto start = chrono::steady_clock::now();
+    size_t num_results = 0;
+    for (int i = 0; i < num_iterations; i++) {
+      num_results += wallet->get_transfers(monero_transfer_query()).size();
+      num_results += wallet->get_outputs(monero_output_query()).size();
+    }
+    uint64_t elapsed_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    MINFO("Query arena " << (arena_enabled ? "on" : "off") << ": " << (NUM_ALLOCATIONS - num_allocations) / num_iterations << " allocations and " << elapsed_us / num_iterations << " us per iteration of " << num_results / num_iterations << " transfers and outputs");
+  }
+  wallet->set_query_arena_enabled(false);
 }